@@ -1,63 +1,40 @@
 #include "configlib.h"
+#include "hashlib.h"
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CONFIG_CACHE_SUFFIX ".cache"
+#define CONFIG_CACHE_MAGIC 0x4643504fu // "OPCF"
+// Bump whenever the image layout or OpConfig's fields change.
+#define CONFIG_CACHE_VERSION 7u
+#define CONFIG_CACHE_NONE UINT32_MAX
 
 typedef struct {
-  const char *cur;
-  const char *end;
+  char *cur;
+  char *end;
   const char *error;
+  // Room reserved in the config block for the arrays; see loadConfigs.
+  size_t object_capacity;
+  size_t string_capacity;
 } JsonParser;
 
-static void free_custom_entry(OpCustomEntry *entry) {
-  if (!entry) {
-    return;
-  }
-
-  free(entry->name);
-  free(entry->win_path);
-  free(entry->linux_path);
-  entry->name = NULL;
-  entry->win_path = NULL;
-  entry->linux_path = NULL;
-}
-
-static void free_custom_command(OpCustomCommand *command) {
-  if (!command) {
-    return;
-  }
-
-  free(command->name);
-  free(command->command);
-  command->name = NULL;
-  command->command = NULL;
-}
-
+// The whole config is a single allocation, so there is nothing to walk; a
+// config read from the cache also holds the mapping its strings point into.
 void freeConfig(OpConfig *config) {
-  size_t i = 0;
-
-  if (!config) {
-    return;
-  }
-
-  free(config->config_path);
-  free(config->repo_directory);
-  free(config->wsl_repo_directory);
-  free(config->preferred_shell);
-
-  for (i = 0; i < config->custom_entry_count; ++i) {
-    free_custom_entry(&config->custom_entries[i]);
+  if (config && config->cache_mapping) {
+    munmap(config->cache_mapping, config->cache_mapping_size);
   }
-  free(config->custom_entries);
-
-  for (i = 0; i < config->custom_command_count; ++i) {
-    free_custom_command(&config->custom_commands[i]);
-  }
-  free(config->custom_commands);
-
   free(config);
 }
 
@@ -90,52 +67,37 @@ static int hex_value(char ch) {
   return -1;
 }
 
-static int append_char(char **buffer, size_t *len, size_t *cap, char ch) {
-  char *new_buffer;
-
-  if (*len + 1 >= *cap) {
-    size_t new_cap = (*cap == 0) ? 32 : (*cap * 2);
-    if (new_cap < *cap) {
-      return 0;
-    }
-
-    new_buffer = realloc(*buffer, new_cap);
-    if (!new_buffer) {
-      return 0;
-    }
-
-    *buffer = new_buffer;
-    *cap = new_cap;
-  }
-
-  (*buffer)[*len] = ch;
-  (*len)++;
-  (*buffer)[*len] = '\0';
-  return 1;
-}
-
+// Strings are returned in place: the closing quote becomes the terminator
+// and escapes are decoded over the raw text, which they never outgrow. The
+// result lives as long as the config block holding the file contents.
 static char *parse_json_string(JsonParser *parser) {
-  char *output = NULL;
-  size_t output_len = 0;
-  size_t output_cap = 0;
+  char *output;
+  char *start;
 
   if (!consume_char(parser, '"')) {
     return NULL;
   }
 
+  start = parser->cur;
+  while (parser->cur < parser->end && *parser->cur != '"' && *parser->cur != '\\' &&
+         (unsigned char)*parser->cur >= 0x20) {
+    parser->cur++;
+  }
+  output = parser->cur;
+
   while (parser->cur < parser->end) {
     char ch = *parser->cur;
 
     if (ch == '"') {
+      *output = '\0';
       parser->cur++;
-      return output ? output : strdup("");
+      return start;
     }
 
     if (ch == '\\') {
       parser->cur++;
       if (parser->cur >= parser->end) {
         parser->error = "Invalid JSON escape sequence";
-        free(output);
         return NULL;
       }
 
@@ -144,51 +106,27 @@ static char *parse_json_string(JsonParser *parser) {
       case '"':
       case '\\':
       case '/':
-        if (!append_char(&output, &output_len, &output_cap, ch)) {
-          parser->error = "Out of memory while parsing JSON string";
-          free(output);
-          return NULL;
-        }
+        *output++ = ch;
         parser->cur++;
         break;
       case 'b':
-        if (!append_char(&output, &output_len, &output_cap, '\b')) {
-          parser->error = "Out of memory while parsing JSON string";
-          free(output);
-          return NULL;
-        }
+        *output++ = '\b';
         parser->cur++;
         break;
       case 'f':
-        if (!append_char(&output, &output_len, &output_cap, '\f')) {
-          parser->error = "Out of memory while parsing JSON string";
-          free(output);
-          return NULL;
-        }
+        *output++ = '\f';
         parser->cur++;
         break;
       case 'n':
-        if (!append_char(&output, &output_len, &output_cap, '\n')) {
-          parser->error = "Out of memory while parsing JSON string";
-          free(output);
-          return NULL;
-        }
+        *output++ = '\n';
         parser->cur++;
         break;
       case 'r':
-        if (!append_char(&output, &output_len, &output_cap, '\r')) {
-          parser->error = "Out of memory while parsing JSON string";
-          free(output);
-          return NULL;
-        }
+        *output++ = '\r';
         parser->cur++;
         break;
       case 't':
-        if (!append_char(&output, &output_len, &output_cap, '\t')) {
-          parser->error = "Out of memory while parsing JSON string";
-          free(output);
-          return NULL;
-        }
+        *output++ = '\t';
         parser->cur++;
         break;
       case 'u': {
@@ -200,7 +138,6 @@ static char *parse_json_string(JsonParser *parser) {
         parser->cur++;
         if (parser->cur + 4 > parser->end) {
           parser->error = "Invalid JSON unicode escape";
-          free(output);
           return NULL;
         }
 
@@ -210,30 +147,15 @@ static char *parse_json_string(JsonParser *parser) {
         h3 = hex_value(parser->cur[3]);
         if (h0 < 0 || h1 < 0 || h2 < 0 || h3 < 0) {
           parser->error = "Invalid JSON unicode escape";
-          free(output);
           return NULL;
         }
 
         codepoint = (unsigned int)((h0 << 12) | (h1 << 8) | (h2 << 4) | h3);
         parser->cur += 4;
-
-        if (codepoint <= 0x7F) {
-          if (!append_char(&output, &output_len, &output_cap, (char)codepoint)) {
-            parser->error = "Out of memory while parsing JSON string";
-            free(output);
-            return NULL;
-          }
-        } else {
-          if (!append_char(&output, &output_len, &output_cap, '?')) {
-            parser->error = "Out of memory while parsing JSON string";
-            free(output);
-            return NULL;
-          }
-        }
+        *output++ = codepoint <= 0x7F ? (char)codepoint : '?';
       } break;
       default:
         parser->error = "Unsupported JSON escape sequence";
-        free(output);
         return NULL;
       }
       continue;
@@ -241,20 +163,14 @@ static char *parse_json_string(JsonParser *parser) {
 
     if ((unsigned char)ch < 0x20) {
       parser->error = "Control character in JSON string";
-      free(output);
       return NULL;
     }
 
-    if (!append_char(&output, &output_len, &output_cap, ch)) {
-      parser->error = "Out of memory while parsing JSON string";
-      free(output);
-      return NULL;
-    }
+    *output++ = ch;
     parser->cur++;
   }
 
   parser->error = "Unterminated JSON string";
-  free(output);
   return NULL;
 }
 
@@ -279,6 +195,37 @@ static int parse_json_bool(JsonParser *parser, bool *value) {
   return 0;
 }
 
+static int parse_json_int(JsonParser *parser, int *value) {
+  const char *start;
+  long parsed = 0;
+  bool negative = false;
+
+  skip_ws(parser);
+  start = parser->cur;
+
+  if (parser->cur < parser->end && *parser->cur == '-') {
+    negative = true;
+    parser->cur++;
+  }
+
+  while (parser->cur < parser->end && isdigit((unsigned char)*parser->cur)) {
+    parsed = parsed * 10 + (*parser->cur - '0');
+    if (parsed > 1000000) {
+      parser->error = "JSON integer out of range";
+      return 0;
+    }
+    parser->cur++;
+  }
+
+  if (parser->cur == start || (negative && parser->cur == start + 1)) {
+    parser->error = "Expected integer value";
+    return 0;
+  }
+
+  *value = (int)(negative ? -parsed : parsed);
+  return 1;
+}
+
 static int skip_json_value(JsonParser *parser);
 
 static int skip_json_object(JsonParser *parser) {
@@ -293,11 +240,9 @@ static int skip_json_object(JsonParser *parser) {
   }
 
   while (parser->cur < parser->end) {
-    char *key = parse_json_string(parser);
-    if (!key) {
+    if (!parse_json_string(parser)) {
       return 0;
     }
-    free(key);
 
     if (!consume_char(parser, ':')) {
       return 0;
@@ -422,14 +367,8 @@ static int skip_json_value(JsonParser *parser) {
     return skip_json_object(parser);
   case '[':
     return skip_json_array(parser);
-  case '"': {
-    char *tmp = parse_json_string(parser);
-    if (!tmp) {
-      return 0;
-    }
-    free(tmp);
-    return 1;
-  }
+  case '"':
+    return parse_json_string(parser) != NULL;
   case 't':
     if ((size_t)(parser->end - parser->cur) >= 4 &&
         strncmp(parser->cur, "true", 4) == 0) {
@@ -477,34 +416,27 @@ static int parse_paths_object(JsonParser *parser, OpCustomEntry *entry) {
     }
 
     if (!consume_char(parser, ':')) {
-      free(key);
       return 0;
     }
 
     if (strcmp(key, "win") == 0) {
       char *value = parse_json_string(parser);
       if (!value) {
-        free(key);
         return 0;
       }
-      free(entry->win_path);
       entry->win_path = value;
     } else if (strcmp(key, "linux") == 0) {
       char *value = parse_json_string(parser);
       if (!value) {
-        free(key);
         return 0;
       }
-      free(entry->linux_path);
       entry->linux_path = value;
     } else {
       if (!skip_json_value(parser)) {
-        free(key);
         return 0;
       }
     }
 
-    free(key);
 
     skip_ws(parser);
     if (parser->cur < parser->end && *parser->cur == ',') {
@@ -545,31 +477,25 @@ static int parse_custom_entry(JsonParser *parser, OpCustomEntry *entry) {
     }
 
     if (!consume_char(parser, ':')) {
-      free(key);
       return 0;
     }
 
     if (strcmp(key, "name") == 0) {
       char *value = parse_json_string(parser);
       if (!value) {
-        free(key);
         return 0;
       }
-      free(entry->name);
       entry->name = value;
     } else if (strcmp(key, "paths") == 0) {
       if (!parse_paths_object(parser, entry)) {
-        free(key);
         return 0;
       }
     } else {
       if (!skip_json_value(parser)) {
-        free(key);
         return 0;
       }
     }
 
-    free(key);
 
     skip_ws(parser);
     if (parser->cur < parser->end && *parser->cur == ',') {
@@ -590,18 +516,13 @@ static int parse_custom_entry(JsonParser *parser, OpCustomEntry *entry) {
   return 0;
 }
 
-static int append_custom_entry(OpConfig *config, OpCustomEntry *entry) {
-  OpCustomEntry *new_entries;
-  size_t new_count = config->custom_entry_count + 1;
-
-  new_entries = realloc(config->custom_entries, new_count * sizeof(*new_entries));
-  if (!new_entries) {
+static int append_custom_entry(JsonParser *parser, OpConfig *config,
+                               const OpCustomEntry *entry) {
+  if (config->custom_entry_count == parser->object_capacity) {
     return 0;
   }
 
-  config->custom_entries = new_entries;
-  config->custom_entries[config->custom_entry_count] = *entry;
-  config->custom_entry_count = new_count;
+  config->custom_entries[config->custom_entry_count++] = *entry;
   return 1;
 }
 
@@ -621,13 +542,11 @@ static int parse_custom_entries_array(JsonParser *parser, OpConfig *config) {
     memset(&entry, 0, sizeof(entry));
 
     if (!parse_custom_entry(parser, &entry)) {
-      free_custom_entry(&entry);
       return 0;
     }
 
-    if (!append_custom_entry(config, &entry)) {
-      parser->error = "Out of memory while parsing custom entries";
-      free_custom_entry(&entry);
+    if (!append_custom_entry(parser, config, &entry)) {
+      parser->error = "Too many custom entries";
       return 0;
     }
 
@@ -650,6 +569,48 @@ static int parse_custom_entries_array(JsonParser *parser, OpConfig *config) {
   return 0;
 }
 
+// The named keys fzf accepts besides the patterned ones below; the events
+// (change, load, ...) are left out since they are not keys to press.
+static const char *const PICKER_KEY_NAMES[] = {
+    "ctrl-space", "ctrl-delete", "ctrl-\\", "ctrl-]", "ctrl-^", "ctrl-/", "ctrl-_",
+    "alt-enter", "alt-space", "alt-bspace", "alt-bs", "alt-up", "alt-down", "alt-left",
+    "alt-right", "tab", "btab", "esc", "del", "up", "down", "left", "right", "home",
+    "end", "insert", "pgup", "page-up", "pgdn", "page-down", "shift-up", "shift-down",
+    "shift-left", "shift-right", "shift-delete", "space", "bspace", "bs", "f10", "f11",
+    "f12", "left-click", "right-click", "double-click", "scroll-up", "scroll-down",
+};
+
+// Follows fzf's key grammar: a name above, ctrl-<letter>, ctrl-alt-<letter>,
+// alt-<character>, f1-f9 or a single character. Enter belongs to
+// enterAction, and a key containing ',' cannot be listed in --expect, which
+// is comma-separated.
+static int is_picker_key(const char *value) {
+  size_t len = strlen(value);
+  size_t i;
+
+  if (len == 0 || strchr(value, ',') || strcasecmp(value, "enter") == 0) {
+    return 0;
+  }
+  for (i = 0; i < sizeof(PICKER_KEY_NAMES) / sizeof(PICKER_KEY_NAMES[0]); ++i) {
+    if (strcasecmp(value, PICKER_KEY_NAMES[i]) == 0) {
+      return 1;
+    }
+  }
+  if (len == 6 && strncasecmp(value, "ctrl-", 5) == 0) {
+    return isalpha((unsigned char)value[5]) != 0;
+  }
+  if (len == 10 && strncasecmp(value, "ctrl-alt-", 9) == 0) {
+    return isalpha((unsigned char)value[9]) != 0;
+  }
+  if (len == 5 && strncasecmp(value, "alt-", 4) == 0) {
+    return isgraph((unsigned char)value[4]) != 0;
+  }
+  if (len == 2 && (value[0] == 'f' || value[0] == 'F')) {
+    return value[1] >= '1' && value[1] <= '9';
+  }
+  return len == 1 && isgraph((unsigned char)value[0]);
+}
+
 static int parse_custom_command(JsonParser *parser, OpCustomCommand *command) {
   memset(command, 0, sizeof(*command));
 
@@ -670,39 +631,57 @@ static int parse_custom_command(JsonParser *parser, OpCustomCommand *command) {
     }
 
     if (!consume_char(parser, ':')) {
-      free(key);
       return 0;
     }
 
     if (strcmp(key, "name") == 0) {
       char *value = parse_json_string(parser);
       if (!value) {
-        free(key);
         return 0;
       }
-      free(command->name);
       command->name = value;
     } else if (strcmp(key, "command") == 0) {
       char *value = parse_json_string(parser);
       if (!value) {
-        free(key);
         return 0;
       }
-      free(command->command);
       command->command = value;
     } else if (strcmp(key, "runInPreferredShell") == 0) {
       if (!parse_json_bool(parser, &command->run_in_preferred_shell)) {
-        free(key);
         return 0;
       }
+    } else if (strcmp(key, "shell") == 0) {
+      char *value = parse_json_string(parser);
+      if (!value) {
+        return 0;
+      }
+      if (strcmp(value, "none") == 0) {
+        command->shell = OP_SHELL_NONE;
+      } else if (strcmp(value, "sh") == 0) {
+        command->shell = OP_SHELL_SH;
+      } else if (strcmp(value, "login") == 0) {
+        command->shell = OP_SHELL_LOGIN;
+      } else {
+        parser->error = "Custom command shell must be \"none\", \"sh\" or \"login\"";
+        return 0;
+      }
+    } else if (strcmp(key, "key") == 0) {
+      char *value = parse_json_string(parser);
+      if (!value) {
+        return 0;
+      }
+      if (!is_picker_key(value)) {
+        parser->error = "Custom command key must be an fzf key such as \"ctrl-g\" "
+                        "(not enter, and without ',')";
+        return 0;
+      }
+      command->key = value;
     } else {
       if (!skip_json_value(parser)) {
-        free(key);
         return 0;
       }
     }
 
-    free(key);
 
     skip_ws(parser);
     if (parser->cur < parser->end && *parser->cur == ',') {
@@ -723,18 +702,13 @@ static int parse_custom_command(JsonParser *parser, OpCustomCommand *command) {
   return 0;
 }
 
-static int append_custom_command(OpConfig *config, OpCustomCommand *command) {
-  OpCustomCommand *new_commands;
-  size_t new_count = config->custom_command_count + 1;
-
-  new_commands = realloc(config->custom_commands, new_count * sizeof(*new_commands));
-  if (!new_commands) {
+static int append_custom_command(JsonParser *parser, OpConfig *config,
+                               const OpCustomCommand *command) {
+  if (config->custom_command_count == parser->object_capacity) {
     return 0;
   }
 
-  config->custom_commands = new_commands;
-  config->custom_commands[config->custom_command_count] = *command;
-  config->custom_command_count = new_count;
+  config->custom_commands[config->custom_command_count++] = *command;
   return 1;
 }
 
@@ -754,13 +728,11 @@ static int parse_custom_commands_array(JsonParser *parser, OpConfig *config) {
     memset(&command, 0, sizeof(command));
 
     if (!parse_custom_command(parser, &command)) {
-      free_custom_command(&command);
       return 0;
     }
 
-    if (!append_custom_command(config, &command)) {
-      parser->error = "Out of memory while parsing custom commands";
-      free_custom_command(&command);
+    if (!append_custom_command(parser, config, &command)) {
+      parser->error = "Too many custom commands";
       return 0;
     }
 
@@ -783,6 +755,48 @@ static int parse_custom_commands_array(JsonParser *parser, OpConfig *config) {
   return 0;
 }
 
+static int parse_repo_roots_array(JsonParser *parser, OpConfig *config) {
+  if (!consume_char(parser, '[')) {
+    return 0;
+  }
+
+  skip_ws(parser);
+  if (parser->cur < parser->end && *parser->cur == ']') {
+    parser->cur++;
+    return 1;
+  }
+
+  while (parser->cur < parser->end) {
+    char *root = parse_json_string(parser);
+    if (!root) {
+      return 0;
+    }
+
+    if (config->repo_root_count == parser->string_capacity) {
+      parser->error = "Too many repo roots";
+      return 0;
+    }
+    config->repo_roots[config->repo_root_count++] = root;
+
+    skip_ws(parser);
+    if (parser->cur < parser->end && *parser->cur == ',') {
+      parser->cur++;
+      continue;
+    }
+
+    if (parser->cur < parser->end && *parser->cur == ']') {
+      parser->cur++;
+      return 1;
+    }
+
+    parser->error = "Malformed repo roots array";
+    return 0;
+  }
+
+  parser->error = "Unterminated repo roots array";
+  return 0;
+}
+
 static int parse_config_object(JsonParser *parser, OpConfig *config) {
   if (!consume_char(parser, '{')) {
     return 0;
@@ -801,57 +815,83 @@ static int parse_config_object(JsonParser *parser, OpConfig *config) {
     }
 
     if (!consume_char(parser, ':')) {
-      free(key);
       return 0;
     }
 
     if (strcmp(key, "repoDirectory") == 0) {
       char *value = parse_json_string(parser);
       if (!value) {
-        free(key);
         return 0;
       }
-      free(config->repo_directory);
       config->repo_directory = value;
     } else if (strcmp(key, "wslRepoDirectory") == 0) {
       char *value = parse_json_string(parser);
       if (!value) {
-        free(key);
         return 0;
       }
-      free(config->wsl_repo_directory);
       config->wsl_repo_directory = value;
+    } else if (strcmp(key, "repoRoots") == 0) {
+      if (!parse_repo_roots_array(parser, config)) {
+        return 0;
+      }
+    } else if (strcmp(key, "maxDepth") == 0) {
+      if (!parse_json_int(parser, &config->max_depth)) {
+        return 0;
+      }
+      if (config->max_depth < 1) {
+        parser->error = "maxDepth must be at least 1";
+        return 0;
+      }
     } else if (strcmp(key, "isServer") == 0) {
       if (!parse_json_bool(parser, &config->is_server)) {
-        free(key);
+        return 0;
+      }
+    } else if (strcmp(key, "backgroundRepoUpdate") == 0) {
+      if (!parse_json_bool(parser, &config->background_repo_update)) {
+        return 0;
+      }
+    } else if (strcmp(key, "asyncDecorations") == 0) {
+      if (!parse_json_bool(parser, &config->async_decorations)) {
+        return 0;
+      }
+    } else if (strcmp(key, "persistentShell") == 0) {
+      if (!parse_json_bool(parser, &config->persistent_shell)) {
+        return 0;
+      }
+    } else if (strcmp(key, "sortIgnoreCase") == 0) {
+      if (!parse_json_bool(parser, &config->sort_ignore_case)) {
+        return 0;
+      }
+    } else if (strcmp(key, "sortNatural") == 0) {
+      if (!parse_json_bool(parser, &config->sort_natural)) {
         return 0;
       }
     } else if (strcmp(key, "preferedShell") == 0) {
       char *value = parse_json_string(parser);
       if (!value) {
-        free(key);
         return 0;
       }
-      free(config->preferred_shell);
       config->preferred_shell = value;
+    } else if (strcmp(key, "enterAction") == 0) {
+      char *value = parse_json_string(parser);
+      if (!value) {
+        return 0;
+      }
+      config->enter_action = value;
     } else if (strcmp(key, "customEntries") == 0) {
       if (!parse_custom_entries_array(parser, config)) {
-        free(key);
         return 0;
       }
     } else if (strcmp(key, "customCommands") == 0) {
       if (!parse_custom_commands_array(parser, config)) {
-        free(key);
         return 0;
       }
     } else {
       if (!skip_json_value(parser)) {
-        free(key);
         return 0;
       }
     }
 
-    free(key);
 
     skip_ws(parser);
     if (parser->cur < parser->end && *parser->cur == ',') {
@@ -872,7 +912,9 @@ static int parse_config_object(JsonParser *parser, OpConfig *config) {
   return 0;
 }
 
-static char *read_file_to_buffer(const char *path, size_t *out_len) {
+// Reads the file into a fresh buffer after offset spare bytes and
+// NUL-terminates it.
+static char *read_file_to_buffer(const char *path, size_t offset, size_t *out_len) {
   FILE *fp;
   long size_long;
   size_t size;
@@ -902,13 +944,13 @@ static char *read_file_to_buffer(const char *path, size_t *out_len) {
   }
 
   size = (size_t)size_long;
-  buffer = malloc(size + 1);
+  buffer = malloc(offset + size + 1);
   if (!buffer) {
     fclose(fp);
     return NULL;
   }
 
-  bytes_read = fread(buffer, 1, size, fp);
+  bytes_read = fread(buffer + offset, 1, size, fp);
   fclose(fp);
 
   if (bytes_read != size) {
@@ -916,56 +958,201 @@ static char *read_file_to_buffer(const char *path, size_t *out_len) {
     return NULL;
   }
 
-  buffer[size] = '\0';
+  buffer[offset + size] = '\0';
   *out_len = size;
   return buffer;
 }
 
-OpConfig *loadConfigs(const char *config_path) {
-  OpConfig *config;
-  JsonParser parser;
-  char *json_buffer = NULL;
-  size_t json_length = 0;
+static size_t count_byte(const char *data, size_t len, char byte) {
+  const char *end = data + len;
+  size_t count = 0;
 
-  if (!config_path) {
-    fprintf(stderr, "Config path is required\n");
-    return NULL;
+  while ((data = memchr(data, byte, (size_t)(end - data))) != NULL) {
+    ++count;
+    ++data;
+  }
+  return count;
+}
+
+// Keeps the index at most half full.
+static size_t name_index_slot_count(size_t count) {
+  size_t slot_count = 1;
+
+  if (count == 0) {
+    return 0;
   }
+  while (slot_count < count * 2) {
+    slot_count <<= 1;
+  }
+  return slot_count;
+}
+
+// Names sit at name_offset inside items of size stride; slots must be zeroed.
+static const char *item_name(const void *items, size_t stride, size_t name_offset,
+                             size_t position) {
+  return *(const char *const *)((const char *)items + position * stride + name_offset);
+}
+
+static void build_name_index(uint32_t *slots, size_t slot_count, const void *items,
+                             size_t stride, size_t name_offset, size_t count) {
+  size_t i;
 
-  json_buffer = read_file_to_buffer(config_path, &json_length);
-  if (!json_buffer) {
+  for (i = 0; i < count; ++i) {
+    const char *name = item_name(items, stride, name_offset, i);
+    size_t slot;
+
+    if (!name) {
+      continue;
+    }
+    slot = (size_t)fnv1a(name) & (slot_count - 1);
+    while (slots[slot] != 0 &&
+           strcmp(item_name(items, stride, name_offset, slots[slot] - 1), name) != 0) {
+      slot = (slot + 1) & (slot_count - 1);
+    }
+    if (slots[slot] == 0) {
+      slots[slot] = (uint32_t)i + 1;
+    }
+  }
+}
+
+// Returns the position of name, or -1. Slot values are range-checked since a
+// mapped cache may hold anything.
+static long find_indexed_name(const uint32_t *slots, size_t slot_count, const void *items,
+                              size_t stride, size_t name_offset, size_t count,
+                              const char *name) {
+  size_t slot;
+  size_t probes;
+
+  if (slot_count == 0) {
+    return -1;
+  }
+  slot = (size_t)fnv1a(name) & (slot_count - 1);
+  for (probes = 0; probes < slot_count && slots[slot] != 0; ++probes) {
+    const char *candidate;
+    if (slots[slot] > count) {
+      return -1;
+    }
+    candidate = item_name(items, stride, name_offset, slots[slot] - 1);
+    if (candidate && strcmp(candidate, name) == 0) {
+      return (long)slots[slot] - 1;
+    }
+    slot = (slot + 1) & (slot_count - 1);
+  }
+  return -1;
+}
+
+const OpCustomEntry *findCustomEntry(const OpConfig *config, const char *name) {
+  long position = find_indexed_name(
+      config->custom_entry_slots, config->custom_entry_slot_count, config->custom_entries,
+      sizeof(OpCustomEntry), offsetof(OpCustomEntry, name), config->custom_entry_count, name);
+  return position < 0 ? NULL : &config->custom_entries[position];
+}
+
+const OpCustomCommand *findCustomCommand(const OpConfig *config, const char *name) {
+  long position = find_indexed_name(
+      config->custom_command_slots, config->custom_command_slot_count,
+      config->custom_commands, sizeof(OpCustomCommand), offsetof(OpCustomCommand, name),
+      config->custom_command_count, name);
+  return position < 0 ? NULL : &config->custom_commands[position];
+}
+
+static void build_config_indexes(OpConfig *config, uint32_t *entry_slots,
+                                 uint32_t *command_slots) {
+  build_name_index(entry_slots, config->custom_entry_slot_count, config->custom_entries,
+                   sizeof(OpCustomEntry), offsetof(OpCustomEntry, name),
+                   config->custom_entry_count);
+  build_name_index(command_slots, config->custom_command_slot_count,
+                   config->custom_commands, sizeof(OpCustomCommand),
+                   offsetof(OpCustomCommand, name), config->custom_command_count);
+  config->custom_entry_slots = entry_slots;
+  config->custom_command_slots = command_slots;
+}
+
+static char *place_string(char **cursor, const char *value) {
+  char *placed = *cursor;
+  size_t len = strlen(value) + 1;
+
+  memcpy(placed, value, len);
+  *cursor += len;
+  return placed;
+}
+
+// A config is one block laid out as
+//   [OpConfig][file contents][config path + defaults][entries][commands][roots]
+//   [entry index][command index]
+// Parsed strings point into the file contents, and the arrays are sized from
+// upper bounds counted before parsing (each entry or command is an object,
+// each root a string), so parsing never allocates and freeConfig is one free.
+static OpConfig *parse_config_file(const char *config_path) {
+  static const char default_repo_directory[] = "~/source/repos";
+  static const char default_wsl_repo_directory[] = "/mnt/c/source/repos";
+  static const char default_shell[] = "bash";
+  OpConfig *config;
+  JsonParser parser;
+  char *block;
+  char *grown;
+  char *json;
+  char *strings;
+  size_t json_length = 0;
+  size_t object_count = 0;
+  size_t quote_count = 0;
+  size_t arrays_offset;
+  size_t slot_count;
+  uint32_t *slots;
+
+  block = read_file_to_buffer(config_path, sizeof(OpConfig), &json_length);
+  if (!block) {
     fprintf(stderr, "Failed to read config file '%s': %s\n", config_path,
             strerror(errno));
     return NULL;
   }
 
-  config = calloc(1, sizeof(*config));
-  if (!config) {
-    free(json_buffer);
+  json = block + sizeof(OpConfig);
+  object_count = count_byte(json, json_length, '{');
+  quote_count = count_byte(json, json_length, '"');
+
+  arrays_offset = sizeof(OpConfig) + json_length + 1 + strlen(config_path) + 1 +
+                  sizeof(default_repo_directory) + sizeof(default_wsl_repo_directory) +
+                  sizeof(default_shell);
+  arrays_offset = (arrays_offset + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+  slot_count = name_index_slot_count(object_count);
+  grown = realloc(block, arrays_offset + object_count * sizeof(OpCustomEntry) +
+                             object_count * sizeof(OpCustomCommand) +
+                             quote_count / 2 * sizeof(char *) +
+                             2 * slot_count * sizeof(uint32_t));
+  if (!grown) {
+    free(block);
     return NULL;
   }
-
-  config->config_path = strdup(config_path);
-  config->repo_directory = strdup("~/source/repos");
-  config->wsl_repo_directory = strdup("/mnt/c/source/repos");
-  config->preferred_shell = strdup("bash");
+  block = grown;
+  json = block + sizeof(OpConfig);
+
+  config = (OpConfig *)block;
+  memset(config, 0, sizeof(*config));
+  strings = json + json_length + 1;
+  config->config_path = place_string(&strings, config_path);
+  config->repo_directory = place_string(&strings, default_repo_directory);
+  config->wsl_repo_directory = place_string(&strings, default_wsl_repo_directory);
+  config->preferred_shell = place_string(&strings, default_shell);
+  config->custom_entries = (OpCustomEntry *)(block + arrays_offset);
+  config->custom_commands = (OpCustomCommand *)(config->custom_entries + object_count);
+  config->repo_roots = (char **)(config->custom_commands + object_count);
+  slots = (uint32_t *)(config->repo_roots + quote_count / 2);
+  memset(slots, 0, 2 * slot_count * sizeof(uint32_t));
+  config->max_depth = 1;
   config->is_server = false;
+  config->background_repo_update = true;
+  config->async_decorations = true;
 
-  if (!config->config_path || !config->repo_directory || !config->wsl_repo_directory ||
-      !config->preferred_shell) {
-    free(json_buffer);
-    freeConfig(config);
-    return NULL;
-  }
-
-  parser.cur = json_buffer;
-  parser.end = json_buffer + json_length;
+  parser.cur = json;
+  parser.end = json + json_length;
   parser.error = NULL;
+  parser.object_capacity = object_count;
+  parser.string_capacity = quote_count / 2;
 
   if (!parse_config_object(&parser, config)) {
     fprintf(stderr, "Failed to parse config file '%s': %s\n", config_path,
             parser.error ? parser.error : "Unknown error");
-    free(json_buffer);
     freeConfig(config);
     return NULL;
   }
@@ -975,15 +1162,523 @@ OpConfig *loadConfigs(const char *config_path) {
     fprintf(stderr,
             "Failed to parse config file '%s': trailing characters found\n",
             config_path);
-    free(json_buffer);
     freeConfig(config);
     return NULL;
   }
 
-  free(json_buffer);
+  config->custom_entry_slot_count = slot_count;
+  config->custom_command_slot_count = slot_count;
+  build_config_indexes(config, slots, slots + slot_count);
   return config;
 }
 
+// The compiled cache next to config.json is a position-independent image of
+// a parsed config:
+//   [ConfigCacheHeader][root offsets][entries][commands]
+//   [entry index][command index][string table]
+// Every string is an offset into the NUL-terminated string table (or
+// CONFIG_CACHE_NONE for NULL); the name indexes are stored ready to use.
+// It is used only while the source file's size, mtime, inode and device
+// still match the ones recorded in the header.
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t source_size;
+  int64_t source_mtime_sec;
+  int64_t source_mtime_nsec;
+  uint64_t source_inode;
+  uint64_t source_device;
+  uint64_t image_size;
+  int32_t max_depth;
+  uint8_t is_server;
+  uint8_t background_repo_update;
+  uint8_t async_decorations;
+  uint8_t persistent_shell;
+  uint8_t sort_ignore_case;
+  uint8_t sort_natural;
+  uint8_t reserved[2];
+  uint32_t repo_directory;
+  uint32_t wsl_repo_directory;
+  uint32_t preferred_shell;
+  uint32_t enter_action;
+  uint32_t repo_root_count;
+  uint32_t custom_entry_count;
+  uint32_t custom_command_count;
+  uint32_t custom_entry_slot_count;
+  uint32_t custom_command_slot_count;
+  uint32_t strings_offset;
+  uint32_t strings_size;
+} ConfigCacheHeader;
+
+typedef struct {
+  uint32_t name;
+  uint32_t win_path;
+  uint32_t linux_path;
+} ConfigCacheEntry;
+
+typedef struct {
+  uint32_t name;
+  uint32_t command;
+  uint32_t run_in_preferred_shell;
+  uint32_t shell;
+  uint32_t key;
+} ConfigCacheCommand;
+
+static char *config_cache_path(const char *config_path) {
+  size_t len = strlen(config_path);
+  char *path = malloc(len + sizeof(CONFIG_CACHE_SUFFIX));
+
+  if (path) {
+    memcpy(path, config_path, len);
+    memcpy(path + len, CONFIG_CACHE_SUFFIX, sizeof(CONFIG_CACHE_SUFFIX));
+  }
+  return path;
+}
+
+static int cache_matches_source(const ConfigCacheHeader *header, const struct stat *source) {
+  return header->source_size == (uint64_t)source->st_size &&
+         header->source_mtime_sec == (int64_t)source->st_mtim.tv_sec &&
+         header->source_mtime_nsec == (int64_t)source->st_mtim.tv_nsec &&
+         header->source_inode == (uint64_t)source->st_ino &&
+         header->source_device == (uint64_t)source->st_dev;
+}
+
+static const char *cache_string(const char *strings, uint32_t strings_size,
+                                uint32_t offset, int *valid) {
+  if (offset == CONFIG_CACHE_NONE) {
+    return NULL;
+  }
+  if (offset >= strings_size) {
+    *valid = 0;
+    return NULL;
+  }
+  return strings + offset;
+}
+
+// Maps the cache and builds an OpConfig whose strings point straight into
+// it. Returns NULL when there is no usable cache for this exact source file.
+static OpConfig *load_config_cache(const char *config_path, const struct stat *source) {
+  const ConfigCacheHeader *header;
+  const uint32_t *roots;
+  const ConfigCacheEntry *entries;
+  const ConfigCacheCommand *commands;
+  const char *strings;
+  char *cache_path = config_cache_path(config_path);
+  size_t path_len = strlen(config_path) + 1;
+  size_t arrays_offset;
+  size_t arrays_end;
+  struct stat cache_stat;
+  OpConfig *config;
+  char *block;
+  void *mapping;
+  int valid = 1;
+  size_t i;
+  int fd;
+
+  if (!cache_path) {
+    return NULL;
+  }
+  fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+  free(cache_path);
+  if (fd < 0) {
+    return NULL;
+  }
+  if (fstat(fd, &cache_stat) != 0 || cache_stat.st_size < (off_t)sizeof(*header)) {
+    close(fd);
+    return NULL;
+  }
+  mapping = mmap(NULL, (size_t)cache_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return NULL;
+  }
+
+  header = mapping;
+  arrays_end = sizeof(*header) + (size_t)header->repo_root_count * sizeof(*roots) +
+               (size_t)header->custom_entry_count * sizeof(*entries) +
+               (size_t)header->custom_command_count * sizeof(*commands) +
+               ((size_t)header->custom_entry_slot_count +
+                header->custom_command_slot_count) * sizeof(uint32_t);
+  if (header->magic != CONFIG_CACHE_MAGIC || header->version != CONFIG_CACHE_VERSION ||
+      !cache_matches_source(header, source) ||
+      (header->custom_entry_slot_count & (header->custom_entry_slot_count - 1)) != 0 ||
+      (header->custom_command_slot_count & (header->custom_command_slot_count - 1)) != 0 ||
+      header->image_size != (uint64_t)cache_stat.st_size ||
+      header->strings_offset < arrays_end || header->strings_size == 0 ||
+      (uint64_t)header->strings_offset + header->strings_size != header->image_size ||
+      ((const char *)mapping)[header->image_size - 1] != '\0') {
+    munmap(mapping, (size_t)cache_stat.st_size);
+    return NULL;
+  }
+
+  roots = (const uint32_t *)(header + 1);
+  entries = (const ConfigCacheEntry *)(roots + header->repo_root_count);
+  commands = (const ConfigCacheCommand *)(entries + header->custom_entry_count);
+  strings = (const char *)mapping + header->strings_offset;
+
+  arrays_offset = (sizeof(OpConfig) + path_len + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+  block = malloc(arrays_offset + header->custom_entry_count * sizeof(OpCustomEntry) +
+                 header->custom_command_count * sizeof(OpCustomCommand) +
+                 header->repo_root_count * sizeof(char *));
+  if (!block) {
+    munmap(mapping, (size_t)cache_stat.st_size);
+    return NULL;
+  }
+
+  // The strings are never written through; OpConfig is read-only by contract.
+  config = (OpConfig *)block;
+  memset(config, 0, sizeof(*config));
+  config->cache_mapping = mapping;
+  config->cache_mapping_size = (size_t)cache_stat.st_size;
+  config->config_path = memcpy(block + sizeof(OpConfig), config_path, path_len);
+  config->repo_directory =
+      (char *)cache_string(strings, header->strings_size, header->repo_directory, &valid);
+  config->wsl_repo_directory = (char *)cache_string(strings, header->strings_size,
+                                                    header->wsl_repo_directory, &valid);
+  config->preferred_shell =
+      (char *)cache_string(strings, header->strings_size, header->preferred_shell, &valid);
+  config->enter_action =
+      (char *)cache_string(strings, header->strings_size, header->enter_action, &valid);
+  config->max_depth = header->max_depth;
+  config->is_server = header->is_server != 0;
+  config->background_repo_update = header->background_repo_update != 0;
+  config->async_decorations = header->async_decorations != 0;
+  config->persistent_shell = header->persistent_shell != 0;
+  config->sort_ignore_case = header->sort_ignore_case != 0;
+  config->sort_natural = header->sort_natural != 0;
+
+  config->custom_entries = (OpCustomEntry *)(block + arrays_offset);
+  config->custom_entry_count = header->custom_entry_count;
+  for (i = 0; i < header->custom_entry_count; ++i) {
+    OpCustomEntry *entry = &config->custom_entries[i];
+    entry->name = (char *)cache_string(strings, header->strings_size, entries[i].name, &valid);
+    entry->win_path =
+        (char *)cache_string(strings, header->strings_size, entries[i].win_path, &valid);
+    entry->linux_path =
+        (char *)cache_string(strings, header->strings_size, entries[i].linux_path, &valid);
+  }
+
+  config->custom_commands = (OpCustomCommand *)(config->custom_entries +
+                                                header->custom_entry_count);
+  config->custom_command_count = header->custom_command_count;
+  for (i = 0; i < header->custom_command_count; ++i) {
+    OpCustomCommand *command = &config->custom_commands[i];
+    command->name =
+        (char *)cache_string(strings, header->strings_size, commands[i].name, &valid);
+    command->command =
+        (char *)cache_string(strings, header->strings_size, commands[i].command, &valid);
+    command->run_in_preferred_shell = commands[i].run_in_preferred_shell != 0;
+    if (commands[i].shell > OP_SHELL_LOGIN) {
+      valid = 0;
+    }
+    command->shell = (OpShellMode)commands[i].shell;
+    command->key = (char *)cache_string(strings, header->strings_size, commands[i].key, &valid);
+  }
+
+  config->custom_entry_slots = (const uint32_t *)(commands + header->custom_command_count);
+  config->custom_entry_slot_count = header->custom_entry_slot_count;
+  config->custom_command_slots =
+      config->custom_entry_slots + header->custom_entry_slot_count;
+  config->custom_command_slot_count = header->custom_command_slot_count;
+
+  config->repo_roots = (char **)(config->custom_commands + header->custom_command_count);
+  config->repo_root_count = header->repo_root_count;
+  for (i = 0; i < header->repo_root_count; ++i) {
+    config->repo_roots[i] =
+        (char *)cache_string(strings, header->strings_size, roots[i], &valid);
+    valid = valid && config->repo_roots[i] != NULL;
+  }
+
+  if (!valid) {
+    freeConfig(config);
+    return NULL;
+  }
+  return config;
+}
+
+static size_t cache_string_size(const char *value) { return value ? strlen(value) + 1 : 0; }
+
+static uint32_t place_cache_string(char *strings, uint32_t *used, const char *value) {
+  uint32_t offset = *used;
+
+  if (!value) {
+    return CONFIG_CACHE_NONE;
+  }
+  memcpy(strings + offset, value, strlen(value) + 1);
+  *used += (uint32_t)strlen(value) + 1;
+  return offset;
+}
+
+// Serializes config for the source file described by source. The image is
+// written to a temporary file and renamed over the cache so readers never
+// map a half-written one.
+static int write_config_cache(const OpConfig *config, const struct stat *source) {
+  ConfigCacheHeader *header;
+  uint32_t *roots;
+  ConfigCacheEntry *entries;
+  ConfigCacheCommand *commands;
+  uint32_t *entry_slots;
+  uint32_t *command_slots;
+  size_t entry_slot_count = name_index_slot_count(config->custom_entry_count);
+  size_t command_slot_count = name_index_slot_count(config->custom_command_count);
+  char *strings;
+  char *image;
+  char *cache_path = NULL;
+  char *temp_path = NULL;
+  size_t strings_size;
+  size_t strings_offset;
+  size_t image_size;
+  uint32_t used = 0;
+  size_t i;
+  int ok = 0;
+  int fd = -1;
+
+  strings_size = cache_string_size(config->repo_directory) +
+                 cache_string_size(config->wsl_repo_directory) +
+                 cache_string_size(config->preferred_shell) +
+                 cache_string_size(config->enter_action) + 1;
+  for (i = 0; i < config->repo_root_count; ++i) {
+    strings_size += cache_string_size(config->repo_roots[i]);
+  }
+  for (i = 0; i < config->custom_entry_count; ++i) {
+    strings_size += cache_string_size(config->custom_entries[i].name) +
+                    cache_string_size(config->custom_entries[i].win_path) +
+                    cache_string_size(config->custom_entries[i].linux_path);
+  }
+  for (i = 0; i < config->custom_command_count; ++i) {
+    strings_size += cache_string_size(config->custom_commands[i].name) +
+                    cache_string_size(config->custom_commands[i].command) +
+                    cache_string_size(config->custom_commands[i].key);
+  }
+
+  strings_offset = sizeof(*header) + config->repo_root_count * sizeof(*roots) +
+                   config->custom_entry_count * sizeof(*entries) +
+                   config->custom_command_count * sizeof(*commands) +
+                   (entry_slot_count + command_slot_count) * sizeof(uint32_t);
+  image_size = strings_offset + strings_size;
+  if (image_size >= CONFIG_CACHE_NONE) {
+    return 0;
+  }
+
+  image = calloc(1, image_size);
+  if (!image) {
+    return 0;
+  }
+
+  header = (ConfigCacheHeader *)image;
+  roots = (uint32_t *)(header + 1);
+  entries = (ConfigCacheEntry *)(roots + config->repo_root_count);
+  commands = (ConfigCacheCommand *)(entries + config->custom_entry_count);
+  entry_slots = (uint32_t *)(commands + config->custom_command_count);
+  command_slots = entry_slots + entry_slot_count;
+  strings = image + strings_offset;
+
+  header->magic = CONFIG_CACHE_MAGIC;
+  header->version = CONFIG_CACHE_VERSION;
+  header->source_size = (uint64_t)source->st_size;
+  header->source_mtime_sec = (int64_t)source->st_mtim.tv_sec;
+  header->source_mtime_nsec = (int64_t)source->st_mtim.tv_nsec;
+  header->source_inode = (uint64_t)source->st_ino;
+  header->source_device = (uint64_t)source->st_dev;
+  header->image_size = image_size;
+  header->max_depth = config->max_depth;
+  header->is_server = config->is_server;
+  header->background_repo_update = config->background_repo_update;
+  header->async_decorations = config->async_decorations;
+  header->persistent_shell = config->persistent_shell;
+  header->sort_ignore_case = config->sort_ignore_case;
+  header->sort_natural = config->sort_natural;
+  header->repo_directory = place_cache_string(strings, &used, config->repo_directory);
+  header->wsl_repo_directory = place_cache_string(strings, &used, config->wsl_repo_directory);
+  header->preferred_shell = place_cache_string(strings, &used, config->preferred_shell);
+  header->enter_action = place_cache_string(strings, &used, config->enter_action);
+  header->repo_root_count = (uint32_t)config->repo_root_count;
+  header->custom_entry_count = (uint32_t)config->custom_entry_count;
+  header->custom_command_count = (uint32_t)config->custom_command_count;
+  header->custom_entry_slot_count = (uint32_t)entry_slot_count;
+  header->custom_command_slot_count = (uint32_t)command_slot_count;
+  header->strings_offset = (uint32_t)strings_offset;
+  header->strings_size = (uint32_t)strings_size;
+
+  for (i = 0; i < config->repo_root_count; ++i) {
+    roots[i] = place_cache_string(strings, &used, config->repo_roots[i]);
+  }
+  for (i = 0; i < config->custom_entry_count; ++i) {
+    entries[i].name = place_cache_string(strings, &used, config->custom_entries[i].name);
+    entries[i].win_path =
+        place_cache_string(strings, &used, config->custom_entries[i].win_path);
+    entries[i].linux_path =
+        place_cache_string(strings, &used, config->custom_entries[i].linux_path);
+  }
+  for (i = 0; i < config->custom_command_count; ++i) {
+    commands[i].name = place_cache_string(strings, &used, config->custom_commands[i].name);
+    commands[i].command =
+        place_cache_string(strings, &used, config->custom_commands[i].command);
+    commands[i].run_in_preferred_shell = config->custom_commands[i].run_in_preferred_shell;
+    commands[i].shell = (uint32_t)config->custom_commands[i].shell;
+    commands[i].key = place_cache_string(strings, &used, config->custom_commands[i].key);
+  }
+  build_name_index(entry_slots, entry_slot_count, config->custom_entries,
+                   sizeof(OpCustomEntry), offsetof(OpCustomEntry, name),
+                   config->custom_entry_count);
+  build_name_index(command_slots, command_slot_count, config->custom_commands,
+                   sizeof(OpCustomCommand), offsetof(OpCustomCommand, name),
+                   config->custom_command_count);
+
+  cache_path = config_cache_path(config->config_path);
+  temp_path = cache_path ? malloc(strlen(cache_path) + 32) : NULL;
+  if (!temp_path) {
+    goto cleanup;
+  }
+  snprintf(temp_path, strlen(cache_path) + 32, "%s.%ld.tmp", cache_path, (long)getpid());
+
+  fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    goto cleanup;
+  }
+  {
+    const char *cursor = image;
+    size_t remaining = image_size;
+    while (remaining > 0) {
+      ssize_t written = write(fd, cursor, remaining);
+      if (written < 0 && errno == EINTR) {
+        continue;
+      }
+      if (written <= 0) {
+        break;
+      }
+      cursor += written;
+      remaining -= (size_t)written;
+    }
+    ok = remaining == 0;
+  }
+  if (close(fd) != 0) {
+    ok = 0;
+  }
+  if (ok && rename(temp_path, cache_path) != 0) {
+    ok = 0;
+  }
+  if (!ok) {
+    unlink(temp_path);
+  }
+
+cleanup:
+  free(image);
+  free(cache_path);
+  free(temp_path);
+  return ok;
+}
+
+OpConfig *loadConfigs(const char *config_path) {
+  struct stat source;
+  OpConfig *config;
+
+  if (!config_path) {
+    fprintf(stderr, "Config path is required\n");
+    return NULL;
+  }
+
+  // Taken before the file is read, so an edit made meanwhile leaves a cache
+  // that does not match and is rebuilt next time.
+  if (stat(config_path, &source) != 0) {
+    fprintf(stderr, "Failed to read config file '%s': %s\n", config_path,
+            strerror(errno));
+    return NULL;
+  }
+
+  config = load_config_cache(config_path, &source);
+  if (config) {
+    return config;
+  }
+
+  config = parse_config_file(config_path);
+  if (config) {
+    // Best effort: a read-only config directory just means no cache.
+    (void)write_config_cache(config, &source);
+  }
+  return config;
+}
+
+int compileConfigCache(const char *config_path) {
+  struct stat source;
+  OpConfig *config;
+  char *cache_path;
+  int ok;
+
+  if (stat(config_path, &source) != 0) {
+    fprintf(stderr, "Failed to read config file '%s': %s\n", config_path,
+            strerror(errno));
+    return 0;
+  }
+
+  config = parse_config_file(config_path);
+  if (!config) {
+    return 0;
+  }
+
+  ok = write_config_cache(config, &source);
+  cache_path = config_cache_path(config_path);
+  if (ok) {
+    printf("Compiled %s\n", cache_path ? cache_path : config_path);
+  } else {
+    fprintf(stderr, "Failed to write config cache '%s': %s\n",
+            cache_path ? cache_path : config_path, strerror(errno));
+  }
+  free(cache_path);
+  freeConfig(config);
+  return ok;
+}
+
+// NULL and "" hash differently; the terminator separates adjacent strings.
+static uint64_t fingerprint_string(uint64_t hash, const char *value) {
+  if (!value) {
+    return fnv1a_bytes(hash, "\xff", 1);
+  }
+  return fnv1a_bytes(hash, value, strlen(value) + 1);
+}
+
+uint64_t configFingerprint(const OpConfig *config) {
+  uint64_t hash = FNV1A_OFFSET_BASIS;
+  unsigned char flags[6];
+  size_t i;
+
+  flags[0] = config->is_server;
+  flags[1] = config->background_repo_update;
+  flags[2] = config->async_decorations;
+  flags[3] = config->persistent_shell;
+  flags[4] = config->sort_ignore_case;
+  flags[5] = config->sort_natural;
+  hash = fingerprint_string(hash, config->repo_directory);
+  hash = fingerprint_string(hash, config->wsl_repo_directory);
+  hash = fingerprint_string(hash, config->preferred_shell);
+  hash = fingerprint_string(hash, config->enter_action);
+  hash = fnv1a_bytes(hash, &config->max_depth, sizeof(config->max_depth));
+  hash = fnv1a_bytes(hash, flags, sizeof(flags));
+
+  hash = fnv1a_bytes(hash, &config->repo_root_count, sizeof(config->repo_root_count));
+  for (i = 0; i < config->repo_root_count; ++i) {
+    hash = fingerprint_string(hash, config->repo_roots[i]);
+  }
+  hash = fnv1a_bytes(hash, &config->custom_entry_count,
+                           sizeof(config->custom_entry_count));
+  for (i = 0; i < config->custom_entry_count; ++i) {
+    hash = fingerprint_string(hash, config->custom_entries[i].name);
+    hash = fingerprint_string(hash, config->custom_entries[i].win_path);
+    hash = fingerprint_string(hash, config->custom_entries[i].linux_path);
+  }
+  hash = fnv1a_bytes(hash, &config->custom_command_count,
+                           sizeof(config->custom_command_count));
+  for (i = 0; i < config->custom_command_count; ++i) {
+    hash = fingerprint_string(hash, config->custom_commands[i].name);
+    hash = fingerprint_string(hash, config->custom_commands[i].command);
+    hash = fnv1a_bytes(hash, &config->custom_commands[i].run_in_preferred_shell,
+                             sizeof(bool));
+    hash = fnv1a_bytes(hash, &config->custom_commands[i].shell, sizeof(OpShellMode));
+    hash = fingerprint_string(hash, config->custom_commands[i].key);
+  }
+  return hash;
+}
+
 void printConfig(const OpConfig *config) {
   size_t i = 0;
 
@@ -998,9 +1693,21 @@ void printConfig(const OpConfig *config) {
          config->repo_directory ? config->repo_directory : "");
   printf("  wslRepoDirectory: %s\n",
          config->wsl_repo_directory ? config->wsl_repo_directory : "");
+  printf("  repoRoots: %zu\n", config->repo_root_count);
+  for (i = 0; i < config->repo_root_count; ++i) {
+    printf("    - %s\n", config->repo_roots[i]);
+  }
+  printf("  maxDepth: %d\n", config->max_depth);
   printf("  isServer: %s\n", config->is_server ? "true" : "false");
+  printf("  backgroundRepoUpdate: %s\n",
+         config->background_repo_update ? "true" : "false");
+  printf("  asyncDecorations: %s\n", config->async_decorations ? "true" : "false");
+  printf("  persistentShell: %s\n", config->persistent_shell ? "true" : "false");
+  printf("  sortIgnoreCase: %s\n", config->sort_ignore_case ? "true" : "false");
+  printf("  sortNatural: %s\n", config->sort_natural ? "true" : "false");
   printf("  preferedShell: %s\n",
          config->preferred_shell ? config->preferred_shell : "");
+  printf("  enterAction: %s\n", config->enter_action ? config->enter_action : "");
 
   printf("  customEntries: %zu\n", config->custom_entry_count);
   for (i = 0; i < config->custom_entry_count; ++i) {
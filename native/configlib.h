@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 typedef struct {
   char *name;
@@ -10,26 +11,76 @@ typedef struct {
   char *linux_path;
 } OpCustomEntry;
 
+// How a custom command is started when it does not run in the preferred
+// shell ("shell" in config.json).
+typedef enum {
+  OP_SHELL_AUTO,   // exec'd directly unless it uses shell syntax, {{env:...}}
+                   // or {{oproot}}, else "login"
+  OP_SHELL_NONE,   // always exec'd directly; {{env:...}} and {{oproot}} are
+                   // each passed as one word
+  OP_SHELL_SH,     // /bin/sh -c
+  OP_SHELL_LOGIN,  // /bin/sh -lc
+} OpShellMode;
+
 typedef struct {
   char *name;
   char *command;
   bool run_in_preferred_shell;
+  OpShellMode shell;
+  // fzf key (e.g. "ctrl-g") that runs the command straight from the repo
+  // picker; NULL when unbound.
+  char *key;
 } OpCustomCommand;
 
 typedef struct {
   char *config_path;
   char *repo_directory;
   char *wsl_repo_directory;
+  char **repo_roots;
+  size_t repo_root_count;
+  int max_depth;
   bool is_server;
+  bool background_repo_update;
+  bool async_decorations;
+  // Continuous mode keeps a /bin/sh per shell mode running for custom
+  // commands instead of starting one for each.
+  bool persistent_shell;
+  // Order of the repo listing: ASCII case folded, and/or numbers by value.
+  bool sort_ignore_case;
+  bool sort_natural;
   char *preferred_shell;
+  // Action Enter runs straight from the repo picker; NULL asks for one.
+  char *enter_action;
   OpCustomEntry *custom_entries;
   size_t custom_entry_count;
   OpCustomCommand *custom_commands;
   size_t custom_command_count;
+  // Open-addressing indexes over the entry and command names: each slot holds
+  // position + 1 (0 is empty) and the slot counts are powers of two.
+  const uint32_t *custom_entry_slots;
+  size_t custom_entry_slot_count;
+  const uint32_t *custom_command_slots;
+  size_t custom_command_slot_count;
+  // The compiled cache the strings point into, when loaded from one.
+  void *cache_mapping;
+  size_t cache_mapping_size;
 } OpConfig;
 
+// The returned config and every string and array it points to share one
+// allocation; treat them as read-only and release them with freeConfig.
+// A compiled image of the parse is kept next to the file (config.json.cache)
+// and mapped instead of reparsing while the file is unchanged.
 OpConfig *loadConfigs(const char *config_path);
 void freeConfig(OpConfig *config);
+// Parses config_path and (re)writes its compiled cache; returns 1 on success.
+int compileConfigCache(const char *config_path);
 void printConfig(const OpConfig *config);
+// Hashes every setting (not the path or the cache/index bookkeeping), so two
+// parses that differ only in keys op ignores fingerprint the same.
+uint64_t configFingerprint(const OpConfig *config);
+// Look a custom entry or command up by name through the indexes above; the
+// first one listed wins when names repeat.
+const OpCustomEntry *findCustomEntry(const OpConfig *config, const char *name);
+const OpCustomCommand *findCustomCommand(const OpConfig *config, const char *name);
 
 #endif
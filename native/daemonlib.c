@@ -0,0 +1,386 @@
+#include "daemonlib.h"
+#include "pathlib.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define DAEMON_SOCKET_FILE "daemon.sock"
+#define DAEMON_MAX_REQUEST 4096
+#define DAEMON_IO_TIMEOUT_MS 2000
+#define DAEMON_WATCH_MASK                                                      \
+  (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF |      \
+   IN_MOVE_SELF | IN_ONLYDIR)
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int signal_number) {
+  (void)signal_number;
+  stop_requested = 1;
+}
+
+struct OpDaemon {
+  int listen_fd;
+  int inotify_fd;
+  int epoll_fd;
+  int changed;
+  char *socket_path;
+};
+
+static int fill_address(struct sockaddr_un *address, const char *socket_path) {
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(address->sun_path)) {
+    return 0;
+  }
+  strcpy(address->sun_path, socket_path);
+  return 1;
+}
+
+static void set_io_timeout(int fd) {
+  struct timeval timeout;
+  timeout.tv_sec = DAEMON_IO_TIMEOUT_MS / 1000;
+  timeout.tv_usec = (DAEMON_IO_TIMEOUT_MS % 1000) * 1000;
+  (void)setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  (void)setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+static int write_all(int fd, const char *ptr, size_t remaining) {
+  while (remaining > 0) {
+    ssize_t written = send(fd, ptr, remaining, MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return 0;
+    }
+    ptr += (size_t)written;
+    remaining -= (size_t)written;
+  }
+  return 1;
+}
+
+char *daemon_socket_path(void) {
+  return get_runtime_file_path(DAEMON_SOCKET_FILE);
+}
+
+static int connect_to(const char *socket_path) {
+  struct sockaddr_un address;
+  int fd;
+
+  if (!fill_address(&address, socket_path)) {
+    return -1;
+  }
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+
+  if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+OpDaemon *daemon_open(const char *socket_path) {
+  struct sockaddr_un address;
+  struct epoll_event event;
+  OpDaemon *daemon;
+  mode_t old_umask;
+  int existing;
+  int bound;
+
+  if (!fill_address(&address, socket_path)) {
+    fprintf(stderr, "Socket path is too long: %s\n", socket_path);
+    return NULL;
+  }
+
+  existing = connect_to(socket_path);
+  if (existing >= 0) {
+    close(existing);
+    fprintf(stderr, "An op daemon is already listening on %s\n", socket_path);
+    return NULL;
+  }
+  // Nobody answered, so whatever is at the path is left over from a crash.
+  unlink(socket_path);
+
+  daemon = calloc(1, sizeof(*daemon));
+  if (!daemon) {
+    return NULL;
+  }
+  daemon->listen_fd = -1;
+  daemon->inotify_fd = -1;
+  daemon->epoll_fd = -1;
+  daemon->changed = 1;
+
+  daemon->socket_path = strdup(socket_path);
+  if (!daemon->socket_path) {
+    goto fail;
+  }
+
+  daemon->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (daemon->listen_fd < 0) {
+    perror("socket");
+    goto fail;
+  }
+
+  // Bound under an owner-only umask, so the socket never exists with looser
+  // permissions that other users could connect through.
+  old_umask = umask(0077);
+  bound = bind(daemon->listen_fd, (struct sockaddr *)&address, sizeof(address)) == 0;
+  umask(old_umask);
+  if (!bound) {
+    perror("bind");
+    goto fail;
+  }
+
+  if (listen(daemon->listen_fd, 16) != 0) {
+    perror("listen");
+    goto fail;
+  }
+
+  daemon->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  daemon->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (daemon->inotify_fd < 0 || daemon->epoll_fd < 0) {
+    perror("inotify/epoll");
+    goto fail;
+  }
+
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = daemon->listen_fd;
+  if (epoll_ctl(daemon->epoll_fd, EPOLL_CTL_ADD, daemon->listen_fd, &event) != 0) {
+    perror("epoll_ctl");
+    goto fail;
+  }
+  event.data.fd = daemon->inotify_fd;
+  if (epoll_ctl(daemon->epoll_fd, EPOLL_CTL_ADD, daemon->inotify_fd, &event) != 0) {
+    perror("epoll_ctl");
+    goto fail;
+  }
+
+  return daemon;
+
+fail:
+  daemon_close(daemon);
+  return NULL;
+}
+
+int daemon_watch(OpDaemon *daemon, const char *directory) {
+  return inotify_add_watch(daemon->inotify_fd, directory, DAEMON_WATCH_MASK) >= 0;
+}
+
+// Dropping the whole inotify instance is cheaper than tracking every wd when
+// the watched tree is rebuilt.
+int daemon_unwatch_all(OpDaemon *daemon) {
+  struct epoll_event event;
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+  if (fd < 0) {
+    return 0;
+  }
+
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  if (epoll_ctl(daemon->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+    close(fd);
+    return 0;
+  }
+
+  close(daemon->inotify_fd);
+  daemon->inotify_fd = fd;
+  return 1;
+}
+
+static void drain_inotify(OpDaemon *daemon) {
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  while (1) {
+    ssize_t got = read(daemon->inotify_fd, buffer, sizeof(buffer));
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      break;
+    }
+    daemon->changed = 1;
+  }
+}
+
+int daemon_take_changes(OpDaemon *daemon) {
+  int changed;
+
+  drain_inotify(daemon);
+  changed = daemon->changed;
+  daemon->changed = 0;
+  return changed;
+}
+
+static void serve_client(OpDaemon *daemon, int client_fd,
+                         DaemonRequestFn handler, void *ctx) {
+  char request[DAEMON_MAX_REQUEST];
+  size_t request_len = 0;
+  char *response;
+  size_t response_len = 0;
+  char *newline = NULL;
+
+  set_io_timeout(client_fd);
+
+  while (!newline && request_len + 1 < sizeof(request)) {
+    ssize_t got = recv(client_fd, request + request_len,
+                       sizeof(request) - 1 - request_len, 0);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      return;
+    }
+    request_len += (size_t)got;
+    request[request_len] = '\0';
+    newline = strchr(request, '\n');
+  }
+
+  if (!newline) {
+    return;
+  }
+  *newline = '\0';
+
+  response = handler(ctx, daemon, request, &response_len);
+  if (response) {
+    (void)write_all(client_fd, response, response_len);
+    free(response);
+  }
+}
+
+// Runs until SIGINT/SIGTERM; returns 1 on a requested stop so the caller can
+// remove the socket, 0 on failure.
+int daemon_serve(OpDaemon *daemon, DaemonRequestFn handler, void *ctx) {
+  struct sigaction stop_action;
+
+  memset(&stop_action, 0, sizeof(stop_action));
+  stop_action.sa_handler = request_stop;
+  sigemptyset(&stop_action.sa_mask);
+  sigaction(SIGINT, &stop_action, NULL);
+  sigaction(SIGTERM, &stop_action, NULL);
+
+  while (!stop_requested) {
+    struct epoll_event events[4];
+    int ready = epoll_wait(daemon->epoll_fd, events, 4, -1);
+    int i;
+
+    if (ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("epoll_wait");
+      return 0;
+    }
+
+    for (i = 0; i < ready; ++i) {
+      if (events[i].data.fd == daemon->listen_fd) {
+        int client_fd = accept4(daemon->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client_fd >= 0) {
+          serve_client(daemon, client_fd, handler, ctx);
+          close(client_fd);
+        }
+      } else if (events[i].data.fd == daemon->inotify_fd) {
+        drain_inotify(daemon);
+      }
+    }
+  }
+  return 1;
+}
+
+void daemon_close(OpDaemon *daemon) {
+  if (!daemon) {
+    return;
+  }
+
+  if (daemon->listen_fd >= 0) {
+    close(daemon->listen_fd);
+    unlink(daemon->socket_path);
+  }
+  if (daemon->inotify_fd >= 0) {
+    close(daemon->inotify_fd);
+  }
+  if (daemon->epoll_fd >= 0) {
+    close(daemon->epoll_fd);
+  }
+  free(daemon->socket_path);
+  free(daemon);
+}
+
+// One round trip: send the request line, read the response to EOF. Returns
+// NULL (and the caller falls back to working locally) when no daemon answers.
+char *daemon_request(const char *socket_path, const char *request,
+                     size_t *response_len) {
+  char *response = NULL;
+  size_t len = 0;
+  size_t cap = 0;
+  int fd;
+
+  *response_len = 0;
+  fd = connect_to(socket_path);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  set_io_timeout(fd);
+  if (!write_all(fd, request, strlen(request)) || !write_all(fd, "\n", 1)) {
+    close(fd);
+    return NULL;
+  }
+  (void)shutdown(fd, SHUT_WR);
+
+  while (1) {
+    ssize_t got;
+
+    if (len + 4096 + 1 > cap) {
+      size_t new_cap = cap == 0 ? 65536 : cap * 2;
+      char *new_response = realloc(response, new_cap);
+      if (!new_response) {
+        free(response);
+        close(fd);
+        return NULL;
+      }
+      response = new_response;
+      cap = new_cap;
+    }
+
+    got = recv(fd, response + len, cap - len - 1, 0);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got < 0) {
+      free(response);
+      close(fd);
+      return NULL;
+    }
+    if (got == 0) {
+      break;
+    }
+    len += (size_t)got;
+  }
+
+  close(fd);
+  if (len == 0) {
+    free(response);
+    return NULL;
+  }
+
+  response[len] = '\0';
+  *response_len = len;
+  return response;
+}
@@ -0,0 +1,24 @@
+#ifndef daemon_lib_included
+#define daemon_lib_included
+
+#include <stddef.h>
+
+typedef struct OpDaemon OpDaemon;
+
+// Handles one request line; returns a malloc'd response or NULL to refuse it.
+typedef char *(*DaemonRequestFn)(void *ctx, OpDaemon *daemon,
+                                 const char *request, size_t *response_len);
+
+char *daemon_socket_path(void);
+
+OpDaemon *daemon_open(const char *socket_path);
+int daemon_watch(OpDaemon *daemon, const char *directory);
+int daemon_unwatch_all(OpDaemon *daemon);
+int daemon_take_changes(OpDaemon *daemon);
+int daemon_serve(OpDaemon *daemon, DaemonRequestFn handler, void *ctx);
+void daemon_close(OpDaemon *daemon);
+
+char *daemon_request(const char *socket_path, const char *request,
+                     size_t *response_len);
+
+#endif // daemon_lib_included
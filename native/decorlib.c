@@ -0,0 +1,220 @@
+#include "decorlib.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DECORATE_MAX_WORKERS 8
+#define DECORATE_PUBLISH_INTERVAL_NS 100000000L
+
+struct DecorationRun {
+  const char *const *candidates;
+  size_t count;
+  char **results;
+  size_t next;
+  size_t done;
+
+  DecorateFn decorate;
+  void *decorate_ctx;
+  char *listing_path;
+  DecorationPublishFn publish;
+  void *publish_ctx;
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int stop;
+
+  pthread_t publisher;
+  int publisher_started;
+  pthread_t workers[DECORATE_MAX_WORKERS];
+  size_t worker_count;
+};
+
+static int run_stopping(DecorationRun *run) {
+  return __atomic_load_n(&run->stop, __ATOMIC_ACQUIRE);
+}
+
+static void *decorate_worker(void *arg) {
+  DecorationRun *run = arg;
+
+  while (!run_stopping(run)) {
+    size_t index = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED);
+    char *result;
+
+    if (index >= run->count) {
+      break;
+    }
+    result = run->decorate(run->decorate_ctx, run->candidates[index]);
+    __atomic_store_n(&run->results[index], result, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&run->done, 1, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+static int write_all(FILE *file, const char *text) {
+  return fputs(text, file) >= 0 && fputc('\n', file) != EOF;
+}
+
+// Writes the listing to a temporary file and renames it into place, so a
+// reader never sees a half-written list.
+static int write_listing(DecorationRun *run) {
+  size_t path_len = strlen(run->listing_path);
+  char *temp_path = malloc(path_len + 5);
+  FILE *file;
+  int ok = 1;
+  size_t i;
+
+  if (!temp_path) {
+    return 0;
+  }
+  memcpy(temp_path, run->listing_path, path_len);
+  memcpy(temp_path + path_len, ".tmp", 5);
+
+  file = fopen(temp_path, "w");
+  if (!file) {
+    free(temp_path);
+    return 0;
+  }
+
+  for (i = 0; i < run->count && ok; ++i) {
+    const char *result = __atomic_load_n(&run->results[i], __ATOMIC_ACQUIRE);
+    ok = write_all(file, result ? result : run->candidates[i]);
+  }
+
+  if (fclose(file) != 0) {
+    ok = 0;
+  }
+  if (ok && rename(temp_path, run->listing_path) != 0) {
+    ok = 0;
+  }
+  if (!ok) {
+    unlink(temp_path);
+  }
+  free(temp_path);
+  return ok;
+}
+
+static void *decorate_publisher(void *arg) {
+  DecorationRun *run = arg;
+  size_t published = 0;
+
+  while (1) {
+    struct timespec deadline;
+    size_t done;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += DECORATE_PUBLISH_INTERVAL_NS;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&run->lock);
+    while (!run->stop) {
+      if (pthread_cond_timedwait(&run->wake, &run->lock, &deadline) == ETIMEDOUT) {
+        break;
+      }
+    }
+    pthread_mutex_unlock(&run->lock);
+    if (run_stopping(run)) {
+      break;
+    }
+
+    // A failed publish (fzf not listening yet, or an error reply) is
+    // retried, so the finished listing always reaches the picker.
+    done = __atomic_load_n(&run->done, __ATOMIC_ACQUIRE);
+    if (done != published && write_listing(run) && run->publish(run->publish_ctx)) {
+      published = done;
+    }
+    if (published == run->count) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+DecorationRun *decoration_start(const char *const *candidates, size_t count,
+                                DecorateFn decorate, void *decorate_ctx,
+                                const char *listing_path, DecorationPublishFn publish,
+                                void *publish_ctx) {
+  DecorationRun *run;
+  long cpu_count;
+  size_t wanted;
+
+  run = calloc(1, sizeof(*run));
+  if (!run) {
+    return NULL;
+  }
+
+  run->candidates = candidates;
+  run->count = count;
+  run->decorate = decorate;
+  run->decorate_ctx = decorate_ctx;
+  run->publish = publish;
+  run->publish_ctx = publish_ctx;
+  run->results = calloc(count > 0 ? count : 1, sizeof(*run->results));
+  run->listing_path = strdup(listing_path);
+  pthread_mutex_init(&run->lock, NULL);
+  pthread_cond_init(&run->wake, NULL);
+  if (!run->results || !run->listing_path) {
+    decoration_stop(run);
+    return NULL;
+  }
+
+  // Mostly lstat and small reads, so a few more threads than cores help.
+  cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+  wanted = cpu_count > 0 ? (size_t)cpu_count * 2 : 2;
+  if (wanted > DECORATE_MAX_WORKERS) {
+    wanted = DECORATE_MAX_WORKERS;
+  }
+  if (wanted > count) {
+    wanted = count;
+  }
+
+  while (run->worker_count < wanted &&
+         pthread_create(&run->workers[run->worker_count], NULL, decorate_worker, run) ==
+             0) {
+    run->worker_count++;
+  }
+
+  if (run->worker_count > 0 &&
+      pthread_create(&run->publisher, NULL, decorate_publisher, run) == 0) {
+    run->publisher_started = 1;
+  }
+  return run;
+}
+
+void decoration_stop(DecorationRun *run) {
+  size_t i;
+
+  if (!run) {
+    return;
+  }
+
+  pthread_mutex_lock(&run->lock);
+  __atomic_store_n(&run->stop, 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&run->wake);
+  pthread_mutex_unlock(&run->lock);
+
+  if (run->publisher_started) {
+    pthread_join(run->publisher, NULL);
+  }
+  for (i = 0; i < run->worker_count; ++i) {
+    pthread_join(run->workers[i], NULL);
+  }
+
+  if (run->results) {
+    for (i = 0; i < run->count; ++i) {
+      free(run->results[i]);
+    }
+  }
+  free(run->results);
+  free(run->listing_path);
+  pthread_mutex_destroy(&run->lock);
+  pthread_cond_destroy(&run->wake);
+  free(run);
+}
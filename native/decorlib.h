@@ -0,0 +1,28 @@
+#ifndef decor_lib_included
+#define decor_lib_included
+
+#include <stddef.h>
+
+// Returns the decorated form of a candidate (malloc'd), or NULL to keep it
+// bare. Called from several worker threads at once.
+typedef char *(*DecorateFn)(void *ctx, const char *candidate);
+
+// Called after listing_path was rewritten with more decorations filled in.
+// Returns 0 when the listing did not reach the picker, so it is published
+// again on the next tick.
+typedef int (*DecorationPublishFn)(void *ctx);
+
+// Decorates a listing on a pool of threads while the picker is already up,
+// rewriting listing_path (bare names where nothing is known yet) and calling
+// publish at most every 100ms while results keep arriving. candidates must
+// stay valid until decoration_stop.
+typedef struct DecorationRun DecorationRun;
+
+DecorationRun *decoration_start(const char *const *candidates, size_t count,
+                                DecorateFn decorate, void *decorate_ctx,
+                                const char *listing_path, DecorationPublishFn publish,
+                                void *publish_ctx);
+// Cancels what is still pending and waits for the workers.
+void decoration_stop(DecorationRun *run);
+
+#endif // decor_lib_included
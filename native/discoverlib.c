@@ -0,0 +1,344 @@
+#include "discoverlib.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define DISCOVER_MAX_WORKERS 8
+
+typedef struct DiscoverTask {
+  struct DiscoverTask *next;
+  size_t root_index;
+  int depth;
+  char relative_path[];
+} DiscoverTask;
+
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  DiscoverTask *head;
+  DiscoverTask *tail;
+  size_t active;
+  size_t idle;
+  int stop;
+
+  pthread_mutex_t emit_lock;
+  RepoDiscoveredFn on_repo;
+  void *ctx;
+
+  const int *root_fds;
+  int max_depth;
+} DiscoverState;
+
+static DiscoverTask *new_task(size_t root_index, const char *relative_path,
+                              int depth) {
+  size_t len = strlen(relative_path);
+  DiscoverTask *task = malloc(sizeof(*task) + len + 1);
+  if (!task) {
+    return NULL;
+  }
+  task->next = NULL;
+  task->root_index = root_index;
+  task->depth = depth;
+  memcpy(task->relative_path, relative_path, len + 1);
+  return task;
+}
+
+// Caller holds state->lock.
+static void enqueue_locked(DiscoverState *state, DiscoverTask *task) {
+  if (state->tail) {
+    state->tail->next = task;
+  } else {
+    state->head = task;
+  }
+  state->tail = task;
+  pthread_cond_signal(&state->wake);
+}
+
+// Hands a subtree to an idle worker instead of descending into it ourselves.
+// Returns 0 when nobody is waiting and the caller should recurse.
+static int share_subtree(DiscoverState *state, size_t root_index,
+                         const char *relative_path, int depth) {
+  DiscoverTask *task;
+  int shared = 0;
+
+  pthread_mutex_lock(&state->lock);
+  if (state->idle > 0) {
+    task = new_task(root_index, relative_path, depth);
+    if (task) {
+      enqueue_locked(state, task);
+      shared = 1;
+    }
+  }
+  pthread_mutex_unlock(&state->lock);
+  return shared;
+}
+
+static int should_stop(DiscoverState *state) {
+  return __atomic_load_n(&state->stop, __ATOMIC_RELAXED);
+}
+
+static void request_stop(DiscoverState *state) {
+  pthread_mutex_lock(&state->lock);
+  state->stop = 1;
+  pthread_cond_broadcast(&state->wake);
+  pthread_mutex_unlock(&state->lock);
+}
+
+static int is_git_repo(int dir_fd) {
+  struct stat st;
+
+  // A worktree or submodule checkout has a .git file pointing elsewhere.
+  if (fstatat(dir_fd, ".git", &st, AT_SYMLINK_NOFOLLOW) != 0) {
+    return 0;
+  }
+  return S_ISDIR(st.st_mode) || S_ISREG(st.st_mode);
+}
+
+static void emit_repo(DiscoverState *state, size_t root_index,
+                      const char *relative_path) {
+  int keep_going;
+
+  pthread_mutex_lock(&state->emit_lock);
+  keep_going = state->on_repo(state->ctx, root_index, relative_path);
+  pthread_mutex_unlock(&state->emit_lock);
+
+  if (!keep_going) {
+    request_stop(state);
+  }
+}
+
+// Walks the directory open on dir_fd (which it takes ownership of) depth-first.
+// path holds the directory's path relative to its root and is restored before
+// returning.
+static void walk_directory(DiscoverState *state, size_t root_index, int dir_fd,
+                           char *path, size_t path_len, int depth) {
+  DIR *dir;
+  struct dirent *entry;
+
+  dir = fdopendir(dir_fd);
+  if (!dir) {
+    close(dir_fd);
+    return;
+  }
+
+  while (!should_stop(state) && (entry = readdir(dir)) != NULL) {
+    size_t name_len;
+    size_t child_len;
+    int child_fd;
+    int is_link = entry->d_type == DT_LNK;
+
+    // Skips ".", ".." and hidden directories such as .cache or .git itself.
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+
+    if (entry->d_type != DT_DIR && entry->d_type != DT_LNK &&
+        entry->d_type != DT_UNKNOWN) {
+      continue;
+    }
+
+    if (entry->d_type == DT_UNKNOWN) {
+      struct stat st;
+      if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        continue;
+      }
+      is_link = S_ISLNK(st.st_mode);
+      if (!is_link && !S_ISDIR(st.st_mode)) {
+        continue;
+      }
+    }
+
+    name_len = strlen(entry->d_name);
+    child_len = path_len + (path_len > 0 ? 1 : 0) + name_len;
+    if (child_len >= PATH_MAX) {
+      continue;
+    }
+
+    child_fd = openat(dirfd(dir), entry->d_name,
+                      O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (child_fd < 0) {
+      continue;
+    }
+
+    if (path_len > 0) {
+      path[path_len] = '/';
+      memcpy(path + path_len + 1, entry->d_name, name_len + 1);
+    } else {
+      memcpy(path, entry->d_name, name_len + 1);
+    }
+
+    if (is_git_repo(child_fd)) {
+      close(child_fd);
+      emit_repo(state, root_index, path);
+    } else if (depth + 1 >= state->max_depth || is_link) {
+      // Symlinked directories are listed when they are repos but never
+      // descended into, so link cycles cannot trap the walk.
+      close(child_fd);
+    } else if (share_subtree(state, root_index, path, depth + 1)) {
+      close(child_fd);
+    } else {
+      walk_directory(state, root_index, child_fd, path, child_len, depth + 1);
+    }
+
+    path[path_len] = '\0';
+  }
+
+  closedir(dir);
+}
+
+static void *discover_worker(void *arg) {
+  DiscoverState *state = arg;
+  char *path = malloc(PATH_MAX);
+
+  if (!path) {
+    request_stop(state);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&state->lock);
+  while (1) {
+    DiscoverTask *task;
+    int dir_fd;
+
+    while (!state->head && !state->stop && state->active > 0) {
+      state->idle++;
+      pthread_cond_wait(&state->wake, &state->lock);
+      state->idle--;
+    }
+
+    if (state->stop || !state->head) {
+      pthread_cond_broadcast(&state->wake);
+      break;
+    }
+
+    task = state->head;
+    state->head = task->next;
+    if (!state->head) {
+      state->tail = NULL;
+    }
+    state->active++;
+    pthread_mutex_unlock(&state->lock);
+
+    dir_fd = openat(state->root_fds[task->root_index],
+                    task->relative_path[0] ? task->relative_path : ".",
+                    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+      size_t len = strlen(task->relative_path);
+      memcpy(path, task->relative_path, len + 1);
+      walk_directory(state, task->root_index, dir_fd, path, len, task->depth);
+    }
+    free(task);
+
+    pthread_mutex_lock(&state->lock);
+    state->active--;
+    if (!state->head && state->active == 0) {
+      pthread_cond_broadcast(&state->wake);
+    }
+  }
+  pthread_mutex_unlock(&state->lock);
+
+  free(path);
+  return NULL;
+}
+
+static size_t discover_worker_count(void) {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cores < 1) {
+    return 1;
+  }
+  return cores > DISCOVER_MAX_WORKERS ? DISCOVER_MAX_WORKERS : (size_t)cores;
+}
+
+int discover_repos(const char *const *roots, size_t root_count, int max_depth,
+                   RepoDiscoveredFn on_repo, void *ctx) {
+  DiscoverState state;
+  pthread_t threads[DISCOVER_MAX_WORKERS];
+  size_t thread_count = 0;
+  size_t worker_count;
+  int *root_fds;
+  size_t i;
+  int ok = 1;
+
+  root_fds = malloc((root_count > 0 ? root_count : 1) * sizeof(*root_fds));
+  if (!root_fds) {
+    return 0;
+  }
+
+  memset(&state, 0, sizeof(state));
+  pthread_mutex_init(&state.lock, NULL);
+  pthread_cond_init(&state.wake, NULL);
+  pthread_mutex_init(&state.emit_lock, NULL);
+  state.on_repo = on_repo;
+  state.ctx = ctx;
+  state.root_fds = root_fds;
+  state.max_depth = max_depth < 1 ? 1 : max_depth;
+
+  for (i = 0; i < root_count; ++i) {
+    root_fds[i] = -1;
+  }
+
+  for (i = 0; i < root_count; ++i) {
+    DiscoverTask *task;
+
+    root_fds[i] = open(roots[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fds[i] < 0) {
+      fprintf(stderr, "Skipping repo root '%s': %s\n", roots[i], strerror(errno));
+      continue;
+    }
+
+    task = new_task(i, "", 0);
+    if (!task) {
+      ok = 0;
+      break;
+    }
+    enqueue_locked(&state, task);
+  }
+
+  worker_count = ok ? discover_worker_count() : 0;
+  for (i = 0; i < worker_count; ++i) {
+    if (pthread_create(&threads[thread_count], NULL, discover_worker, &state) != 0) {
+      break;
+    }
+    thread_count++;
+  }
+
+  if (ok && thread_count == 0) {
+    // No threads available; walk everything on the calling thread.
+    discover_worker(&state);
+  }
+
+  for (i = 0; i < thread_count; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+
+  while (state.head) {
+    DiscoverTask *next = state.head->next;
+    free(state.head);
+    state.head = next;
+  }
+
+  if (state.stop) {
+    ok = 0;
+  }
+
+  for (i = 0; i < root_count; ++i) {
+    if (root_fds[i] >= 0) {
+      close(root_fds[i]);
+    }
+  }
+  free(root_fds);
+
+  pthread_mutex_destroy(&state.lock);
+  pthread_cond_destroy(&state.wake);
+  pthread_mutex_destroy(&state.emit_lock);
+  return ok;
+}
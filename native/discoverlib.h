@@ -0,0 +1,14 @@
+#ifndef discover_lib_included
+#define discover_lib_included
+
+#include <stddef.h>
+
+// Called once per repository found, serialized across workers. relative_path
+// is relative to roots[root_index]. Returning 0 stops the walk.
+typedef int (*RepoDiscoveredFn)(void *ctx, size_t root_index,
+                                const char *relative_path);
+
+int discover_repos(const char *const *roots, size_t root_count, int max_depth,
+                   RepoDiscoveredFn on_repo, void *ctx);
+
+#endif // discover_lib_included
@@ -1,96 +1,487 @@
 #include "fzflib.h"
+#include "spawnlib.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/types.h>
-#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
-char *askChoicesWithPrompt(const char *choices, const char *prompt) {
+#define PICKER_BUFFER_SIZE 8192
+#define PICKER_FLUSH_INTERVAL_NS 20000000L
+#define FZF_MAX_ARGS 16
+#define FZF_API_KEY_VAR "FZF_API_KEY="
+// --listen arrived in fzf 0.36, but only from 0.48 on is it certain to honour
+// FZF_API_KEY and to refuse execute() from clients.
+#define FZF_LISTEN_MIN_MAJOR 0
+#define FZF_LISTEN_MIN_MINOR 48
+// fzf answers a local POST at once; longer means it stalled.
+#define FZF_POST_TIMEOUT_MS 500
+
+extern char **environ;
+
+// Writes are buffered and sent when the buffer fills or PICKER_FLUSH_INTERVAL
+// has passed. A flusher thread, started with the first write, sends what a
+// slow producer (a large root still being scanned) left behind; lock guards
+// the buffer and the pipe between it and the writer.
+struct FzfPicker {
+  pid_t pid;
+  int to_child;
+  int from_child;
+  int input_closed;
+  struct sigaction previous_sigpipe;
+  struct timespec last_flush;
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_t flusher;
+  int flusher_started;
+  int stopping;
+
+  size_t pending_len;
+  char pending[PICKER_BUFFER_SIZE];
+};
+
+static long elapsed_ns(const struct timespec *since) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+  return (long)(now.tv_sec - since->tv_sec) * 1000000000L +
+         (now.tv_nsec - since->tv_nsec);
+}
+
+static int write_all(int fd, const char *ptr, size_t remaining) {
+  while (remaining > 0) {
+    ssize_t written = write(fd, ptr, remaining);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return 0;
+    }
+    ptr += (size_t)written;
+    remaining -= (size_t)written;
+  }
+  return 1;
+}
+
+static void close_input(FzfPicker *picker) {
+  if (picker->to_child >= 0) {
+    close(picker->to_child);
+    picker->to_child = -1;
+  }
+  __atomic_store_n(&picker->input_closed, 1, __ATOMIC_RELAXED);
+}
+
+// Called with lock held (or before the flusher exists).
+static int picker_flush(FzfPicker *picker) {
+  if (picker->input_closed) {
+    return 0;
+  }
+
+  if (picker->pending_len > 0 &&
+      !write_all(picker->to_child, picker->pending, picker->pending_len)) {
+    // fzf stopped reading, most likely because a choice was already made.
+    close_input(picker);
+  }
+
+  picker->pending_len = 0;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &picker->last_flush);
+  return !picker->input_closed;
+}
+
+static void *picker_flusher(void *arg) {
+  FzfPicker *picker = arg;
+
+  pthread_mutex_lock(&picker->lock);
+  while (!picker->stopping && !picker->input_closed) {
+    struct timespec deadline;
+
+    if (picker->pending_len == 0) {
+      pthread_cond_wait(&picker->wake, &picker->lock);
+      continue;
+    }
+    // last_flush is on the coarse clock, which trails this one by a tick at
+    // most, so the wait can end a little early but never late.
+    deadline = picker->last_flush;
+    deadline.tv_nsec += PICKER_FLUSH_INTERVAL_NS;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    if (pthread_cond_timedwait(&picker->wake, &picker->lock, &deadline) == ETIMEDOUT &&
+        !picker->stopping) {
+      (void)picker_flush(picker);
+    }
+  }
+  pthread_mutex_unlock(&picker->lock);
+  return NULL;
+}
+
+// Called with lock held, after something was added to an empty buffer.
+static void wake_flusher(FzfPicker *picker) {
+  if (!picker->flusher_started && !picker->stopping) {
+    picker->flusher_started =
+        pthread_create(&picker->flusher, NULL, picker_flusher, picker) == 0;
+  }
+  pthread_cond_signal(&picker->wake);
+}
+
+static void stop_flusher(FzfPicker *picker) {
+  pthread_mutex_lock(&picker->lock);
+  picker->stopping = 1;
+  pthread_cond_signal(&picker->wake);
+  pthread_mutex_unlock(&picker->lock);
+  if (picker->flusher_started) {
+    pthread_join(picker->flusher, NULL);
+    picker->flusher_started = 0;
+  }
+}
+
+// op's environment with FZF_API_KEY replaced by the listener's key; one
+// malloc, the variable itself stored after the pointers.
+static char **listen_environment(const FzfListen *listen) {
+  size_t count = 0;
+  size_t kept = 0;
+  size_t key_size = sizeof(FZF_API_KEY_VAR) + sizeof(listen->api_key);
+  char **envp;
+  char *key_var;
+  size_t i;
+
+  while (environ[count]) {
+    count++;
+  }
+  envp = malloc((count + 2) * sizeof(*envp) + key_size);
+  if (!envp) {
+    return NULL;
+  }
+  key_var = (char *)(envp + count + 2);
+  snprintf(key_var, key_size, "%s%s", FZF_API_KEY_VAR, listen->api_key);
+  for (i = 0; i < count; ++i) {
+    if (strncmp(environ[i], FZF_API_KEY_VAR, sizeof(FZF_API_KEY_VAR) - 1) != 0) {
+      envp[kept++] = environ[i];
+    }
+  }
+  envp[kept++] = key_var;
+  envp[kept] = NULL;
+  return envp;
+}
+
+// extra_args is a NULL-terminated list of fzf options, or NULL. With listen,
+// fzf serves --listen on its port and only accepts requests with its key.
+static FzfPicker *picker_open(const char *prompt, const char *const *extra_args,
+                              const FzfListen *listen) {
+  const char *argv[FZF_MAX_ARGS + 1];
+  char listen_arg[32];
+  char **envp;
+  size_t argc = 0;
   int to_child[2];
   int from_child[2];
-  pid_t pid;
-  char *output = NULL;
-  size_t output_len = 0;
-  size_t output_cap = 0;
-  int status = 0;
+  struct sigaction ignore_sigpipe;
+  FzfPicker *picker;
 
-  if (!choices) {
+  argv[argc++] = "fzf";
+  if (prompt && prompt[0] != '\0') {
+    argv[argc++] = "--prompt";
+    argv[argc++] = prompt;
+  }
+  while (extra_args && *extra_args) {
+    if (argc == FZF_MAX_ARGS) {
+      fprintf(stderr, "Too many fzf arguments\n");
+      return NULL;
+    }
+    argv[argc++] = *extra_args++;
+  }
+  if (listen) {
+    if (argc == FZF_MAX_ARGS) {
+      fprintf(stderr, "Too many fzf arguments\n");
+      return NULL;
+    }
+    snprintf(listen_arg, sizeof(listen_arg), "--listen=%d", listen->port);
+    argv[argc++] = listen_arg;
+  }
+  argv[argc] = NULL;
+
+  picker = calloc(1, sizeof(*picker));
+  if (!picker) {
     return NULL;
   }
 
-  if (pipe(to_child) != 0) {
+  // Both pipes are close-on-exec so fzf only holds the ends it is given and
+  // sees EOF once op closes its side.
+  if (pipe2(to_child, O_CLOEXEC) != 0) {
     perror("pipe");
+    free(picker);
     return NULL;
   }
 
-  if (pipe(from_child) != 0) {
+  if (pipe2(from_child, O_CLOEXEC) != 0) {
     perror("pipe");
     close(to_child[0]);
     close(to_child[1]);
+    free(picker);
     return NULL;
   }
 
-  pid = fork();
-  if (pid < 0) {
-    perror("fork");
-    close(to_child[0]);
+  envp = listen ? listen_environment(listen) : environ;
+  if (envp) {
+    const int fds[] = {to_child[0], from_child[1]};
+    picker->pid = spawn_process_env(NULL, (char *const *)argv, fds, 2, envp);
+    if (envp != environ) {
+      free(envp);
+    }
+  } else {
+    picker->pid = -1;
+  }
+
+  close(to_child[0]);
+  close(from_child[1]);
+  if (picker->pid < 0) {
     close(to_child[1]);
     close(from_child[0]);
-    close(from_child[1]);
+    free(picker);
     return NULL;
   }
 
-  if (pid == 0) {
-    close(to_child[1]);
-    close(from_child[0]);
+  picker->to_child = to_child[1];
+  picker->from_child = from_child[0];
 
-    if (dup2(to_child[0], STDIN_FILENO) < 0) {
-      _exit(127);
-    }
+  // A write after fzf has exited must surface as EPIPE, not kill op.
+  memset(&ignore_sigpipe, 0, sizeof(ignore_sigpipe));
+  ignore_sigpipe.sa_handler = SIG_IGN;
+  sigemptyset(&ignore_sigpipe.sa_mask);
+  sigaction(SIGPIPE, &ignore_sigpipe, &picker->previous_sigpipe);
+
+  {
+    pthread_condattr_t wake_attr;
+    pthread_condattr_init(&wake_attr);
+    pthread_condattr_setclock(&wake_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&picker->wake, &wake_attr);
+    pthread_condattr_destroy(&wake_attr);
+  }
+  pthread_mutex_init(&picker->lock, NULL);
 
-    if (dup2(from_child[1], STDOUT_FILENO) < 0) {
-      _exit(127);
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &picker->last_flush);
+  return picker;
+}
+
+FzfPicker *fzfPickerOpenWithArgs(const char *prompt, const char *const *extra_args) {
+  return picker_open(prompt, extra_args, NULL);
+}
+
+FzfPicker *fzfPickerOpenListening(const char *prompt, const char *const *extra_args,
+                                  const FzfListen *listen) {
+  return picker_open(prompt, extra_args, listen);
+}
+
+FzfPicker *fzfPickerOpen(const char *prompt) {
+  return fzfPickerOpenWithArgs(prompt, NULL);
+}
+
+static int write_block_locked(FzfPicker *picker, const char *choices, size_t len) {
+  if (picker->input_closed) {
+    return 0;
+  }
+
+  if (picker->pending_len + len > sizeof(picker->pending)) {
+    if (!picker_flush(picker)) {
+      return 0;
     }
+    if (len > sizeof(picker->pending)) {
+      if (!write_all(picker->to_child, choices, len)) {
+        close_input(picker);
+        return 0;
+      }
+      return 1;
+    }
+  }
 
-    close(to_child[0]);
-    close(from_child[1]);
+  if (picker->pending_len == 0) {
+    wake_flusher(picker);
+  }
+  memcpy(picker->pending + picker->pending_len, choices, len);
+  picker->pending_len += len;
 
-    if (prompt && prompt[0] != '\0') {
-      execlp("fzf", "fzf", "--prompt", prompt, (char *)NULL);
-    } else {
-      execlp("fzf", "fzf", (char *)NULL);
+  // A steady producer flushes from here; the flusher covers the pauses.
+  if (elapsed_ns(&picker->last_flush) >= PICKER_FLUSH_INTERVAL_NS) {
+    return picker_flush(picker);
+  }
+  return 1;
+}
+
+int fzfPickerWriteBlock(FzfPicker *picker, const char *choices, size_t len) {
+  int ok;
+
+  pthread_mutex_lock(&picker->lock);
+  ok = write_block_locked(picker, choices, len);
+  pthread_mutex_unlock(&picker->lock);
+  return ok;
+}
+
+int fzfPickerWrite(FzfPicker *picker, const char *choice) {
+  size_t len = strlen(choice);
+  int ok;
+
+  pthread_mutex_lock(&picker->lock);
+  if (picker->pending_len + len + 1 <= sizeof(picker->pending) && !picker->input_closed) {
+    if (picker->pending_len == 0) {
+      wake_flusher(picker);
     }
-    _exit(127);
+    picker->pending[picker->pending_len + len] = '\n';
+    memcpy(picker->pending + picker->pending_len, choice, len);
+    picker->pending_len += len + 1;
+    ok = elapsed_ns(&picker->last_flush) < PICKER_FLUSH_INTERVAL_NS || picker_flush(picker);
+  } else {
+    ok = write_block_locked(picker, choice, len) && write_block_locked(picker, "\n", 1);
   }
+  pthread_mutex_unlock(&picker->lock);
+  return ok;
+}
 
-  close(to_child[0]);
-  close(from_child[1]);
+int fzfPickerIsOpen(const FzfPicker *picker) {
+  return !__atomic_load_n(&picker->input_closed, __ATOMIC_RELAXED);
+}
 
-  {
-    size_t remaining = strlen(choices);
-    const char *ptr = choices;
-    while (remaining > 0) {
-      ssize_t written = write(to_child[1], ptr, remaining);
-      if (written < 0) {
-        if (errno == EINTR) {
-          continue;
-        }
-        break;
-      }
-      ptr += (size_t)written;
-      remaining -= (size_t)written;
+// Sends what is buffered and ends fzf's stdin; the picker stays up.
+void fzfPickerCloseInput(FzfPicker *picker) {
+  stop_flusher(picker);
+  if (picker->input_closed) {
+    return;
+  }
+  (void)picker_flush(picker);
+  close_input(picker);
+}
+
+int fzfSupportsListen(void) {
+  static int supported = -1;
+
+  if (supported < 0) {
+    char *const argv[] = {"fzf", "--version", NULL};
+    char *output = spawn_capture(NULL, argv, 0, NULL, NULL);
+    int major;
+    int minor;
+
+    supported = output && sscanf(output, "%d.%d", &major, &minor) == 2 &&
+                (major > FZF_LISTEN_MIN_MAJOR ||
+                 (major == FZF_LISTEN_MIN_MAJOR && minor >= FZF_LISTEN_MIN_MINOR));
+    free(output);
+  }
+  return supported;
+}
+
+// Picks a free localhost port for `fzf --listen` and a random API key for
+// it. The port is released before fzf binds it, so another local process
+// can take it in between; it then receives the posted actions (and the key,
+// which only opens this picker) instead of fzf, and the decorations never
+// arrive.
+int fzfListenReserve(FzfListen *listen) {
+  struct sockaddr_in address;
+  socklen_t address_len = sizeof(address);
+  unsigned char key[(sizeof(listen->api_key) - 1) / 2];
+  size_t i;
+  int fd;
+
+  listen->port = -1;
+  if (getrandom(key, sizeof(key), 0) != (ssize_t)sizeof(key)) {
+    return 0;
+  }
+  for (i = 0; i < sizeof(key); ++i) {
+    snprintf(listen->api_key + i * 2, 3, "%02x", key[i]);
+  }
+
+  fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return 0;
+  }
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(fd, (struct sockaddr *)&address, sizeof(address)) == 0 &&
+      getsockname(fd, (struct sockaddr *)&address, &address_len) == 0) {
+    listen->port = ntohs(address.sin_port);
+  }
+  close(fd);
+  return listen->port > 0;
+}
+
+// Runs an fzf action (e.g. "reload(...)") in the fzf listening on
+// listen->port. Returns 1 once fzf answered with 200. Every socket call is
+// bounded by FZF_POST_TIMEOUT_MS, so a stalled fzf (or whatever took the
+// port) only drops the action instead of blocking the caller.
+int fzfPostAction(const FzfListen *listen, const char *action) {
+  struct sockaddr_in address;
+  struct timeval timeout = {FZF_POST_TIMEOUT_MS / 1000, (FZF_POST_TIMEOUT_MS % 1000) * 1000};
+  char header[192];
+  char reply[64];
+  size_t action_len = strlen(action);
+  ssize_t got;
+  int header_len;
+  int ok = 0;
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  if (fd < 0) {
+    return 0;
+  }
+  if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) != 0 ||
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0) {
+    close(fd);
+    return 0;
+  }
+
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons((uint16_t)listen->port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  header_len = snprintf(header, sizeof(header),
+                        "POST / HTTP/1.1\r\nHost: localhost\r\nx-api-key: %s\r\n"
+                        "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                        listen->api_key, action_len);
+  if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0 &&
+      header_len > 0 && (size_t)header_len < sizeof(header) &&
+      write_all(fd, header, (size_t)header_len) && write_all(fd, action, action_len)) {
+    do {
+      got = read(fd, reply, sizeof(reply) - 1);
+    } while (got < 0 && errno == EINTR);
+    if (got > 0) {
+      reply[got] = '\0';
+      ok = strncmp(reply, "HTTP/1.1 200", 12) == 0 || strncmp(reply, "HTTP/1.0 200", 12) == 0;
     }
   }
-  close(to_child[1]);
+  close(fd);
+  return ok;
+}
+
+// Waits for fzf and returns everything it printed, or NULL when it was
+// cancelled or printed nothing.
+static char *picker_read_output(FzfPicker *picker) {
+  char *output = NULL;
+  size_t output_len = 0;
+  size_t output_cap = 0;
+  int status;
+  int failed = 0;
+
+  if (!picker) {
+    return NULL;
+  }
+
+  stop_flusher(picker);
+  picker_flush(picker);
+  close_input(picker);
 
   while (1) {
     char chunk[256];
-    ssize_t bytes_read = read(from_child[0], chunk, sizeof(chunk));
+    ssize_t bytes_read = read(picker->from_child, chunk, sizeof(chunk));
     if (bytes_read < 0) {
       if (errno == EINTR) {
         continue;
@@ -106,25 +497,15 @@ char *askChoicesWithPrompt(const char *choices, const char *prompt) {
       char *new_output;
       while (new_cap < output_len + (size_t)bytes_read + 1) {
         if (new_cap > (SIZE_MAX / 2)) {
-          free(output);
-          output = NULL;
-          output_len = 0;
-          output_cap = 0;
-          close(from_child[0]);
-          waitpid(pid, &status, 0);
-          return NULL;
+          failed = 1;
+          break;
         }
         new_cap *= 2;
       }
-      new_output = realloc(output, new_cap);
+      new_output = failed ? NULL : realloc(output, new_cap);
       if (!new_output) {
-        free(output);
-        output = NULL;
-        output_len = 0;
-        output_cap = 0;
-        close(from_child[0]);
-        waitpid(pid, &status, 0);
-        return NULL;
+        failed = 1;
+        break;
       }
       output = new_output;
       output_cap = new_cap;
@@ -135,10 +516,14 @@ char *askChoicesWithPrompt(const char *choices, const char *prompt) {
     output[output_len] = '\0';
   }
 
-  close(from_child[0]);
-  waitpid(pid, &status, 0);
+  close(picker->from_child);
+  status = spawn_wait(picker->pid);
+  sigaction(SIGPIPE, &picker->previous_sigpipe, NULL);
+  pthread_mutex_destroy(&picker->lock);
+  pthread_cond_destroy(&picker->wake);
+  free(picker);
 
-  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+  if (failed || status != 0) {
     free(output);
     return NULL;
   }
@@ -148,11 +533,20 @@ char *askChoicesWithPrompt(const char *choices, const char *prompt) {
     return NULL;
   }
 
-  {
-    char *newline = strchr(output, '\n');
-    if (newline) {
-      *newline = '\0';
-    }
+  return output;
+}
+
+char *fzfPickerFinish(FzfPicker *picker) {
+  char *output = picker_read_output(picker);
+  char *newline;
+
+  if (!output) {
+    return NULL;
+  }
+
+  newline = strchr(output, '\n');
+  if (newline) {
+    *newline = '\0';
   }
 
   if (output[0] == '\0') {
@@ -163,6 +557,64 @@ char *askChoicesWithPrompt(const char *choices, const char *prompt) {
   return output;
 }
 
+char *fzfPickerFinishWithKey(FzfPicker *picker, char **key) {
+  char *output = picker_read_output(picker);
+  char *selection;
+  char *newline;
+  size_t selection_len;
+
+  *key = NULL;
+  if (!output) {
+    return NULL;
+  }
+
+  // --expect prints the key line ("" for Enter) before the selection.
+  newline = strchr(output, '\n');
+  if (!newline) {
+    free(output);
+    return NULL;
+  }
+  *newline = '\0';
+  selection = newline + 1;
+  selection_len = strcspn(selection, "\n");
+  if (selection_len == 0) {
+    free(output);
+    return NULL;
+  }
+
+  // One block: the selection is moved to the front and the key follows it.
+  {
+    size_t key_len = (size_t)(newline - output);
+    char *result = malloc(selection_len + key_len + 2);
+    if (!result) {
+      free(output);
+      return NULL;
+    }
+    memcpy(result, selection, selection_len);
+    result[selection_len] = '\0';
+    memcpy(result + selection_len + 1, output, key_len + 1);
+    *key = result + selection_len + 1;
+    free(output);
+    return result;
+  }
+}
+
+char *askChoicesWithPrompt(const char *choices, const char *prompt) {
+  FzfPicker *picker;
+
+  if (!choices) {
+    return NULL;
+  }
+
+  picker = fzfPickerOpen(prompt);
+  if (!picker) {
+    return NULL;
+  }
+
+  (void)fzfPickerWriteBlock(picker, choices, strlen(choices));
+  return fzfPickerFinish(picker);
+}
+
 char *askChoices(const char *choices) {
   return askChoicesWithPrompt(choices, NULL);
 }
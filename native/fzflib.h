@@ -1,6 +1,38 @@
 #ifndef fzf_lib_included
 #define fzf_lib_included
 
+#include <stddef.h>
+
+// A running fzf whose candidate list is still being written. Candidates can
+// be streamed in while the user is already typing.
+typedef struct FzfPicker FzfPicker;
+
+FzfPicker* fzfPickerOpen(const char* prompt);
+FzfPicker* fzfPickerOpenWithArgs(const char* prompt, const char* const* extra_args);
+int fzfPickerWrite(FzfPicker* picker, const char* choice);
+int fzfPickerWriteBlock(FzfPicker* picker, const char* choices, size_t len);
+int fzfPickerIsOpen(const FzfPicker* picker);
+void fzfPickerCloseInput(FzfPicker* picker);
+char* fzfPickerFinish(FzfPicker* picker);
+// For a picker opened with --expect: returns the selection and points *key at
+// the key that accepted it ("" for Enter). *key lives in the returned block.
+char* fzfPickerFinishWithKey(FzfPicker* picker, char** key);
+
+// fzf's --listen HTTP endpoint, used to push actions into a running picker.
+// fzf gets the key as FZF_API_KEY and rejects requests without it.
+typedef struct {
+  int port;
+  char api_key[33];
+} FzfListen;
+
+// Whether the installed fzf is new enough for an authenticated --listen;
+// asks `fzf --version` once per process.
+int fzfSupportsListen(void);
+int fzfListenReserve(FzfListen* listen);
+FzfPicker* fzfPickerOpenListening(const char* prompt, const char* const* extra_args,
+                                  const FzfListen* listen);
+int fzfPostAction(const FzfListen* listen, const char* action);
+
 char* askChoices(const char* choices);
 char* askChoicesWithPrompt(const char* choices, const char* prompt);
 
@@ -0,0 +1,1543 @@
+#include "gitlib.h"
+#include "hashlib.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define GIT_INDEX_HEADER_SIZE 12
+#define GIT_INDEX_ENTRY_FIXED 62
+#define GIT_HASH_SIZE 20
+#define GIT_SMALL_FILE_MAX 65536
+
+#define GIT_FLAG_ASSUME_VALID 0x8000
+#define GIT_FLAG_EXTENDED 0x4000
+#define GIT_FLAG_STAGE_MASK 0x3000
+#define GIT_EXT_SKIP_WORKTREE 0x4000
+#define GIT_EXT_INTENT_TO_ADD 0x2000
+
+#define GIT_MODE_TYPE 0170000
+#define GIT_MODE_DIRECTORY 0040000
+#define GIT_MODE_GITLINK 0160000
+
+typedef struct {
+  uint32_t ctime_sec;
+  uint32_t ctime_nsec;
+  uint32_t mtime_sec;
+  uint32_t mtime_nsec;
+  uint32_t ino;
+  uint32_t mode;
+  uint32_t uid;
+  uint32_t gid;
+  uint32_t size;
+  uint16_t flags;
+  uint16_t extended_flags;
+  char name[PATH_MAX];
+  size_t name_len;
+} IndexEntry;
+
+typedef struct {
+  const unsigned char *data;
+  size_t size;
+  size_t offset;
+  uint32_t version;
+  uint32_t entry_count;
+} IndexReader;
+
+static uint32_t read_be32(const unsigned char *data) {
+  return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+         ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+}
+
+static uint16_t read_be16(const unsigned char *data) {
+  return (uint16_t)(((unsigned)data[0] << 8) | (unsigned)data[1]);
+}
+
+static int timespec_after(const struct timespec *a, const struct timespec *b) {
+  return a->tv_sec > b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
+}
+
+// Reads a small file under .git into a NUL-terminated buffer.
+static char *read_small_file(int dir_fd, const char *path) {
+  char *data;
+  ssize_t got;
+  int fd = openat(dir_fd, path, O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0) {
+    return NULL;
+  }
+
+  data = malloc(GIT_SMALL_FILE_MAX + 1);
+  if (!data) {
+    close(fd);
+    return NULL;
+  }
+
+  do {
+    got = read(fd, data, GIT_SMALL_FILE_MAX);
+  } while (got < 0 && errno == EINTR);
+  close(fd);
+
+  if (got < 0) {
+    free(data);
+    return NULL;
+  }
+  data[got] = '\0';
+  return data;
+}
+
+// Repos using SHA-256 object names have wider index entries; leave those to git.
+static int uses_default_hash(int git_fd) {
+  char *config = read_small_file(git_fd, "config");
+  char *cursor;
+  int ok = 1;
+
+  if (!config) {
+    return 1;
+  }
+  for (cursor = config; *cursor; ++cursor) {
+    *cursor = (char)tolower((unsigned char)*cursor);
+  }
+  ok = strstr(config, "objectformat") == NULL;
+  free(config);
+  return ok;
+}
+
+// `git commit` writes the index just before moving the branch, so HEAD being
+// newer than the index is only expected when the last HEAD reflog entry is a
+// commit.
+static int last_head_update_was_commit(int git_fd) {
+  char tail[4096];
+  char *line;
+  char *message;
+  ssize_t got;
+  off_t size;
+  int fd = openat(git_fd, "logs/HEAD", O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0) {
+    return 0;
+  }
+  size = lseek(fd, 0, SEEK_END);
+  got = size > 0 ? pread(fd, tail, sizeof(tail) - 1,
+                         size > (off_t)(sizeof(tail) - 1) ? size - (off_t)(sizeof(tail) - 1)
+                                                          : 0)
+                 : -1;
+  close(fd);
+  if (got <= 0) {
+    return 0;
+  }
+
+  tail[got] = '\0';
+  if (tail[got - 1] == '\n') {
+    tail[got - 1] = '\0';
+  }
+  line = strrchr(tail, '\n');
+  line = line ? line + 1 : tail;
+  message = strchr(line, '\t');
+  return message && strncmp(message + 1, "commit", 6) == 0;
+}
+
+// HEAD (or the branch it points at) moving after the index was written means
+// the index may no longer match HEAD, e.g. after `git reset --soft`.
+static int head_matches_index(int git_fd, const struct timespec *index_mtime) {
+  struct stat statbuf;
+  char *head = read_small_file(git_fd, "HEAD");
+  int moved = 0;
+  int ok = 0;
+
+  if (!head) {
+    return 0;
+  }
+
+  if (fstatat(git_fd, "HEAD", &statbuf, 0) != 0) {
+    goto cleanup;
+  }
+  moved = timespec_after(&statbuf.st_mtim, index_mtime);
+
+  if (strncmp(head, "ref: ", 5) == 0) {
+    char *ref = head + 5;
+    ref[strcspn(ref, "\r\n")] = '\0';
+    if (ref[0] == '\0' || ref[0] == '/' || strstr(ref, "..")) {
+      goto cleanup;
+    }
+    if (fstatat(git_fd, ref, &statbuf, 0) != 0 &&
+        fstatat(git_fd, "packed-refs", &statbuf, 0) != 0) {
+      goto cleanup;
+    }
+    moved = moved || timespec_after(&statbuf.st_mtim, index_mtime);
+  }
+  ok = !moved || last_head_update_was_commit(git_fd);
+
+cleanup:
+  free(head);
+  return ok;
+}
+
+// Index v4 prefix-compresses names with git's offset varint.
+static int read_varint(IndexReader *reader, size_t *value) {
+  size_t result;
+  unsigned char byte;
+
+  if (reader->offset >= reader->size) {
+    return 0;
+  }
+  byte = reader->data[reader->offset++];
+  result = byte & 127;
+  while (byte & 128) {
+    if (reader->offset >= reader->size || result > (SIZE_MAX >> 8)) {
+      return 0;
+    }
+    byte = reader->data[reader->offset++];
+    result = ((result + 1) << 7) | (byte & 127);
+  }
+  *value = result;
+  return 1;
+}
+
+static int read_entry(IndexReader *reader, IndexEntry *entry, size_t limit) {
+  const unsigned char *fixed;
+  size_t entry_start = reader->offset;
+  size_t header_len = GIT_INDEX_ENTRY_FIXED;
+  const unsigned char *name;
+  const unsigned char *name_end;
+
+  if (limit - reader->offset < GIT_INDEX_ENTRY_FIXED) {
+    return 0;
+  }
+
+  fixed = reader->data + reader->offset;
+  entry->ctime_sec = read_be32(fixed);
+  entry->ctime_nsec = read_be32(fixed + 4);
+  entry->mtime_sec = read_be32(fixed + 8);
+  entry->mtime_nsec = read_be32(fixed + 12);
+  entry->ino = read_be32(fixed + 20);
+  entry->mode = read_be32(fixed + 24);
+  entry->uid = read_be32(fixed + 28);
+  entry->gid = read_be32(fixed + 32);
+  entry->size = read_be32(fixed + 36);
+  entry->flags = read_be16(fixed + 40 + GIT_HASH_SIZE);
+  entry->extended_flags = 0;
+
+  if ((entry->flags & GIT_FLAG_EXTENDED) && reader->version >= 3) {
+    if (limit - reader->offset < GIT_INDEX_ENTRY_FIXED + 2) {
+      return 0;
+    }
+    entry->extended_flags = read_be16(fixed + GIT_INDEX_ENTRY_FIXED);
+    header_len += 2;
+  }
+  reader->offset += header_len;
+
+  if (reader->version == 4) {
+    size_t strip;
+    size_t suffix_len;
+
+    if (!read_varint(reader, &strip) || strip > entry->name_len) {
+      return 0;
+    }
+    name = reader->data + reader->offset;
+    name_end = memchr(name, '\0', limit - reader->offset);
+    if (!name_end) {
+      return 0;
+    }
+    suffix_len = (size_t)(name_end - name);
+    if (entry->name_len - strip + suffix_len >= sizeof(entry->name)) {
+      return 0;
+    }
+    memcpy(entry->name + entry->name_len - strip, name, suffix_len);
+    entry->name_len = entry->name_len - strip + suffix_len;
+    entry->name[entry->name_len] = '\0';
+    reader->offset += suffix_len + 1;
+    return 1;
+  }
+
+  name = reader->data + reader->offset;
+  name_end = memchr(name, '\0', limit - reader->offset);
+  if (!name_end || (size_t)(name_end - name) >= sizeof(entry->name)) {
+    return 0;
+  }
+  entry->name_len = (size_t)(name_end - name);
+  memcpy(entry->name, name, entry->name_len + 1);
+
+  // v2/v3 entries are NUL-padded to a multiple of eight bytes.
+  reader->offset = entry_start + ((header_len + entry->name_len + 8) & ~(size_t)7);
+  return reader->offset <= limit;
+}
+
+// Walks the extensions after the entries. Only the cache tree is used: a
+// valid root entry means nothing was staged since the tree was last written.
+// Lower-case signatures are extensions git itself requires readers to
+// understand (split index, sparse index), so those make the answer unknown.
+static int extensions_allow_answer(const IndexReader *reader, size_t entries_end,
+                                   size_t limit) {
+  size_t offset = entries_end;
+  int tree_valid = 0;
+
+  while (limit - offset >= 8) {
+    const unsigned char *signature = reader->data + offset;
+    uint32_t length = read_be32(signature + 4);
+
+    if (limit - offset - 8 < length) {
+      return 0;
+    }
+    if (signature[0] >= 'a' && signature[0] <= 'z') {
+      return 0;
+    }
+    if (memcmp(signature, "TREE", 4) == 0 && length > 1 && signature[8] == '\0') {
+      tree_valid = signature[9] != '-';
+    }
+    offset += 8 + length;
+  }
+
+  return tree_valid && offset == limit;
+}
+
+static GitTreeState check_entry(int repo_fd, const IndexEntry *entry,
+                                const struct timespec *index_mtime) {
+  struct stat statbuf;
+  uint32_t type = entry->mode & GIT_MODE_TYPE;
+
+  if (entry->flags & GIT_FLAG_STAGE_MASK) {
+    return GIT_TREE_DIRTY;
+  }
+  if (entry->extended_flags & GIT_EXT_INTENT_TO_ADD) {
+    return GIT_TREE_DIRTY;
+  }
+  if ((entry->flags & GIT_FLAG_ASSUME_VALID) ||
+      (entry->extended_flags & GIT_EXT_SKIP_WORKTREE) || type == GIT_MODE_GITLINK) {
+    return GIT_TREE_CLEAN;
+  }
+  if (type == GIT_MODE_DIRECTORY) {
+    return GIT_TREE_UNKNOWN;
+  }
+
+  if (fstatat(repo_fd, entry->name, &statbuf, AT_SYMLINK_NOFOLLOW) != 0) {
+    return errno == ENOENT || errno == ENOTDIR ? GIT_TREE_DIRTY : GIT_TREE_UNKNOWN;
+  }
+
+  // Git smudges a racily clean entry by zeroing its cached size, so a zero
+  // size against a non-empty file proves nothing either way.
+  if ((statbuf.st_mode & S_IFMT) == type && entry->size == 0 && statbuf.st_size != 0) {
+    return GIT_TREE_UNKNOWN;
+  }
+  if ((statbuf.st_mode & S_IFMT) != type ||
+      (uint32_t)statbuf.st_size != entry->size) {
+    return GIT_TREE_DIRTY;
+  }
+
+  // Exec bits only count when core.fileMode is on; let git decide.
+  if (S_ISREG(statbuf.st_mode) &&
+      ((entry->mode & 0100) != 0) != ((statbuf.st_mode & S_IXUSR) != 0)) {
+    return GIT_TREE_UNKNOWN;
+  }
+
+  // Racy: written in the same instant as the index, so matching stat data
+  // does not prove the content matches.
+  if ((int64_t)entry->mtime_sec > (int64_t)index_mtime->tv_sec ||
+      ((int64_t)entry->mtime_sec == (int64_t)index_mtime->tv_sec &&
+       (long)entry->mtime_nsec >= index_mtime->tv_nsec)) {
+    return GIT_TREE_UNKNOWN;
+  }
+
+  if ((uint32_t)statbuf.st_mtim.tv_sec != entry->mtime_sec ||
+      (uint32_t)statbuf.st_mtim.tv_nsec != entry->mtime_nsec ||
+      (uint32_t)statbuf.st_ctim.tv_sec != entry->ctime_sec ||
+      (uint32_t)statbuf.st_ctim.tv_nsec != entry->ctime_nsec ||
+      (uint32_t)statbuf.st_ino != entry->ino || (uint32_t)statbuf.st_uid != entry->uid ||
+      (uint32_t)statbuf.st_gid != entry->gid) {
+    // Touched but possibly unchanged; only hashing the content can tell.
+    return GIT_TREE_UNKNOWN;
+  }
+
+  return GIT_TREE_CLEAN;
+}
+
+GitTreeState git_tree_state(const char *repo_path) {
+  GitTreeState state = GIT_TREE_UNKNOWN;
+  IndexReader reader;
+  IndexEntry *entry = NULL;
+  struct stat index_stat;
+  void *mapping = MAP_FAILED;
+  size_t limit;
+  size_t entries_end;
+  uint32_t i;
+  int repo_fd = -1;
+  int git_fd = -1;
+  int index_fd = -1;
+  int unknown = 0;
+
+  repo_fd = open(repo_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (repo_fd < 0) {
+    goto cleanup;
+  }
+  // A .git file (linked worktree, submodule) is left to git.
+  git_fd = openat(repo_fd, ".git", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (git_fd < 0) {
+    goto cleanup;
+  }
+  index_fd = openat(git_fd, "index", O_RDONLY | O_CLOEXEC);
+  if (index_fd < 0 || fstat(index_fd, &index_stat) != 0 ||
+      index_stat.st_size < GIT_INDEX_HEADER_SIZE + GIT_HASH_SIZE) {
+    goto cleanup;
+  }
+  if (!uses_default_hash(git_fd) || !head_matches_index(git_fd, &index_stat.st_mtim)) {
+    goto cleanup;
+  }
+
+  mapping = mmap(NULL, (size_t)index_stat.st_size, PROT_READ, MAP_PRIVATE, index_fd, 0);
+  if (mapping == MAP_FAILED) {
+    goto cleanup;
+  }
+
+  reader.data = mapping;
+  reader.size = (size_t)index_stat.st_size;
+  reader.offset = GIT_INDEX_HEADER_SIZE;
+  reader.version = read_be32(reader.data + 4);
+  reader.entry_count = read_be32(reader.data + 8);
+  limit = reader.size - GIT_HASH_SIZE;
+  if (memcmp(reader.data, "DIRC", 4) != 0 || reader.version < 2 || reader.version > 4) {
+    goto cleanup;
+  }
+
+  entry = malloc(sizeof(*entry));
+  if (!entry) {
+    goto cleanup;
+  }
+
+  // First pass only finds where the entries end, so the extensions can rule
+  // the index out before any file is stat'ed.
+  entry->name_len = 0;
+  for (i = 0; i < reader.entry_count; ++i) {
+    if (!read_entry(&reader, entry, limit)) {
+      goto cleanup;
+    }
+  }
+  entries_end = reader.offset;
+  if (!extensions_allow_answer(&reader, entries_end, limit)) {
+    goto cleanup;
+  }
+
+  reader.offset = GIT_INDEX_HEADER_SIZE;
+  entry->name_len = 0;
+  for (i = 0; i < reader.entry_count; ++i) {
+    GitTreeState entry_state;
+
+    (void)read_entry(&reader, entry, limit);
+    entry_state = check_entry(repo_fd, entry, &index_stat.st_mtim);
+    if (entry_state == GIT_TREE_DIRTY) {
+      state = GIT_TREE_DIRTY;
+      goto cleanup;
+    }
+    // Keep looking: a definite change elsewhere still settles the answer.
+    if (entry_state == GIT_TREE_UNKNOWN) {
+      unknown = 1;
+    }
+  }
+  state = unknown ? GIT_TREE_UNKNOWN : GIT_TREE_CLEAN;
+
+cleanup:
+  free(entry);
+  if (mapping != MAP_FAILED) {
+    munmap(mapping, (size_t)index_stat.st_size);
+  }
+  if (index_fd >= 0) {
+    close(index_fd);
+  }
+  if (git_fd >= 0) {
+    close(git_fd);
+  }
+  if (repo_fd >= 0) {
+    close(repo_fd);
+  }
+  return state;
+}
+
+// --- HEAD, branch and upstream -------------------------------------------
+
+#define GIT_REF_DEPTH_MAX 5
+#define GIT_WALK_MAX 20000
+#define GIT_LOOSE_DEPTH_MAX 256
+#define GIT_PARENTS_MAX 16
+#define GIT_LOOSE_READ_MAX 8192
+#define GIT_GRAPH_NO_PARENT 0x70000000u
+#define GIT_GRAPH_EXTRA_PARENTS 0x80000000u
+#define GIT_GRAPH_LAST_EDGE 0x80000000u
+
+typedef struct {
+  char git_dir[PATH_MAX];
+  char common_dir[PATH_MAX];
+} GitDirs;
+
+typedef struct {
+  unsigned char bytes[GIT_HASH_SIZE];
+} GitOid;
+
+static int hex_value(char ch) {
+  if (ch >= '0' && ch <= '9') {
+    return ch - '0';
+  }
+  if (ch >= 'a' && ch <= 'f') {
+    return ch - 'a' + 10;
+  }
+  return -1;
+}
+
+static int parse_oid(const char *hex, GitOid *oid) {
+  size_t i;
+  for (i = 0; i < GIT_HASH_SIZE; ++i) {
+    int high = hex_value(hex[i * 2]);
+    int low = high < 0 ? -1 : hex_value(hex[i * 2 + 1]);
+    if (low < 0) {
+      return 0;
+    }
+    oid->bytes[i] = (unsigned char)((high << 4) | low);
+  }
+  return 1;
+}
+
+static void trim_line_end(char *text) {
+  text[strcspn(text, "\r\n")] = '\0';
+}
+
+static int make_path(char *out, const char *dir, const char *name) {
+  return snprintf(out, PATH_MAX, "%s/%s", dir, name) < PATH_MAX;
+}
+
+// Follows a .git file and a commondir file the way git does for linked
+// worktrees and submodules.
+static int resolve_git_dirs(const char *repo_path, GitDirs *dirs) {
+  struct stat statbuf;
+  char path[PATH_MAX];
+  char *text;
+
+  if (!make_path(dirs->git_dir, repo_path, ".git") || stat(dirs->git_dir, &statbuf) != 0) {
+    return 0;
+  }
+
+  if (!S_ISDIR(statbuf.st_mode)) {
+    text = read_small_file(AT_FDCWD, dirs->git_dir);
+    if (!text || strncmp(text, "gitdir: ", 8) != 0) {
+      free(text);
+      return 0;
+    }
+    trim_line_end(text);
+    if (text[8] == '/' ? snprintf(dirs->git_dir, PATH_MAX, "%s", text + 8) >= PATH_MAX
+                       : !make_path(dirs->git_dir, repo_path, text + 8)) {
+      free(text);
+      return 0;
+    }
+    free(text);
+  }
+
+  memcpy(dirs->common_dir, dirs->git_dir, sizeof(dirs->common_dir));
+  if (make_path(path, dirs->git_dir, "commondir") &&
+      (text = read_small_file(AT_FDCWD, path)) != NULL) {
+    trim_line_end(text);
+    if (text[0] == '/' ? snprintf(dirs->common_dir, PATH_MAX, "%s", text) >= PATH_MAX
+                       : !make_path(dirs->common_dir, dirs->git_dir, text)) {
+      free(text);
+      return 0;
+    }
+    free(text);
+  }
+  return 1;
+}
+
+static int lookup_packed_ref(const GitDirs *dirs, const char *ref, GitOid *oid) {
+  char path[PATH_MAX];
+  struct stat statbuf;
+  const char *data;
+  const char *cursor;
+  const char *end;
+  size_t ref_len = strlen(ref);
+  void *mapping;
+  int found = 0;
+  int fd;
+
+  if (!make_path(path, dirs->common_dir, "packed-refs")) {
+    return 0;
+  }
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return 0;
+  }
+  if (fstat(fd, &statbuf) != 0 || statbuf.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+  mapping = mmap(NULL, (size_t)statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return 0;
+  }
+
+  data = mapping;
+  end = data + statbuf.st_size;
+  for (cursor = data; cursor < end && !found;) {
+    const char *line_end = memchr(cursor, '\n', (size_t)(end - cursor));
+    size_t line_len;
+
+    if (!line_end) {
+      line_end = end;
+    }
+    line_len = (size_t)(line_end - cursor);
+
+    // "<oid> <refname>"; '#' headers and '^' peeled lines are skipped.
+    if (line_len == GIT_HASH_SIZE * 2 + 1 + ref_len &&
+        cursor[GIT_HASH_SIZE * 2] == ' ' &&
+        memcmp(cursor + GIT_HASH_SIZE * 2 + 1, ref, ref_len) == 0) {
+      found = parse_oid(cursor, oid);
+    }
+    cursor = line_end + 1;
+  }
+
+  munmap(mapping, (size_t)statbuf.st_size);
+  return found;
+}
+
+// Resolves a ref name (HEAD or refs/...) to an object id through loose refs,
+// symbolic refs and packed-refs.
+static int resolve_ref(const GitDirs *dirs, const char *ref, GitOid *oid, int depth) {
+  char path[PATH_MAX];
+  const char *base;
+  char *text;
+  int ok;
+
+  if (depth > GIT_REF_DEPTH_MAX || ref[0] == '/' || strstr(ref, "..")) {
+    return 0;
+  }
+
+  base = strncmp(ref, "refs/", 5) == 0 ? dirs->common_dir : dirs->git_dir;
+  if (!make_path(path, base, ref)) {
+    return 0;
+  }
+
+  text = read_small_file(AT_FDCWD, path);
+  if (!text) {
+    return lookup_packed_ref(dirs, ref, oid);
+  }
+  trim_line_end(text);
+  if (strncmp(text, "ref: ", 5) == 0) {
+    ok = resolve_ref(dirs, text + 5, oid, depth + 1);
+  } else {
+    ok = strlen(text) >= GIT_HASH_SIZE * 2 && parse_oid(text, oid);
+  }
+  free(text);
+  return ok;
+}
+
+// Reads branch.<name>.remote and branch.<name>.merge from the repo config
+// and turns them into the tracking ref, e.g. refs/remotes/origin/main.
+static int find_upstream_ref(const GitDirs *dirs, const char *branch, char *upstream,
+                             size_t upstream_size, char remote[256]) {
+  char path[PATH_MAX];
+  char merge[PATH_MAX] = "";
+  char *config;
+  char *line;
+  char *save = NULL;
+  int in_section = 0;
+
+  remote[0] = '\0';
+  if (!make_path(path, dirs->common_dir, "config") ||
+      (config = read_small_file(AT_FDCWD, path)) == NULL) {
+    return 0;
+  }
+
+  for (line = strtok_r(config, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+    char *key;
+    char *value;
+
+    while (*line == ' ' || *line == '\t') {
+      line++;
+    }
+    if (*line == '[') {
+      size_t branch_len = strlen(branch);
+      in_section = strncmp(line, "[branch \"", 9) == 0 &&
+                   strncmp(line + 9, branch, branch_len) == 0 &&
+                   strncmp(line + 9 + branch_len, "\"]", 2) == 0;
+      continue;
+    }
+    if (!in_section || !(value = strchr(line, '='))) {
+      continue;
+    }
+
+    *value++ = '\0';
+    key = line;
+    key[strcspn(key, " \t")] = '\0';
+    while (*value == ' ' || *value == '\t') {
+      value++;
+    }
+    value[strcspn(value, " \t\r;#")] = '\0';
+
+    if (strcasecmp(key, "remote") == 0) {
+      snprintf(remote, 256, "%s", value);
+    } else if (strcasecmp(key, "merge") == 0) {
+      snprintf(merge, sizeof(merge), "%s", value);
+    }
+  }
+  free(config);
+
+  if (remote[0] == '\0' || strncmp(merge, "refs/heads/", 11) != 0) {
+    remote[0] = '\0';
+    return 0;
+  }
+  // A remote of "." tracks another local branch.
+  if (strcmp(remote, ".") == 0) {
+    return snprintf(upstream, upstream_size, "%s", merge) < (int)upstream_size;
+  }
+  return snprintf(upstream, upstream_size, "refs/remotes/%s/%s", remote, merge + 11) <
+         (int)upstream_size;
+}
+
+// --- Commit history --------------------------------------------------------
+
+typedef struct {
+  const unsigned char *data;
+  size_t size;
+  const unsigned char *fanout;
+  const unsigned char *oids;
+  const unsigned char *commits;
+  const unsigned char *edges;
+  size_t edges_len;
+  uint32_t count;
+} CommitGraph;
+
+// generation is git's topological level: one more than the highest parent,
+// so every commit is processed after all of its descendants.
+typedef struct {
+  GitOid oid;
+  uint32_t generation;
+  unsigned char flags;
+  unsigned char used;
+} WalkNode;
+
+typedef struct {
+  const GitDirs *dirs;
+  CommitGraph graph;
+  int have_graph;
+  WalkNode *nodes;
+  size_t node_cap;
+  size_t node_count;
+  size_t *heap;
+  size_t heap_len;
+  size_t heap_cap;
+  size_t open_count;
+} CommitWalk;
+
+#define WALK_LOCAL 1
+#define WALK_UPSTREAM 2
+#define WALK_BOTH (WALK_LOCAL | WALK_UPSTREAM)
+#define WALK_QUEUED 4
+#define WALK_DONE 8
+
+static uint64_t read_be64(const unsigned char *data) {
+  return ((uint64_t)read_be32(data) << 32) | read_be32(data + 4);
+}
+
+static int commit_graph_open(const GitDirs *dirs, CommitGraph *graph) {
+  char path[PATH_MAX];
+  struct stat statbuf;
+  unsigned chunk_count;
+  unsigned i;
+  void *mapping;
+  int fd;
+
+  memset(graph, 0, sizeof(*graph));
+  if (!make_path(path, dirs->common_dir, "objects/info/commit-graph")) {
+    return 0;
+  }
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return 0;
+  }
+  if (fstat(fd, &statbuf) != 0 || statbuf.st_size < 8 + 12) {
+    close(fd);
+    return 0;
+  }
+  mapping = mmap(NULL, (size_t)statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return 0;
+  }
+
+  graph->data = mapping;
+  graph->size = (size_t)statbuf.st_size;
+  chunk_count = graph->data[6];
+
+  // Version 1, SHA-1, and no base graphs (split chains are left alone).
+  if (memcmp(graph->data, "CGPH", 4) != 0 || graph->data[4] != 1 ||
+      graph->data[5] != 1 || graph->data[7] != 0 ||
+      graph->size < 8 + (size_t)(chunk_count + 1) * 12) {
+    goto invalid;
+  }
+
+  for (i = 0; i < chunk_count; ++i) {
+    const unsigned char *chunk = graph->data + 8 + i * 12;
+    uint64_t offset = read_be64(chunk + 4);
+    uint64_t next = read_be64(chunk + 16);
+    if (offset > next || next > graph->size) {
+      goto invalid;
+    }
+    if (memcmp(chunk, "OIDF", 4) == 0 && next - offset == 256 * 4) {
+      graph->fanout = graph->data + offset;
+    } else if (memcmp(chunk, "OIDL", 4) == 0) {
+      graph->oids = graph->data + offset;
+    } else if (memcmp(chunk, "CDAT", 4) == 0) {
+      graph->commits = graph->data + offset;
+    } else if (memcmp(chunk, "EDGE", 4) == 0) {
+      graph->edges = graph->data + offset;
+      graph->edges_len = (size_t)(next - offset) / 4;
+    }
+  }
+
+  if (!graph->fanout || !graph->oids || !graph->commits) {
+    goto invalid;
+  }
+  graph->count = read_be32(graph->fanout + 255 * 4);
+  if ((size_t)(graph->oids - graph->data) + (size_t)graph->count * GIT_HASH_SIZE >
+          graph->size ||
+      (size_t)(graph->commits - graph->data) + (size_t)graph->count * (GIT_HASH_SIZE + 16) >
+          graph->size) {
+    goto invalid;
+  }
+  return 1;
+
+invalid:
+  munmap((void *)graph->data, graph->size);
+  memset(graph, 0, sizeof(*graph));
+  return 0;
+}
+
+static void commit_graph_close(CommitGraph *graph) {
+  if (graph->data) {
+    munmap((void *)graph->data, graph->size);
+  }
+}
+
+static int commit_graph_find(const CommitGraph *graph, const GitOid *oid,
+                             uint32_t *position) {
+  uint32_t low = oid->bytes[0] == 0 ? 0 : read_be32(graph->fanout + (oid->bytes[0] - 1) * 4);
+  uint32_t high = read_be32(graph->fanout + oid->bytes[0] * 4);
+
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    int cmp = memcmp(graph->oids + (size_t)middle * GIT_HASH_SIZE, oid->bytes,
+                     GIT_HASH_SIZE);
+    if (cmp == 0) {
+      *position = middle;
+      return 1;
+    }
+    if (cmp < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return 0;
+}
+
+static WalkNode *walk_node(CommitWalk *walk, const GitOid *oid, size_t *index_out);
+
+static int walk_push(CommitWalk *walk, size_t index) {
+  size_t child;
+
+  if (walk->heap_len == walk->heap_cap) {
+    size_t new_cap = walk->heap_cap == 0 ? 64 : walk->heap_cap * 2;
+    size_t *new_heap = realloc(walk->heap, new_cap * sizeof(*new_heap));
+    if (!new_heap) {
+      return 0;
+    }
+    walk->heap = new_heap;
+    walk->heap_cap = new_cap;
+  }
+
+  // Max-heap on generation, so a commit is only counted once everything
+  // above it has passed its flags down.
+  child = walk->heap_len++;
+  while (child > 0) {
+    size_t parent = (child - 1) / 2;
+    if (walk->nodes[walk->heap[parent]].generation >= walk->nodes[index].generation) {
+      break;
+    }
+    walk->heap[child] = walk->heap[parent];
+    child = parent;
+  }
+  walk->heap[child] = index;
+  return 1;
+}
+
+static size_t walk_pop(CommitWalk *walk) {
+  size_t top = walk->heap[0];
+  size_t last = walk->heap[--walk->heap_len];
+  size_t parent = 0;
+
+  while (1) {
+    size_t child = parent * 2 + 1;
+    if (child >= walk->heap_len) {
+      break;
+    }
+    if (child + 1 < walk->heap_len &&
+        walk->nodes[walk->heap[child + 1]].generation >
+            walk->nodes[walk->heap[child]].generation) {
+      child++;
+    }
+    if (walk->nodes[last].generation >= walk->nodes[walk->heap[child]].generation) {
+      break;
+    }
+    walk->heap[parent] = walk->heap[child];
+    parent = child;
+  }
+  if (walk->heap_len > 0) {
+    walk->heap[parent] = last;
+  }
+  return top;
+}
+
+static uint64_t oid_hash(const GitOid *oid) {
+  uint64_t hash;
+  memcpy(&hash, oid->bytes, sizeof(hash));
+  return hash;
+}
+
+static int walk_grow(CommitWalk *walk) {
+  WalkNode *old_nodes = walk->nodes;
+  size_t old_cap = walk->node_cap;
+  size_t new_cap = old_cap == 0 ? 256 : old_cap * 2;
+  size_t i;
+
+  walk->nodes = calloc(new_cap, sizeof(*walk->nodes));
+  if (!walk->nodes) {
+    walk->nodes = old_nodes;
+    return 0;
+  }
+  walk->node_cap = new_cap;
+  walk->node_count = 0;
+
+  // Heap entries hold node slots, so the heap is rebuilt along with them.
+  walk->heap_len = 0;
+  for (i = 0; i < old_cap; ++i) {
+    if (old_nodes[i].used) {
+      size_t index;
+      WalkNode *node = walk_node(walk, &old_nodes[i].oid, &index);
+      *node = old_nodes[i];
+      if ((node->flags & WALK_QUEUED) && !(node->flags & WALK_DONE) &&
+          !walk_push(walk, index)) {
+        free(old_nodes);
+        return 0;
+      }
+    }
+  }
+  free(old_nodes);
+  return 1;
+}
+
+// Finds or adds the node for oid in the open-addressing table.
+static WalkNode *walk_node(CommitWalk *walk, const GitOid *oid, size_t *index_out) {
+  size_t slot;
+
+  if ((walk->node_count + 1) * 2 > walk->node_cap && !walk_grow(walk)) {
+    return NULL;
+  }
+
+  slot = (size_t)oid_hash(oid) & (walk->node_cap - 1);
+  while (walk->nodes[slot].used &&
+         memcmp(walk->nodes[slot].oid.bytes, oid->bytes, GIT_HASH_SIZE) != 0) {
+    slot = (slot + 1) & (walk->node_cap - 1);
+  }
+  if (!walk->nodes[slot].used) {
+    walk->nodes[slot].used = 1;
+    walk->nodes[slot].oid = *oid;
+    walk->nodes[slot].generation = 0;
+    walk->node_count++;
+  }
+  *index_out = slot;
+  return &walk->nodes[slot];
+}
+
+// Reads the parents (and, when date is given, the committer date) of a
+// loose commit object.
+static int read_loose_commit(const GitDirs *dirs, const GitOid *oid, GitOid *parents,
+                             size_t max_parents, size_t *parent_count, int64_t *date) {
+  static const char hex[] = "0123456789abcdef";
+  unsigned char compressed[GIT_LOOSE_READ_MAX];
+  char text[GIT_LOOSE_READ_MAX];
+  char object[GIT_HASH_SIZE * 2 + 2];
+  char path[PATH_MAX];
+  z_stream stream;
+  char *line;
+  char *save = NULL;
+  ssize_t got;
+  size_t i;
+  int fd;
+  int status;
+
+  for (i = 0; i < GIT_HASH_SIZE; ++i) {
+    size_t at = i == 0 ? 0 : i * 2 + 1;
+    object[at] = hex[oid->bytes[i] >> 4];
+    object[at + 1] = hex[oid->bytes[i] & 15];
+    if (i == 0) {
+      object[2] = '/';
+    }
+  }
+  object[sizeof(object) - 1] = '\0';
+
+  if (snprintf(path, sizeof(path), "%s/objects/%s", dirs->common_dir, object) >=
+      (int)sizeof(path)) {
+    return 0;
+  }
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return 0;
+  }
+  do {
+    got = read(fd, compressed, sizeof(compressed));
+  } while (got < 0 && errno == EINTR);
+  close(fd);
+  if (got <= 0) {
+    return 0;
+  }
+
+  // Only the header lines are needed, so a partial inflate is enough.
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit(&stream) != Z_OK) {
+    return 0;
+  }
+  stream.next_in = compressed;
+  stream.avail_in = (uInt)got;
+  stream.next_out = (unsigned char *)text;
+  stream.avail_out = sizeof(text) - 1;
+  status = inflate(&stream, Z_SYNC_FLUSH);
+  inflateEnd(&stream);
+  if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+    return 0;
+  }
+  text[sizeof(text) - 1 - stream.avail_out] = '\0';
+
+  if (strncmp(text, "commit ", 7) != 0) {
+    return 0;
+  }
+
+  *parent_count = 0;
+  line = text + strlen(text) + 1;
+  if ((size_t)(line - text) >= sizeof(text) - 1 - stream.avail_out) {
+    return 0;
+  }
+  for (line = strtok_r(line, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+    if (strncmp(line, "parent ", 7) == 0) {
+      if (*parent_count == max_parents || !parse_oid(line + 7, &parents[*parent_count])) {
+        return 0;
+      }
+      (*parent_count)++;
+    } else if (date && strncmp(line, "committer ", 10) == 0) {
+      char *email_end = strrchr(line, '>');
+      *date = email_end ? strtoll(email_end + 1, NULL, 10) : 0;
+      return 1;
+    } else if (!date && strncmp(line, "tree ", 5) != 0) {
+      // Parents always come right after the tree line.
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Looks a commit up in the commit-graph, then among the loose objects.
+// Packed commits missing from the graph make the walk give up. *generation
+// is 0 for loose commits; the caller derives it from the parents.
+static int load_commit(CommitWalk *walk, const GitOid *oid, GitOid *parents,
+                       size_t max_parents, size_t *parent_count, uint32_t *generation) {
+  uint32_t position;
+
+  if (walk->have_graph && commit_graph_find(&walk->graph, oid, &position)) {
+    const unsigned char *commit =
+        walk->graph.commits + (size_t)position * (GIT_HASH_SIZE + 16);
+    uint32_t links[2];
+    size_t i;
+
+    links[0] = read_be32(commit + GIT_HASH_SIZE);
+    links[1] = read_be32(commit + GIT_HASH_SIZE + 4);
+    *generation = read_be32(commit + GIT_HASH_SIZE + 8) >> 2;
+    *parent_count = 0;
+    // Graphs written without generation numbers cannot order the walk.
+    if (*generation == 0) {
+      return 0;
+    }
+
+    for (i = 0; i < 2; ++i) {
+      uint32_t link = links[i];
+      if (link == GIT_GRAPH_NO_PARENT) {
+        break;
+      }
+      if (i == 1 && (link & GIT_GRAPH_EXTRA_PARENTS)) {
+        size_t edge = link & ~GIT_GRAPH_EXTRA_PARENTS;
+        while (1) {
+          uint32_t value;
+          if (!walk->graph.edges || edge >= walk->graph.edges_len ||
+              *parent_count == max_parents) {
+            return 0;
+          }
+          value = read_be32(walk->graph.edges + edge * 4);
+          if ((value & ~GIT_GRAPH_LAST_EDGE) >= walk->graph.count) {
+            return 0;
+          }
+          memcpy(parents[(*parent_count)++].bytes,
+                 walk->graph.oids + (size_t)(value & ~GIT_GRAPH_LAST_EDGE) * GIT_HASH_SIZE,
+                 GIT_HASH_SIZE);
+          if (value & GIT_GRAPH_LAST_EDGE) {
+            break;
+          }
+          edge++;
+        }
+        break;
+      }
+      if (link >= walk->graph.count || *parent_count == max_parents) {
+        return 0;
+      }
+      memcpy(parents[(*parent_count)++].bytes,
+             walk->graph.oids + (size_t)link * GIT_HASH_SIZE, GIT_HASH_SIZE);
+    }
+    return 1;
+  }
+
+  *generation = 0;
+  return read_loose_commit(walk->dirs, oid, parents, max_parents, parent_count, NULL);
+}
+
+// Committer date of a commit, from the commit-graph or a loose object.
+static int commit_date(const GitDirs *dirs, const GitOid *oid, int64_t *date) {
+  GitOid parents[GIT_PARENTS_MAX];
+  CommitGraph graph;
+  size_t parent_count;
+  uint32_t position;
+  int found = 0;
+
+  if (commit_graph_open(dirs, &graph)) {
+    if (commit_graph_find(&graph, oid, &position)) {
+      const unsigned char *commit = graph.commits + (size_t)position * (GIT_HASH_SIZE + 16);
+      *date = (int64_t)(((uint64_t)(read_be32(commit + GIT_HASH_SIZE + 8) & 3) << 32) |
+                        read_be32(commit + GIT_HASH_SIZE + 12));
+      found = 1;
+    }
+    commit_graph_close(&graph);
+    if (found) {
+      return 1;
+    }
+  }
+  return read_loose_commit(dirs, oid, parents, GIT_PARENTS_MAX, &parent_count, date);
+}
+
+// Fills in a commit's generation, recursing through loose parents until it
+// reaches commits the graph already numbers (or root commits).
+static int commit_generation(CommitWalk *walk, const GitOid *oid, uint32_t *generation,
+                             int depth) {
+  GitOid parents[GIT_PARENTS_MAX];
+  size_t parent_count;
+  size_t index;
+  size_t i;
+  WalkNode *node = walk_node(walk, oid, &index);
+
+  if (!node) {
+    return 0;
+  }
+  if (node->generation != 0) {
+    *generation = node->generation;
+    return 1;
+  }
+  if (depth > GIT_LOOSE_DEPTH_MAX ||
+      !load_commit(walk, oid, parents, GIT_PARENTS_MAX, &parent_count, generation)) {
+    return 0;
+  }
+
+  if (*generation == 0) {
+    *generation = 1;
+    for (i = 0; i < parent_count; ++i) {
+      uint32_t parent_generation;
+      if (!commit_generation(walk, &parents[i], &parent_generation, depth + 1)) {
+        return 0;
+      }
+      if (parent_generation + 1 > *generation) {
+        *generation = parent_generation + 1;
+      }
+    }
+  }
+
+  // The table may have grown during the recursion.
+  node = walk_node(walk, oid, &index);
+  if (!node) {
+    return 0;
+  }
+  node->generation = *generation;
+  return 1;
+}
+
+// Adds flags to a commit, queueing it the first time it is reached.
+// open_count tracks queued commits not yet known to be shared by both sides.
+static int walk_add(CommitWalk *walk, const GitOid *oid, unsigned char flags) {
+  uint32_t generation;
+  size_t index;
+  WalkNode *node;
+
+  if (!commit_generation(walk, oid, &generation, 0)) {
+    return 0;
+  }
+  node = walk_node(walk, oid, &index);
+  if (!node) {
+    return 0;
+  }
+
+  if (!(node->flags & WALK_QUEUED)) {
+    node->flags |= WALK_QUEUED | flags;
+    if (flags != WALK_BOTH) {
+      walk->open_count++;
+    }
+    return walk_push(walk, index);
+  }
+
+  if (!(node->flags & WALK_DONE) && (node->flags & WALK_BOTH) != WALK_BOTH &&
+      ((node->flags | flags) & WALK_BOTH) == WALK_BOTH) {
+    walk->open_count--;
+  }
+  node->flags |= flags;
+  return 1;
+}
+
+// Counts commits only reachable from local (ahead) and only from upstream
+// (behind), walking down by generation until every open line of history is
+// shared by both sides.
+static int count_ahead_behind(const GitDirs *dirs, const GitOid *local,
+                              const GitOid *upstream, int *ahead, int *behind) {
+  CommitWalk walk;
+  GitOid parents[GIT_PARENTS_MAX];
+  size_t popped = 0;
+  int ok = 0;
+
+  memset(&walk, 0, sizeof(walk));
+  walk.dirs = dirs;
+  walk.have_graph = commit_graph_open(dirs, &walk.graph);
+  *ahead = 0;
+  *behind = 0;
+
+  if (!walk_add(&walk, local, WALK_LOCAL) || !walk_add(&walk, upstream, WALK_UPSTREAM)) {
+    goto cleanup;
+  }
+
+  while (walk.heap_len > 0 && walk.open_count > 0) {
+    size_t index = walk_pop(&walk);
+    unsigned char flags;
+    size_t parent_count;
+    uint32_t generation;
+    GitOid oid = walk.nodes[index].oid;
+    size_t i;
+
+    if (++popped > GIT_WALK_MAX ||
+        !load_commit(&walk, &oid, parents, GIT_PARENTS_MAX, &parent_count, &generation)) {
+      goto cleanup;
+    }
+
+    walk.nodes[index].flags |= WALK_DONE;
+    flags = walk.nodes[index].flags & WALK_BOTH;
+    if (flags != WALK_BOTH) {
+      walk.open_count--;
+    }
+    if (flags == WALK_LOCAL) {
+      (*ahead)++;
+    } else if (flags == WALK_UPSTREAM) {
+      (*behind)++;
+    }
+
+    for (i = 0; i < parent_count; ++i) {
+      if (!walk_add(&walk, &parents[i], flags)) {
+        goto cleanup;
+      }
+    }
+  }
+  ok = 1;
+
+cleanup:
+  commit_graph_close(&walk.graph);
+  free(walk.nodes);
+  free(walk.heap);
+  return ok;
+}
+
+// --- Per-repo cache ---------------------------------------------------------
+
+// Files whose mtimes decide whether a cached GitHeadInfo is still current.
+enum {
+  STAMP_DOT_GIT,
+  STAMP_HEAD,
+  STAMP_CONFIG,
+  STAMP_PACKED_REFS,
+  STAMP_BRANCH,
+  STAMP_UPSTREAM,
+  STAMP_COMMIT_GRAPH,
+  STAMP_COUNT
+};
+
+typedef struct {
+  struct timespec mtime;
+  off_t size;
+  int exists;
+} FileStamp;
+
+typedef struct {
+  char *repo_path;
+  char *stamp_paths[STAMP_COUNT];
+  FileStamp stamps[STAMP_COUNT];
+  GitHeadInfo info;
+  int is_repo;
+} CachedHead;
+
+// The lock covers the table and the stamp checks; a stale entry is re-read
+// outside it, so decoration workers only queue behind a few stat calls.
+struct GitRefCache {
+  pthread_mutex_t lock;
+  CachedHead *entries;
+  size_t capacity;
+  size_t count;
+};
+
+static void take_stamp(const char *path, FileStamp *stamp) {
+  struct stat statbuf;
+
+  memset(stamp, 0, sizeof(*stamp));
+  if (path && stat(path, &statbuf) == 0) {
+    stamp->mtime = statbuf.st_mtim;
+    stamp->size = statbuf.st_size;
+    stamp->exists = 1;
+  }
+}
+
+static int stamps_current(const CachedHead *cached) {
+  size_t i;
+
+  for (i = 0; i < STAMP_COUNT; ++i) {
+    FileStamp now;
+    take_stamp(cached->stamp_paths[i], &now);
+    if (now.exists != cached->stamps[i].exists || now.size != cached->stamps[i].size ||
+        now.mtime.tv_sec != cached->stamps[i].mtime.tv_sec ||
+        now.mtime.tv_nsec != cached->stamps[i].mtime.tv_nsec) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void clear_stamp_paths(CachedHead *cached) {
+  size_t i;
+  for (i = 0; i < STAMP_COUNT; ++i) {
+    free(cached->stamp_paths[i]);
+    cached->stamp_paths[i] = NULL;
+  }
+}
+
+static void set_stamp_path(CachedHead *cached, size_t which, const char *dir,
+                           const char *name) {
+  char path[PATH_MAX];
+  if (make_path(path, dir, name)) {
+    cached->stamp_paths[which] = strdup(path);
+  }
+}
+
+// Stamps are taken before the files are read, so a change racing with the
+// read leaves a stale stamp and is picked up on the next lookup.
+static int read_head_info(const char *repo_path, CachedHead *cached) {
+  GitHeadInfo *info = &cached->info;
+  GitDirs dirs;
+  GitOid head_oid;
+  GitOid upstream_oid;
+  char upstream_ref[PATH_MAX];
+  char *head;
+  size_t i;
+
+  clear_stamp_paths(cached);
+  memset(info, 0, sizeof(*info));
+  info->ahead = -1;
+  info->behind = -1;
+
+  set_stamp_path(cached, STAMP_DOT_GIT, repo_path, ".git");
+  if (!resolve_git_dirs(repo_path, &dirs)) {
+    take_stamp(cached->stamp_paths[STAMP_DOT_GIT], &cached->stamps[STAMP_DOT_GIT]);
+    return 0;
+  }
+
+  set_stamp_path(cached, STAMP_HEAD, dirs.git_dir, "HEAD");
+  set_stamp_path(cached, STAMP_CONFIG, dirs.common_dir, "config");
+  set_stamp_path(cached, STAMP_PACKED_REFS, dirs.common_dir, "packed-refs");
+  set_stamp_path(cached, STAMP_COMMIT_GRAPH, dirs.common_dir, "objects/info/commit-graph");
+
+  head = cached->stamp_paths[STAMP_HEAD]
+             ? read_small_file(AT_FDCWD, cached->stamp_paths[STAMP_HEAD])
+             : NULL;
+  if (head) {
+    trim_line_end(head);
+    if (strncmp(head, "ref: refs/heads/", 16) == 0) {
+      snprintf(info->head, sizeof(info->head), "%s", head + 16);
+      set_stamp_path(cached, STAMP_BRANCH, dirs.common_dir, head + 5);
+    }
+  }
+
+  if (head && info->head[0] != '\0' &&
+      find_upstream_ref(&dirs, info->head, upstream_ref, sizeof(upstream_ref),
+                        info->remote)) {
+    set_stamp_path(cached, STAMP_UPSTREAM, dirs.common_dir, upstream_ref);
+  }
+
+  for (i = 0; i < STAMP_COUNT; ++i) {
+    take_stamp(cached->stamp_paths[i], &cached->stamps[i]);
+  }
+
+  if (!head) {
+    return 0;
+  }
+
+  if (info->head[0] == '\0') {
+    // Detached: show the abbreviated commit instead of a branch.
+    if (!parse_oid(head, &head_oid)) {
+      free(head);
+      return 0;
+    }
+    info->detached = 1;
+    snprintf(info->head, sizeof(info->head), "%.7s", head);
+    free(head);
+    (void)commit_date(&dirs, &head_oid, &info->commit_time);
+    return 1;
+  }
+  free(head);
+
+  // An unborn branch has no commit to date or compare yet.
+  if (!resolve_ref(&dirs, "HEAD", &head_oid, 0)) {
+    return 1;
+  }
+  (void)commit_date(&dirs, &head_oid, &info->commit_time);
+
+  if (!cached->stamp_paths[STAMP_UPSTREAM] ||
+      !resolve_ref(&dirs, upstream_ref, &upstream_oid, 0)) {
+    return 1;
+  }
+  info->has_upstream = 1;
+
+  if (memcmp(head_oid.bytes, upstream_oid.bytes, GIT_HASH_SIZE) == 0) {
+    info->ahead = 0;
+    info->behind = 0;
+  } else if (!count_ahead_behind(&dirs, &head_oid, &upstream_oid, &info->ahead,
+                                 &info->behind)) {
+    info->ahead = -1;
+    info->behind = -1;
+  }
+  return 1;
+}
+
+GitRefCache *git_ref_cache_new(void) {
+  GitRefCache *cache = calloc(1, sizeof(GitRefCache));
+
+  if (cache) {
+    pthread_mutex_init(&cache->lock, NULL);
+  }
+  return cache;
+}
+
+static CachedHead *cache_slot(GitRefCache *cache, const char *repo_path) {
+  size_t slot;
+
+  if ((cache->count + 1) * 2 > cache->capacity) {
+    size_t new_capacity = cache->capacity == 0 ? 64 : cache->capacity * 2;
+    CachedHead *new_entries = calloc(new_capacity, sizeof(*new_entries));
+    size_t i;
+
+    if (!new_entries) {
+      return NULL;
+    }
+    for (i = 0; i < cache->capacity; ++i) {
+      if (cache->entries[i].repo_path) {
+        slot = (size_t)fnv1a(cache->entries[i].repo_path) & (new_capacity - 1);
+        while (new_entries[slot].repo_path) {
+          slot = (slot + 1) & (new_capacity - 1);
+        }
+        new_entries[slot] = cache->entries[i];
+      }
+    }
+    free(cache->entries);
+    cache->entries = new_entries;
+    cache->capacity = new_capacity;
+  }
+
+  slot = (size_t)fnv1a(repo_path) & (cache->capacity - 1);
+  while (cache->entries[slot].repo_path &&
+         strcmp(cache->entries[slot].repo_path, repo_path) != 0) {
+    slot = (slot + 1) & (cache->capacity - 1);
+  }
+  return &cache->entries[slot];
+}
+
+int git_head_info(GitRefCache *cache, const char *repo_path, GitHeadInfo *info) {
+  CachedHead uncached;
+  CachedHead *cached;
+
+  if (!cache) {
+    memset(&uncached, 0, sizeof(uncached));
+    uncached.is_repo = read_head_info(repo_path, &uncached);
+    *info = uncached.info;
+    clear_stamp_paths(&uncached);
+    return uncached.is_repo;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  cached = cache_slot(cache, repo_path);
+  if (cached && cached->repo_path && stamps_current(cached)) {
+    int is_repo = cached->is_repo;
+    *info = cached->info;
+    pthread_mutex_unlock(&cache->lock);
+    return is_repo;
+  }
+  pthread_mutex_unlock(&cache->lock);
+
+  memset(&uncached, 0, sizeof(uncached));
+  uncached.is_repo = read_head_info(repo_path, &uncached);
+  *info = uncached.info;
+
+  // The table may have grown meanwhile, so the slot is looked up again.
+  pthread_mutex_lock(&cache->lock);
+  cached = cache_slot(cache, repo_path);
+  if (cached && !cached->repo_path) {
+    cached->repo_path = strdup(repo_path);
+    if (cached->repo_path) {
+      cache->count++;
+    }
+  }
+  if (cached && cached->repo_path) {
+    uncached.repo_path = cached->repo_path;
+    clear_stamp_paths(cached);
+    *cached = uncached;
+  } else {
+    clear_stamp_paths(&uncached);
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return uncached.is_repo;
+}
+
+void git_ref_cache_free(GitRefCache *cache) {
+  size_t i;
+
+  if (!cache) {
+    return;
+  }
+  for (i = 0; i < cache->capacity; ++i) {
+    if (cache->entries[i].repo_path) {
+      free(cache->entries[i].repo_path);
+      clear_stamp_paths(&cache->entries[i]);
+    }
+  }
+  free(cache->entries);
+  pthread_mutex_destroy(&cache->lock);
+  free(cache);
+}
@@ -0,0 +1,42 @@
+#ifndef git_lib_included
+#define git_lib_included
+
+#include <stdint.h>
+
+typedef enum {
+  GIT_TREE_UNKNOWN = -1,
+  GIT_TREE_CLEAN = 0,
+  GIT_TREE_DIRTY = 1,
+} GitTreeState;
+
+// Answers "does the work tree differ from the index or HEAD" for tracked
+// files by reading .git/index and comparing its cached stat data with lstat.
+// Returns GIT_TREE_UNKNOWN whenever only git itself can tell (racy entries,
+// touched-but-maybe-unchanged files, staged changes, unsupported index
+// features); callers then fall back to `git status`.
+GitTreeState git_tree_state(const char *repo_path);
+
+// What the picker shows next to a repo: its branch (or abbreviated commit
+// when detached), how far it is from the branch's upstream and when HEAD
+// was committed.
+typedef struct {
+  char head[256];
+  int detached;
+  int has_upstream;
+  int ahead;  // -1 when the histories could not be compared
+  int behind;
+  int64_t commit_time;  // 0 when unknown
+  char remote[256];     // the branch's upstream remote, "" when none
+} GitHeadInfo;
+
+// Remembers GitHeadInfo per repo until HEAD, the refs, the config or the
+// commit-graph change on disk. One cache can be shared between threads.
+typedef struct GitRefCache GitRefCache;
+
+GitRefCache *git_ref_cache_new(void);
+void git_ref_cache_free(GitRefCache *cache);
+// Resolves HEAD and its upstream without running git; cache may be NULL.
+// Returns 0 when repo_path is not a git repo.
+int git_head_info(GitRefCache *cache, const char *repo_path, GitHeadInfo *info);
+
+#endif // git_lib_included
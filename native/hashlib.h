@@ -0,0 +1,32 @@
+#ifndef hash_lib_included
+#define hash_lib_included
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 64-bit FNV-1a, shared by the in-memory tables and the config fingerprint.
+// Inline since the table probes call it for every lookup.
+#define FNV1A_OFFSET_BASIS 1469598103934665603ULL
+
+static inline uint64_t fnv1a_bytes(uint64_t hash, const void *data, size_t len) {
+  const unsigned char *bytes = data;
+  size_t i;
+
+  for (i = 0; i < len; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static inline uint64_t fnv1a(const char *text) {
+  uint64_t hash = FNV1A_OFFSET_BASIS;
+
+  while (*text) {
+    hash ^= (unsigned char)*text++;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+#endif // hash_lib_included
@@ -0,0 +1,546 @@
+#include "hashlib.h"
+#include "historylib.h"
+#include "pathlib.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HISTORY_LOG_FILE "history.log"
+#define HISTORY_SUMMARY_FILE "history.sum"
+#define HISTORY_RECORD_MAGIC 0x3148504fu /* "OPH1" */
+#define HISTORY_SUMMARY_MAGIC "OPHSUM\0"
+#define HISTORY_SUMMARY_VERSION 1u
+#define HISTORY_HALF_LIFE_SECONDS (7.0 * 24.0 * 60.0 * 60.0)
+#define HISTORY_COMPACT_THRESHOLD (64u * 1024u)
+
+// One open in the append-only log, followed by repo_len + action_len bytes.
+typedef struct {
+  uint32_t magic;
+  uint16_t repo_len;
+  uint16_t action_len;
+  int64_t timestamp;
+} HistoryRecordHeader;
+
+// The summary folds the whole log up to log_offset into one entry per repo,
+// with scores stored as of reference_time.
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t count;
+  int64_t reference_time;
+  uint64_t log_offset;
+  uint32_t names_len;
+  uint32_t reserved;
+} HistorySummaryHeader;
+
+typedef struct {
+  uint32_t repo_offset;
+  uint32_t action_offset;
+  uint32_t open_count;
+  uint32_t reserved;
+  double score;
+  int64_t last_used;
+} HistorySummaryEntry;
+
+static double decay(int64_t from, int64_t to) {
+  if (to <= from) {
+    return 1.0;
+  }
+  return exp2(-(double)(to - from) / HISTORY_HALF_LIFE_SECONDS);
+}
+
+void history_init(History *history) { memset(history, 0, sizeof(*history)); }
+
+void history_free(History *history) {
+  size_t i;
+  for (i = 0; i < history->count; ++i) {
+    free(history->entries[i].repo);
+    free(history->entries[i].last_action);
+  }
+  free(history->entries);
+  free(history->slots);
+  history_init(history);
+}
+
+static int rebuild_slots(History *history, size_t slot_count) {
+  size_t *slots = calloc(slot_count, sizeof(*slots));
+  size_t i;
+
+  if (!slots) {
+    return 0;
+  }
+
+  for (i = 0; i < history->count; ++i) {
+    const char *repo = history->entries[i].repo;
+    size_t slot = fnv1a(repo) & (slot_count - 1);
+    while (slots[slot] != 0) {
+      slot = (slot + 1) & (slot_count - 1);
+    }
+    slots[slot] = i + 1;
+  }
+
+  free(history->slots);
+  history->slots = slots;
+  history->slot_count = slot_count;
+  return 1;
+}
+
+static HistoryEntry *find_entry(const History *history, const char *repo,
+                                size_t repo_len) {
+  size_t slot;
+
+  if (history->slot_count == 0) {
+    return NULL;
+  }
+
+  slot = fnv1a_bytes(FNV1A_OFFSET_BASIS, repo, repo_len) & (history->slot_count - 1);
+  while (history->slots[slot] != 0) {
+    HistoryEntry *entry = &history->entries[history->slots[slot] - 1];
+    if (strncmp(entry->repo, repo, repo_len) == 0 && entry->repo[repo_len] == '\0') {
+      return entry;
+    }
+    slot = (slot + 1) & (history->slot_count - 1);
+  }
+  return NULL;
+}
+
+const HistoryEntry *history_find(const History *history, const char *repo) {
+  return find_entry(history, repo, strlen(repo));
+}
+
+static char *copy_bytes(const char *bytes, size_t len) {
+  char *copy = malloc(len + 1);
+  if (!copy) {
+    return NULL;
+  }
+  memcpy(copy, bytes, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+// Adds weight (already decayed to history->now) to repo's entry, creating it
+// on first sight.
+static int fold_open(History *history, const char *repo, size_t repo_len,
+                     const char *action, size_t action_len, double weight,
+                     int64_t last_used, uint32_t open_count) {
+  HistoryEntry *entry = find_entry(history, repo, repo_len);
+
+  if (!entry) {
+    if (history->count == history->capacity) {
+      size_t new_cap = history->capacity == 0 ? 64 : history->capacity * 2;
+      HistoryEntry *new_entries =
+          realloc(history->entries, new_cap * sizeof(*new_entries));
+      if (!new_entries) {
+        return 0;
+      }
+      history->entries = new_entries;
+      history->capacity = new_cap;
+    }
+
+    entry = &history->entries[history->count];
+    memset(entry, 0, sizeof(*entry));
+    entry->repo = copy_bytes(repo, repo_len);
+    if (!entry->repo) {
+      return 0;
+    }
+    history->count++;
+
+    if (history->count * 2 > history->slot_count) {
+      if (!rebuild_slots(history, history->slot_count == 0 ? 128
+                                                           : history->slot_count * 2)) {
+        return 0;
+      }
+    } else {
+      size_t slot = fnv1a_bytes(FNV1A_OFFSET_BASIS, repo, repo_len) & (history->slot_count - 1);
+      while (history->slots[slot] != 0) {
+        slot = (slot + 1) & (history->slot_count - 1);
+      }
+      history->slots[slot] = history->count;
+    }
+  }
+
+  entry->score += weight;
+  entry->open_count += open_count;
+  if (last_used >= entry->last_used) {
+    char *new_action = copy_bytes(action, action_len);
+    if (!new_action) {
+      return 0;
+    }
+    free(entry->last_action);
+    entry->last_action = new_action;
+    entry->last_used = last_used;
+  }
+  return 1;
+}
+
+static char *read_whole_file(const char *path, size_t *out_len) {
+  struct stat st;
+  char *buffer;
+  size_t done = 0;
+  int fd;
+
+  *out_len = 0;
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return NULL;
+  }
+
+  buffer = malloc((size_t)st.st_size);
+  if (!buffer) {
+    close(fd);
+    return NULL;
+  }
+
+  while (done < (size_t)st.st_size) {
+    ssize_t got = read(fd, buffer + done, (size_t)st.st_size - done);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      break;
+    }
+    done += (size_t)got;
+  }
+  close(fd);
+
+  *out_len = done;
+  return buffer;
+}
+
+// Returns the log offset the summary covers, or 0 when there is no usable
+// summary (the whole log is then replayed).
+static uint64_t load_summary(History *history, const char *summary_path) {
+  HistorySummaryHeader header;
+  const HistorySummaryEntry *entries;
+  const char *names;
+  char *buffer;
+  size_t len;
+  double age_factor;
+  uint32_t i;
+
+  buffer = read_whole_file(summary_path, &len);
+  if (!buffer) {
+    return 0;
+  }
+
+  if (len < sizeof(header)) {
+    free(buffer);
+    return 0;
+  }
+
+  memcpy(&header, buffer, sizeof(header));
+  if (memcmp(header.magic, HISTORY_SUMMARY_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != HISTORY_SUMMARY_VERSION ||
+      len != sizeof(header) + (size_t)header.count * sizeof(*entries) +
+                 header.names_len ||
+      (header.names_len > 0 && buffer[len - 1] != '\0')) {
+    free(buffer);
+    return 0;
+  }
+
+  entries = (const HistorySummaryEntry *)(buffer + sizeof(header));
+  names = (const char *)(entries + header.count);
+  age_factor = decay(header.reference_time, history->now);
+
+  for (i = 0; i < header.count; ++i) {
+    const char *repo;
+    const char *action;
+
+    if (entries[i].repo_offset >= header.names_len ||
+        entries[i].action_offset >= header.names_len) {
+      continue;
+    }
+
+    repo = names + entries[i].repo_offset;
+    action = names + entries[i].action_offset;
+    if (!fold_open(history, repo, strlen(repo), action, strlen(action),
+                   entries[i].score * age_factor, entries[i].last_used,
+                   entries[i].open_count)) {
+      free(buffer);
+      return 0;
+    }
+  }
+
+  free(buffer);
+  return header.log_offset;
+}
+
+// Replays log records from offset to EOF. Returns the number of bytes folded.
+static size_t replay_log(History *history, int log_fd, uint64_t offset) {
+  struct stat st;
+  char *buffer;
+  size_t len;
+  size_t pos = 0;
+  size_t done = 0;
+
+  if (fstat(log_fd, &st) != 0 || (uint64_t)st.st_size <= offset) {
+    return 0;
+  }
+
+  len = (size_t)((uint64_t)st.st_size - offset);
+  buffer = malloc(len);
+  if (!buffer) {
+    return 0;
+  }
+
+  while (done < len) {
+    ssize_t got = pread(log_fd, buffer + done, len - done, (off_t)(offset + done));
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      break;
+    }
+    done += (size_t)got;
+  }
+
+  while (pos + sizeof(HistoryRecordHeader) <= done) {
+    HistoryRecordHeader record;
+    size_t body;
+
+    memcpy(&record, buffer + pos, sizeof(record));
+    body = (size_t)record.repo_len + record.action_len;
+    if (record.magic != HISTORY_RECORD_MAGIC ||
+        pos + sizeof(record) + body > done) {
+      break;
+    }
+
+    (void)fold_open(history, buffer + pos + sizeof(record), record.repo_len,
+                    buffer + pos + sizeof(record) + record.repo_len,
+                    record.action_len, decay(record.timestamp, history->now),
+                    record.timestamp, 1);
+    pos += sizeof(record) + body;
+  }
+
+  free(buffer);
+  return pos;
+}
+
+static int write_summary(const History *history, const char *summary_path) {
+  HistorySummaryHeader header;
+  HistorySummaryEntry *entries;
+  char tmp_path[PATH_MAX];
+  size_t names_len = 0;
+  size_t cursor = 0;
+  size_t total;
+  char *image;
+  size_t i;
+  int fd;
+  int ok;
+
+  for (i = 0; i < history->count; ++i) {
+    names_len += strlen(history->entries[i].repo) + 1;
+    names_len += strlen(history->entries[i].last_action
+                            ? history->entries[i].last_action
+                            : "") +
+                 1;
+  }
+  if (names_len > UINT32_MAX) {
+    return 0;
+  }
+
+  total = sizeof(header) + history->count * sizeof(*entries) + names_len;
+  image = calloc(1, total);
+  if (!image) {
+    return 0;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, HISTORY_SUMMARY_MAGIC, sizeof(header.magic));
+  header.version = HISTORY_SUMMARY_VERSION;
+  header.count = (uint32_t)history->count;
+  header.reference_time = history->now;
+  header.log_offset = 0;
+  header.names_len = (uint32_t)names_len;
+  memcpy(image, &header, sizeof(header));
+
+  entries = (HistorySummaryEntry *)(image + sizeof(header));
+  for (i = 0; i < history->count; ++i) {
+    const HistoryEntry *entry = &history->entries[i];
+    char *names = (char *)(entries + history->count);
+    const char *action = entry->last_action ? entry->last_action : "";
+    size_t repo_len = strlen(entry->repo) + 1;
+    size_t action_len = strlen(action) + 1;
+
+    entries[i].repo_offset = (uint32_t)cursor;
+    memcpy(names + cursor, entry->repo, repo_len);
+    cursor += repo_len;
+    entries[i].action_offset = (uint32_t)cursor;
+    memcpy(names + cursor, action, action_len);
+    cursor += action_len;
+    entries[i].open_count = entry->open_count;
+    entries[i].score = entry->score;
+    entries[i].last_used = entry->last_used;
+  }
+
+  if (snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", summary_path,
+               (long)getpid()) >= (int)sizeof(tmp_path)) {
+    free(image);
+    return 0;
+  }
+
+  fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    free(image);
+    return 0;
+  }
+
+  ok = write(fd, image, total) == (ssize_t)total;
+  ok = close(fd) == 0 && ok;
+  ok = ok && rename(tmp_path, summary_path) == 0;
+  if (!ok) {
+    unlink(tmp_path);
+  }
+
+  free(image);
+  return ok;
+}
+
+// Folds the whole log into a fresh summary and truncates the log, holding an
+// exclusive lock so no concurrent open is lost between the two.
+static void compact_history(const char *log_path, const char *summary_path) {
+  History history;
+  uint64_t offset;
+  int log_fd;
+
+  log_fd = open(log_path, O_RDWR | O_CLOEXEC);
+  if (log_fd < 0) {
+    return;
+  }
+
+  if (flock(log_fd, LOCK_EX) != 0) {
+    close(log_fd);
+    return;
+  }
+
+  history_init(&history);
+  history.now = (int64_t)time(NULL);
+  offset = load_summary(&history, summary_path);
+  (void)replay_log(&history, log_fd, offset);
+
+  if (write_summary(&history, summary_path)) {
+    (void)ftruncate(log_fd, 0);
+  }
+
+  history_free(&history);
+  flock(log_fd, LOCK_UN);
+  close(log_fd);
+}
+
+int history_load(History *history) {
+  char *log_path = get_data_file_path(HISTORY_LOG_FILE);
+  char *summary_path = get_data_file_path(HISTORY_SUMMARY_FILE);
+  size_t replayed = 0;
+  uint64_t offset;
+  int log_fd;
+
+  history_free(history);
+  history->now = (int64_t)time(NULL);
+
+  if (!log_path || !summary_path) {
+    free(log_path);
+    free(summary_path);
+    return 0;
+  }
+
+  log_fd = open(log_path, O_RDONLY | O_CLOEXEC);
+  if (log_fd >= 0) {
+    (void)flock(log_fd, LOCK_SH);
+  }
+
+  offset = load_summary(history, summary_path);
+  if (log_fd >= 0) {
+    replayed = replay_log(history, log_fd, offset);
+    flock(log_fd, LOCK_UN);
+    close(log_fd);
+  }
+
+  if (replayed > HISTORY_COMPACT_THRESHOLD) {
+    compact_history(log_path, summary_path);
+  }
+
+  free(log_path);
+  free(summary_path);
+  return 1;
+}
+
+static int compare_by_score(const void *left, const void *right) {
+  const HistoryEntry *a = left;
+  const HistoryEntry *b = right;
+  if (a->score != b->score) {
+    return a->score > b->score ? -1 : 1;
+  }
+  return strcmp(a->repo, b->repo);
+}
+
+void history_sort_by_score(History *history) {
+  if (history->count > 1) {
+    qsort(history->entries, history->count, sizeof(*history->entries),
+          compare_by_score);
+    (void)rebuild_slots(history, history->slot_count);
+  }
+}
+
+int history_record(const char *repo, const char *action) {
+  HistoryRecordHeader record;
+  char *buffer;
+  size_t repo_len = strlen(repo);
+  size_t action_len = strlen(action ? action : "");
+  char *log_path;
+  size_t total;
+  int log_fd;
+  int ok;
+
+  if (repo_len > UINT16_MAX || action_len > UINT16_MAX) {
+    return 0;
+  }
+
+  log_path = get_data_file_path(HISTORY_LOG_FILE);
+  if (!log_path) {
+    return 0;
+  }
+
+  log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  free(log_path);
+  if (log_fd < 0) {
+    return 0;
+  }
+
+  total = sizeof(record) + repo_len + action_len;
+  buffer = malloc(total);
+  if (!buffer) {
+    close(log_fd);
+    return 0;
+  }
+
+  record.magic = HISTORY_RECORD_MAGIC;
+  record.repo_len = (uint16_t)repo_len;
+  record.action_len = (uint16_t)action_len;
+  record.timestamp = (int64_t)time(NULL);
+  memcpy(buffer, &record, sizeof(record));
+  memcpy(buffer + sizeof(record), repo, repo_len);
+  memcpy(buffer + sizeof(record) + repo_len, action ? action : "", action_len);
+
+  // One write per record so concurrent appenders never interleave.
+  (void)flock(log_fd, LOCK_EX);
+  ok = write(log_fd, buffer, total) == (ssize_t)total;
+  flock(log_fd, LOCK_UN);
+  close(log_fd);
+  free(buffer);
+  return ok;
+}
@@ -0,0 +1,34 @@
+#ifndef history_lib_included
+#define history_lib_included
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+  char *repo;
+  char *last_action;
+  double score;
+  int64_t last_used;
+  uint32_t open_count;
+} HistoryEntry;
+
+// Per-repo frecency, folded from the compacted summary plus the tail of the
+// append-only open log. Scores are exponentially decayed to load time.
+typedef struct {
+  HistoryEntry *entries;
+  size_t count;
+  size_t capacity;
+  size_t *slots;
+  size_t slot_count;
+  int64_t now;
+} History;
+
+void history_init(History *history);
+int history_load(History *history);
+const HistoryEntry *history_find(const History *history, const char *repo);
+void history_sort_by_score(History *history);
+void history_free(History *history);
+
+int history_record(const char *repo, const char *action);
+
+#endif // history_lib_included
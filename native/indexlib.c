@@ -0,0 +1,413 @@
+#include "hashlib.h"
+#include "indexlib.h"
+#include "pathlib.h"
+#include "sortlib.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REPO_INDEX_MAGIC "OPRIDX\0"
+#define REPO_INDEX_VERSION 3u
+// Large enough that a root with thousands of repos takes a few syscalls.
+#define INDEX_SCAN_BUFFER_SIZE (256 * 1024)
+
+// On-disk layout: header, the indexed directory path (padded to 4 bytes),
+// count uint32 offsets into the names blob in sorted order (sort_flags from
+// sortlib.h), then the blob of NUL-terminated names. Everything is read in
+// place from the mapping.
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t count;
+  uint64_t dir_dev;
+  uint64_t dir_ino;
+  int64_t dir_mtime_sec;
+  int64_t dir_mtime_nsec;
+  int64_t built_sec;
+  uint32_t path_len;
+  uint32_t names_len;
+  uint32_t sort_flags;
+  uint32_t reserved;
+} RepoIndexHeader;
+
+static size_t pad4(size_t value) { return (value + 3u) & ~(size_t)3u; }
+
+static const RepoIndexHeader *index_header(const RepoIndex *index) {
+  return (const RepoIndexHeader *)index->image;
+}
+
+void repo_index_init(RepoIndex *index) { memset(index, 0, sizeof(*index)); }
+
+void repo_index_close(RepoIndex *index) {
+  if (index->image) {
+    if (index->is_mapped) {
+      munmap(index->image, index->image_len);
+    } else {
+      free(index->image);
+    }
+  }
+  repo_index_init(index);
+}
+
+const char *repo_index_name(const RepoIndex *index, size_t position) {
+  uint32_t offset;
+
+  if (position >= index->count) {
+    return NULL;
+  }
+
+  offset = index->offsets[position];
+  if (offset >= index->names_len) {
+    return "";
+  }
+  return index->names + offset;
+}
+
+static int header_matches_dir(const RepoIndexHeader *header, const struct stat *st) {
+  return header->dir_dev == (uint64_t)st->st_dev &&
+         header->dir_ino == (uint64_t)st->st_ino &&
+         header->dir_mtime_sec == (int64_t)st->st_mtim.tv_sec &&
+         header->dir_mtime_nsec == (int64_t)st->st_mtim.tv_nsec &&
+         // A directory modified in the same second the index was built may
+         // have changed after the scan without a visible mtime change.
+         header->dir_mtime_sec < header->built_sec;
+}
+
+static int attach_image(RepoIndex *index, void *image, size_t image_len,
+                        int is_mapped, const char *directory) {
+  const RepoIndexHeader *header = image;
+  size_t path_len = strlen(directory);
+  size_t offsets_at;
+  size_t names_at;
+
+  if (image_len < sizeof(*header) ||
+      memcmp(header->magic, REPO_INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != REPO_INDEX_VERSION || header->path_len != path_len) {
+    return 0;
+  }
+
+  offsets_at = sizeof(*header) + pad4(header->path_len);
+  names_at = offsets_at + (size_t)header->count * sizeof(uint32_t);
+  if (names_at + header->names_len != image_len ||
+      (header->names_len > 0 &&
+       ((const char *)image)[image_len - 1] != '\0') ||
+      memcmp((const char *)image + sizeof(*header), directory, path_len) != 0) {
+    return 0;
+  }
+
+  index->image = image;
+  index->image_len = image_len;
+  index->is_mapped = is_mapped;
+  index->offsets = (const uint32_t *)((const char *)image + offsets_at);
+  index->names = (const char *)image + names_at;
+  index->names_len = header->names_len;
+  index->count = header->count;
+  return 1;
+}
+
+static char *index_cache_path(const char *directory) {
+  char file_name[64];
+
+  snprintf(file_name, sizeof(file_name), "repos-%016llx.idx",
+           (unsigned long long)fnv1a(directory));
+  return get_cache_file_path(file_name);
+}
+
+static int load_mapped_index(const char *cache_path, const char *directory,
+                             const struct stat *dir_st, unsigned sort_flags,
+                             RepoIndex *index) {
+  struct stat st;
+  void *map;
+  int fd;
+
+  fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return 0;
+  }
+
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(RepoIndexHeader)) {
+    close(fd);
+    return 0;
+  }
+
+  map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return 0;
+  }
+
+  if (!header_matches_dir(map, dir_st) ||
+      ((const RepoIndexHeader *)map)->sort_flags != sort_flags ||
+      !attach_image(index, map, (size_t)st.st_size, 1, directory)) {
+    munmap(map, (size_t)st.st_size);
+    return 0;
+  }
+
+  return 1;
+}
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} ByteBuffer;
+
+static int buffer_append(ByteBuffer *buffer, const void *bytes, size_t len) {
+  if (buffer->len + len > buffer->cap) {
+    size_t new_cap = buffer->cap == 0 ? 4096 : buffer->cap;
+    char *new_data;
+    while (new_cap < buffer->len + len) {
+      new_cap *= 2;
+    }
+    new_data = realloc(buffer->data, new_cap);
+    if (!new_data) {
+      return 0;
+    }
+    buffer->data = new_data;
+    buffer->cap = new_cap;
+  }
+
+  memcpy(buffer->data + buffer->len, bytes, len);
+  buffer->len += len;
+  return 1;
+}
+
+// What getdents64 fills the buffer with; glibc has no public struct for it.
+typedef struct {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+} LinuxDirent64;
+
+// Whether a directory entry names a directory a repo could live in. d_type
+// settles it for most entries; symlinks, and filesystems that leave d_type
+// DT_UNKNOWN, take one fstatat following the link.
+static int entry_is_directory(int dir_fd, const LinuxDirent64 *entry) {
+  struct stat st;
+
+  if (entry->d_type == DT_DIR) {
+    return 1;
+  }
+  if (entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) {
+    return 0;
+  }
+  return fstatat(dir_fd, entry->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Lists the visible subdirectories of directory straight from getdents64
+// into names, without readdir's per-entry copies and small buffer.
+static int scan_directory(const char *directory, ByteBuffer *names,
+                          ByteBuffer *offsets) {
+  char *buffer;
+  int dir_fd;
+  int ok = 1;
+
+  dir_fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0) {
+    perror("open");
+    return 0;
+  }
+  buffer = malloc(INDEX_SCAN_BUFFER_SIZE);
+  if (!buffer) {
+    close(dir_fd);
+    return 0;
+  }
+
+  while (ok) {
+    long got = syscall(SYS_getdents64, dir_fd, buffer, INDEX_SCAN_BUFFER_SIZE);
+    long pos = 0;
+
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      if (got < 0) {
+        perror("getdents64");
+        ok = 0;
+      }
+      break;
+    }
+
+    while (pos < got && ok) {
+      const LinuxDirent64 *entry = (const LinuxDirent64 *)(buffer + pos);
+      uint32_t offset = (uint32_t)names->len;
+
+      pos += entry->d_reclen;
+      // Skips ".", ".." and hidden entries such as .cache.
+      if (entry->d_name[0] == '.' || !entry_is_directory(dir_fd, entry)) {
+        continue;
+      }
+      ok = names->len <= UINT32_MAX - 4096 &&
+           buffer_append(names, entry->d_name, strlen(entry->d_name) + 1) &&
+           buffer_append(offsets, &offset, sizeof(offset));
+    }
+  }
+
+  free(buffer);
+  close(dir_fd);
+  return ok;
+}
+
+static void write_index_file(const char *cache_path, const void *image,
+                             size_t image_len) {
+  char tmp_path[PATH_MAX];
+  const char *ptr = image;
+  size_t remaining = image_len;
+  int fd;
+
+  if (snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", cache_path,
+               (long)getpid()) >= (int)sizeof(tmp_path)) {
+    return;
+  }
+
+  fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return;
+  }
+
+  while (remaining > 0) {
+    ssize_t written = write(fd, ptr, remaining);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      close(fd);
+      unlink(tmp_path);
+      return;
+    }
+    ptr += written;
+    remaining -= (size_t)written;
+  }
+
+  if (close(fd) != 0 || rename(tmp_path, cache_path) != 0) {
+    unlink(tmp_path);
+  }
+}
+
+static int rebuild_index(const char *cache_path, const char *directory,
+                         const struct stat *dir_st, unsigned sort_flags,
+                         RepoIndex *index) {
+  ByteBuffer names = {0};
+  ByteBuffer offsets = {0};
+  RepoIndexHeader header;
+  struct stat after_st;
+  char *image;
+  size_t count;
+  size_t path_len = strlen(directory);
+  size_t offsets_at;
+  size_t names_at;
+  size_t image_len;
+  size_t i;
+  const uint32_t *sorted;
+  char *out_names;
+  uint32_t *out_offsets;
+  uint32_t cursor = 0;
+
+  memset(&header, 0, sizeof(header));
+  header.built_sec = (int64_t)time(NULL);
+
+  if (!scan_directory(directory, &names, &offsets)) {
+    free(names.data);
+    free(offsets.data);
+    return 0;
+  }
+
+  count = offsets.len / sizeof(uint32_t);
+  if (!sort_name_offsets((uint32_t *)offsets.data, count, names.data, sort_flags)) {
+    free(names.data);
+    free(offsets.data);
+    return 0;
+  }
+
+  offsets_at = sizeof(header) + pad4(path_len);
+  names_at = offsets_at + count * sizeof(uint32_t);
+  image_len = names_at + names.len;
+  image = calloc(1, image_len);
+  if (!image) {
+    free(names.data);
+    free(offsets.data);
+    return 0;
+  }
+
+  memcpy(header.magic, REPO_INDEX_MAGIC, sizeof(header.magic));
+  header.version = REPO_INDEX_VERSION;
+  header.count = (uint32_t)count;
+  header.dir_dev = (uint64_t)dir_st->st_dev;
+  header.dir_ino = (uint64_t)dir_st->st_ino;
+  header.dir_mtime_sec = (int64_t)dir_st->st_mtim.tv_sec;
+  header.dir_mtime_nsec = (int64_t)dir_st->st_mtim.tv_nsec;
+  header.path_len = (uint32_t)path_len;
+  header.names_len = (uint32_t)names.len;
+  header.sort_flags = sort_flags;
+  memcpy(image, &header, sizeof(header));
+  memcpy(image + sizeof(header), directory, path_len);
+
+  // Lay the names out in sorted order so the blob itself reads as a listing.
+  sorted = (const uint32_t *)offsets.data;
+  out_offsets = (uint32_t *)(image + offsets_at);
+  out_names = image + names_at;
+  for (i = 0; i < count; ++i) {
+    const char *name = names.data + sorted[i];
+    size_t len = strlen(name) + 1;
+    out_offsets[i] = cursor;
+    memcpy(out_names + cursor, name, len);
+    cursor += (uint32_t)len;
+  }
+
+  free(names.data);
+  free(offsets.data);
+
+  // Only persist the image when nothing changed while we were scanning.
+  if (stat(directory, &after_st) == 0 && header_matches_dir(&header, &after_st) &&
+      cache_path) {
+    write_index_file(cache_path, image, image_len);
+  }
+
+  if (!attach_image(index, image, image_len, 0, directory)) {
+    free(image);
+    return 0;
+  }
+  return 1;
+}
+
+int repo_index_open(const char *directory, unsigned sort_flags, RepoIndex *index) {
+  struct stat dir_st;
+  char *cache_path;
+  int ok;
+
+  if (stat(directory, &dir_st) != 0) {
+    perror("stat");
+    return 0;
+  }
+
+  if (index->image && header_matches_dir(index_header(index), &dir_st) &&
+      index_header(index)->sort_flags == sort_flags) {
+    return 1;
+  }
+
+  repo_index_close(index);
+
+  cache_path = index_cache_path(directory);
+  if (cache_path &&
+      load_mapped_index(cache_path, directory, &dir_st, sort_flags, index)) {
+    free(cache_path);
+    return 1;
+  }
+
+  ok = rebuild_index(cache_path, directory, &dir_st, sort_flags, index);
+  free(cache_path);
+  return ok;
+}
@@ -0,0 +1,26 @@
+#ifndef index_lib_included
+#define index_lib_included
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Sorted listing of a repo root, backed by an on-disk image that is mmap'd
+// when the directory's inode/mtime still match the ones it was built from.
+typedef struct {
+  void *image;
+  size_t image_len;
+  int is_mapped;
+  const uint32_t *offsets;
+  const char *names;
+  size_t names_len;
+  size_t count;
+} RepoIndex;
+
+void repo_index_init(RepoIndex *index);
+// sort_flags (SORT_* from sortlib.h) pick the listing order; an index built
+// in another order is rebuilt.
+int repo_index_open(const char *directory, unsigned sort_flags, RepoIndex *index);
+const char *repo_index_name(const RepoIndex *index, size_t position);
+void repo_index_close(RepoIndex *index);
+
+#endif // index_lib_included
@@ -1,10 +1,26 @@
 #include "configlib.h"
+#include "daemonlib.h"
+#include "decorlib.h"
+#include "discoverlib.h"
 #include "fzflib.h"
+#include "gitlib.h"
+#include "hashlib.h"
+#include "historylib.h"
+#include "indexlib.h"
+#include "matchlib.h"
+#include "metalib.h"
 #include "pathlib.h"
+#include "reloadlib.h"
+#include "shelllib.h"
+#include "sortlib.h"
+#include "spawnlib.h"
+#include "synclib.h"
+#include "templatelib.h"
+#include "tmuxlib.h"
 
 #include <ctype.h>
-#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -13,18 +29,36 @@
 #include <stdint.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #define MAIN_TMUX_SESSION_NAME "code"
 #define EXIT_KEYWORD "<< Exit >>"
 #define CLONE_KEYWORD "<< Clone >>"
 #define NEW_REPO_KEYWORD "<< New Repo >>"
-
+#define DAEMON_LIST_REQUEST "op1-list"
+#define DAEMON_OK_LINE "OK\n"
+// A tab can't be mistaken for part of a repo name; fzf shows it (with
+// --tabstop=1) as the first of the two spaces before the bracket.
+#define DECORATION_SEPARATOR '\t'
+#define DECORATION_OPEN "\t ["
+#define DECORATION_AHEAD "\xe2\x86\x91"    // ↑
+#define DECORATION_BEHIND "\xe2\x86\x93"   // ↓
+#define DECORATION_DIVERGED "\xe2\x89\xa0" // ≠
+#define PULL_LOG_FILE "pull.log"
+#define PULL_LOG_MAX_SIZE (256 * 1024)
+
+// Strings copied in by vec_push are packed back to back (each NUL-terminated)
+// into one text buffer rather than allocated one by one. items points into
+// text or at storage the vec does not own (e.g. a mapped repo index), so
+// sorting only moves pointers.
 typedef struct {
   char **items;
   size_t count;
   size_t capacity;
+  char *text;
+  size_t text_len;
+  size_t text_capacity;
 } StringVec;
 
 typedef struct {
@@ -37,12 +71,14 @@ typedef struct {
   const char *name;
   const char *command;
   bool run_in_preferred_shell;
+  OpShellMode shell;
 } BuiltinCommand;
 
 static const BuiltinCommand BUILTIN_NEW_WORKTREE = {
     .name = "new-worktree",
     .command = "pwsh \"{{oproot}}/scripts/New-GitWorktree.ps1\"",
     .run_in_preferred_shell = false,
+    .shell = OP_SHELL_AUTO,
 };
 
 static char *xstrdup(const char *value) {
@@ -63,66 +99,139 @@ static void vec_init(StringVec *vec) {
   vec->items = NULL;
   vec->count = 0;
   vec->capacity = 0;
+  vec->text = NULL;
+  vec->text_len = 0;
+  vec->text_capacity = 0;
 }
 
-static int vec_push(StringVec *vec, const char *value) {
+static int vec_reserve(StringVec *vec, size_t needed) {
   char **new_items;
+  size_t new_cap;
 
-  if (vec->count == vec->capacity) {
-    size_t new_cap = vec->capacity == 0 ? 8 : vec->capacity * 2;
-    if (new_cap < vec->capacity) {
-      return 0;
-    }
+  if (needed <= vec->capacity) {
+    return 1;
+  }
 
-    new_items = realloc(vec->items, new_cap * sizeof(*new_items));
-    if (!new_items) {
+  new_cap = vec->capacity == 0 ? 8 : vec->capacity;
+  while (new_cap < needed) {
+    if (new_cap > (SIZE_MAX / (2 * sizeof(*new_items)))) {
       return 0;
     }
-
-    vec->items = new_items;
-    vec->capacity = new_cap;
+    new_cap *= 2;
   }
 
-  vec->items[vec->count] = xstrdup(value);
-  if (!vec->items[vec->count]) {
+  new_items = realloc(vec->items, new_cap * sizeof(*new_items));
+  if (!new_items) {
     return 0;
   }
 
-  vec->count++;
+  vec->items = new_items;
+  vec->capacity = new_cap;
   return 1;
 }
 
-static void vec_free(StringVec *vec) {
+// Grows text to hold needed bytes. The old buffer stays alive until the
+// items pointing into it have been moved over to the new one.
+static int vec_reserve_text(StringVec *vec, size_t needed) {
+  uintptr_t old_start = (uintptr_t)vec->text;
+  uintptr_t old_end = old_start + vec->text_len;
+  char *new_text;
+  size_t new_cap;
   size_t i;
+
+  if (needed <= vec->text_capacity) {
+    return 1;
+  }
+
+  new_cap = vec->text_capacity == 0 ? 4096 : vec->text_capacity;
+  while (new_cap < needed) {
+    if (new_cap > SIZE_MAX / 2) {
+      return 0;
+    }
+    new_cap *= 2;
+  }
+
+  new_text = malloc(new_cap);
+  if (!new_text) {
+    return 0;
+  }
+  if (vec->text_len > 0) {
+    memcpy(new_text, vec->text, vec->text_len);
+  }
   for (i = 0; i < vec->count; ++i) {
-    free(vec->items[i]);
+    uintptr_t item = (uintptr_t)vec->items[i];
+    if (item >= old_start && item < old_end) {
+      vec->items[i] = new_text + (item - old_start);
+    }
   }
-  free(vec->items);
-  vec->items = NULL;
-  vec->count = 0;
-  vec->capacity = 0;
+
+  free(vec->text);
+  vec->text = new_text;
+  vec->text_capacity = new_cap;
+  return 1;
 }
 
-static int vec_contains(const StringVec *vec, const char *value) {
-  size_t i;
+static int vec_push_borrowed(StringVec *vec, const char *value) {
+  if (!vec_reserve(vec, vec->count + 1)) {
+    return 0;
+  }
+
+  vec->items[vec->count++] = (char *)value;
+  return 1;
+}
+
+static int vec_push(StringVec *vec, const char *value) {
+  size_t size = strlen(value) + 1;
+  char *copy;
 
-  if (!vec || !value) {
+  if (!vec_reserve(vec, vec->count + 1) ||
+      !vec_reserve_text(vec, vec->text_len + size)) {
+    fprintf(stderr, "Out of memory\n");
     return 0;
   }
 
-  for (i = 0; i < vec->count; ++i) {
-    if (vec->items[i] && strcmp(vec->items[i], value) == 0) {
-      return 1;
+  copy = vec->text + vec->text_len;
+  memcpy(copy, value, size);
+  vec->text_len += size;
+  vec->items[vec->count++] = copy;
+  return 1;
+}
+
+// Splits a malloc'd block of '\n'-terminated lines in place, from offset
+// start on, and takes it over as the vec's text so nothing is copied. A vec
+// that already owns text gets copies instead, and the block is freed.
+static int vec_adopt_lines(StringVec *vec, char *text, size_t start, size_t len) {
+  int adopt = vec->text == NULL;
+  char *line = text + start;
+  char *end = text + len;
+  int ok = 1;
+
+  if (adopt) {
+    vec->text = text;
+    vec->text_len = len;
+    vec->text_capacity = len;
+  }
+
+  while (line < end && ok) {
+    char *newline = memchr(line, '\n', (size_t)(end - line));
+    if (!newline) {
+      break;
     }
+    *newline = '\0';
+    ok = adopt ? vec_push_borrowed(vec, line) : vec_push(vec, line);
+    line = newline + 1;
   }
 
-  return 0;
+  if (!adopt) {
+    free(text);
+  }
+  return ok;
 }
 
-static int compare_strings(const void *left, const void *right) {
-  const char *a = *(const char *const *)left;
-  const char *b = *(const char *const *)right;
-  return strcmp(a, b);
+static void vec_free(StringVec *vec) {
+  free(vec->text);
+  free(vec->items);
+  vec_init(vec);
 }
 
 static void sb_init(StringBuilder *sb) {
@@ -393,121 +502,12 @@ static char *resolve_config_path(const char *exe_dir) {
 }
 
 static int run_command_in_dir(const char *working_dir, char *const argv[]) {
-  pid_t pid;
-  int status = 0;
-
-  pid = fork();
-  if (pid < 0) {
-    perror("fork");
-    return -1;
-  }
-
-  if (pid == 0) {
-    if (working_dir && chdir(working_dir) != 0) {
-      perror("chdir");
-      _exit(127);
-    }
-
-    execvp(argv[0], argv);
-    perror("execvp");
-    _exit(127);
-  }
-
-  while (waitpid(pid, &status, 0) < 0) {
-    if (errno != EINTR) {
-      perror("waitpid");
-      return -1;
-    }
-  }
-
-  if (WIFEXITED(status)) {
-    return WEXITSTATUS(status);
-  }
-
-  return -1;
+  return spawn_run(working_dir, argv);
 }
 
 static char *capture_command_output(const char *working_dir, char *const argv[],
                                     int *exit_code) {
-  int pipefd[2];
-  pid_t pid;
-  int status = 0;
-  StringBuilder sb;
-
-  if (pipe(pipefd) != 0) {
-    perror("pipe");
-    return NULL;
-  }
-
-  pid = fork();
-  if (pid < 0) {
-    perror("fork");
-    close(pipefd[0]);
-    close(pipefd[1]);
-    return NULL;
-  }
-
-  if (pid == 0) {
-    close(pipefd[0]);
-
-    if (dup2(pipefd[1], STDOUT_FILENO) < 0) {
-      _exit(127);
-    }
-
-    close(pipefd[1]);
-
-    if (working_dir && chdir(working_dir) != 0) {
-      _exit(127);
-    }
-
-    execvp(argv[0], argv);
-    _exit(127);
-  }
-
-  close(pipefd[1]);
-  sb_init(&sb);
-
-  while (1) {
-    char chunk[256];
-    ssize_t bytes_read = read(pipefd[0], chunk, sizeof(chunk));
-    if (bytes_read < 0) {
-      if (errno == EINTR) {
-        continue;
-      }
-      sb_free(&sb);
-      close(pipefd[0]);
-      while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
-      }
-      return NULL;
-    }
-
-    if (bytes_read == 0) {
-      break;
-    }
-
-    if (!sb_append_n(&sb, chunk, (size_t)bytes_read)) {
-      sb_free(&sb);
-      close(pipefd[0]);
-      while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
-      }
-      return NULL;
-    }
-  }
-
-  close(pipefd[0]);
-
-  while (waitpid(pid, &status, 0) < 0) {
-    if (errno != EINTR) {
-      sb_free(&sb);
-      return NULL;
-    }
-  }
-
-  if (exit_code) {
-    *exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
-  }
-
-  return sb_take(&sb);
+  return spawn_capture(working_dir, argv, 0, NULL, exit_code);
 }
 
 static int output_has_visible_text(const char *text) {
@@ -524,6 +524,31 @@ static int output_has_visible_text(const char *text) {
   return 0;
 }
 
+// Returns 1 when tracked files have uncommitted changes, 0 when they do not
+// and -1 when that could not be determined. The index is read directly;
+// git is only run when its stat data cannot settle the question.
+static int repo_has_local_changes(const char *repo_path) {
+  char *const status_argv[] = {"git", "status", "--porcelain", "--untracked-files=no",
+                               NULL};
+  GitTreeState state = git_tree_state(repo_path);
+  char *status_output;
+  int status_code = 0;
+  int dirty;
+
+  if (state != GIT_TREE_UNKNOWN) {
+    return state == GIT_TREE_DIRTY;
+  }
+
+  status_output = capture_command_output(repo_path, status_argv, &status_code);
+  if (!status_output || status_code != 0) {
+    free(status_output);
+    return -1;
+  }
+  dirty = output_has_visible_text(status_output);
+  free(status_output);
+  return dirty;
+}
+
 static void update_repo_if_clean(const char *repo_path, bool no_repo_update) {
   char *git_dir;
   struct stat statbuf;
@@ -546,22 +571,17 @@ static void update_repo_if_clean(const char *repo_path, bool no_repo_update) {
   free(git_dir);
 
   {
-    char *const status_argv[] = {"git", "status", "--porcelain", NULL};
-    int status_code = 0;
-    char *status_output = capture_command_output(repo_path, status_argv, &status_code);
+    int dirty = repo_has_local_changes(repo_path);
 
-    if (!status_output || status_code != 0) {
+    if (dirty < 0) {
       fprintf(stderr, "Failed to check git status for %s\n", repo_path);
-      free(status_output);
       return;
     }
 
-    if (output_has_visible_text(status_output)) {
+    if (dirty) {
       printf("Repo %s has uncommitted changes\n", repo_path);
-      free(status_output);
       return;
     }
-    free(status_output);
   }
 
   printf("Updating repo %s\n", repo_path);
@@ -571,6 +591,129 @@ static void update_repo_if_clean(const char *repo_path, bool no_repo_update) {
   }
 }
 
+// Appends one line to the background update log and, when asked, shows the
+// same result in tmux's status line.
+static void report_background_update(const char *repo_path, const char *result,
+                                     bool notify_tmux) {
+  char *log_path = get_cache_file_path(PULL_LOG_FILE);
+  struct stat statbuf;
+
+  if (log_path) {
+    int truncate_log = stat(log_path, &statbuf) == 0 &&
+                       statbuf.st_size > PULL_LOG_MAX_SIZE;
+    FILE *log = fopen(log_path, truncate_log ? "w" : "a");
+    if (log) {
+      char stamp[32];
+      time_t now = time(NULL);
+      struct tm local;
+      localtime_r(&now, &local);
+      strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+      fprintf(log, "%s\t%s\t%s\n", stamp, repo_path, result);
+      fclose(log);
+    }
+    free(log_path);
+  }
+
+  if (notify_tmux) {
+    StringBuilder message;
+    sb_init(&message);
+    if (sb_append(&message, "op: ") && sb_append(&message, repo_path) &&
+        sb_append(&message, ": ") && sb_append(&message, result)) {
+      char *const argv[] = {"tmux", "display-message", message.data, NULL};
+      (void)run_command_in_dir(NULL, argv);
+    }
+    sb_free(&message);
+  }
+}
+
+// Body of `op --pull-worker <repo> [--notify-tmux]`. Detaches from the op
+// that started it, then runs the clean check and a fast-forward pull. The
+// check runs after the editor has opened, so edits made meanwhile also
+// cancel the pull.
+static int run_pull_worker(const char *repo_path, bool notify_tmux) {
+  char *const pull_argv[] = {"git", "pull", "--ff-only", NULL};
+  char *output;
+  int exit_code = 0;
+  int dirty;
+  pid_t pid;
+
+  pid = fork();
+  if (pid != 0) {
+    return pid < 0 ? 1 : 0;
+  }
+  setsid();
+
+  setenv("GIT_TERMINAL_PROMPT", "0", 1);
+  setenv("LC_ALL", "C", 1);
+
+  dirty = repo_has_local_changes(repo_path);
+  if (dirty < 0) {
+    report_background_update(repo_path, "could not check git status", notify_tmux);
+    _exit(1);
+  }
+
+  if (dirty) {
+    report_background_update(repo_path, "not updated, has local changes",
+                             notify_tmux);
+    _exit(0);
+  }
+
+  output = spawn_capture(repo_path, pull_argv, 1, NULL, &exit_code);
+  if (!output || exit_code != 0) {
+    report_background_update(repo_path, "pull failed", notify_tmux);
+  } else if (strstr(output, "Already up to date")) {
+    report_background_update(repo_path, "already up to date", notify_tmux);
+  } else {
+    report_background_update(repo_path, "updated", notify_tmux);
+  }
+  free(output);
+  _exit(exit_code == 0 ? 0 : 1);
+}
+
+// Updates the repo before it is opened: inline (the original blocking
+// behaviour) or through a detached worker so the editor starts at once.
+static void start_repo_update(const OpConfig *config, const char *executable_path,
+                              const char *repo_path, bool no_repo_update,
+                              bool notify_tmux) {
+  char *git_dir;
+  struct stat statbuf;
+  int null_fd;
+  pid_t pid;
+
+  if (no_repo_update) {
+    return;
+  }
+
+  if (!config->background_repo_update) {
+    update_repo_if_clean(repo_path, false);
+    return;
+  }
+
+  git_dir = join_path(repo_path, ".git");
+  if (!git_dir || stat(git_dir, &statbuf) != 0 || !S_ISDIR(statbuf.st_mode)) {
+    free(git_dir);
+    return;
+  }
+  free(git_dir);
+
+  null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+  if (null_fd < 0) {
+    return;
+  }
+
+  {
+    char *const argv[] = {(char *)executable_path, "--pull-worker", (char *)repo_path,
+                          notify_tmux ? "--notify-tmux" : NULL, NULL};
+    pid = spawn_process_io(NULL, argv, null_fd, null_fd, null_fd);
+  }
+  close(null_fd);
+
+  // The worker forks and its first process exits right away.
+  if (pid > 0) {
+    (void)spawn_wait(pid);
+  }
+}
+
 static char *quote_for_posix_single(const char *text) {
   StringBuilder sb;
   const char *ptr;
@@ -725,52 +868,6 @@ static char *build_shell_cd_command(const char *shell_name, const char *path_to_
   return sb_take(&sb);
 }
 
-static char *replace_all(const char *input, const char *needle,
-                         const char *replacement) {
-  StringBuilder sb;
-  size_t needle_len;
-  size_t replacement_len;
-  const char *cursor;
-
-  if (!input || !needle || !replacement) {
-    return NULL;
-  }
-
-  needle_len = strlen(needle);
-  replacement_len = strlen(replacement);
-  if (needle_len == 0) {
-    return xstrdup(input);
-  }
-
-  sb_init(&sb);
-  cursor = input;
-
-  while (*cursor) {
-    const char *match = strstr(cursor, needle);
-    if (!match) {
-      if (!sb_append(&sb, cursor)) {
-        sb_free(&sb);
-        return NULL;
-      }
-      break;
-    }
-
-    if (!sb_append_n(&sb, cursor, (size_t)(match - cursor))) {
-      sb_free(&sb);
-      return NULL;
-    }
-
-    if (replacement_len > 0 && !sb_append_n(&sb, replacement, replacement_len)) {
-      sb_free(&sb);
-      return NULL;
-    }
-
-    cursor = match + needle_len;
-  }
-
-  return sb_take(&sb);
-}
-
 static int run_shell_command_in_dir(const char *working_dir, const char *command) {
   char *const argv[] = {"/bin/sh", "-lc", (char *)command, NULL};
   return run_command_in_dir(working_dir, argv);
@@ -835,20 +932,82 @@ static int open_preferred_shell_in_dir(const char *preferred_shell,
   }
 }
 
-static int tmux_has_session(const char *session_name) {
-  char *const argv[] = {"tmux", "has-session", "-t", (char *)session_name, NULL};
-  return run_command_in_dir(NULL, argv) == 0;
+// Returns the shared control-mode client, (re)connecting when needed. Inside
+// tmux it attaches to the caller's session; otherwise it attaches to the main
+// session, creating it on the way. On tmux 3.2+ the client never draws or
+// resizes; older versions don't take client flags, so they are left out.
+static TmuxClient *tmux_connect(TmuxClient **tmux, const char *start_dir) {
+  const char *tmux_env = getenv("TMUX");
+  const char *pane = getenv("TMUX_PANE");
+  const char *attach_argv[12];
+  size_t argc = 0;
+
+  if (tmux_client_is_alive(*tmux)) {
+    return *tmux;
+  }
+
+  tmux_client_close(*tmux);
+  if (tmux_env && tmux_env[0] != '\0') {
+    attach_argv[argc++] = "attach-session";
+  } else {
+    attach_argv[argc++] = "new-session";
+    attach_argv[argc++] = "-A";
+  }
+  if (tmux_supports_client_flags()) {
+    attach_argv[argc++] = "-f";
+    attach_argv[argc++] = "no-output,ignore-size";
+  }
+  if (tmux_env && tmux_env[0] != '\0') {
+    if (pane && pane[0] != '\0') {
+      attach_argv[argc++] = "-t";
+      attach_argv[argc++] = pane;
+    }
+  } else {
+    attach_argv[argc++] = "-s";
+    attach_argv[argc++] = MAIN_TMUX_SESSION_NAME;
+    attach_argv[argc++] = "-n";
+    attach_argv[argc++] = "op";
+    attach_argv[argc++] = "-c";
+    attach_argv[argc++] = start_dir;
+  }
+  attach_argv[argc] = NULL;
+  *tmux = tmux_client_open(attach_argv);
+  return *tmux;
+}
+
+// Runs one command and returns its first output line, or NULL when the
+// command failed or printed nothing.
+static char *tmux_run_single_line(TmuxClient *tmux, const char *const *argv) {
+  char *output = NULL;
+
+  if (!tmux_client_run(tmux, argv, &output)) {
+    free(output);
+    return NULL;
+  }
+
+  output[strcspn(output, "\n")] = '\0';
+  if (output[0] == '\0') {
+    free(output);
+    return NULL;
+  }
+  return output;
+}
+
+static int tmux_has_session(TmuxClient *tmux, const char *session_name) {
+  const char *const argv[] = {"has-session", "-t", session_name, NULL};
+  return tmux_client_run(tmux, argv, NULL);
 }
 
-static int ensure_tmux_session(const char *session_name, const char *start_dir) {
-  if (tmux_has_session(session_name)) {
+static int ensure_tmux_session(TmuxClient *tmux, const char *session_name,
+                               const char *start_dir) {
+  if (tmux_has_session(tmux, session_name)) {
     return 1;
   }
 
   {
-    char *const argv[] = {"tmux", "new-session", "-d", "-s", (char *)session_name,
-                          "-n", "op", "-c", (char *)start_dir, NULL};
-    return run_command_in_dir(NULL, argv) == 0;
+    const char *const argv[] = {"new-session", "-d", "-s", session_name,
+                                "-n", "op", "-c", start_dir, NULL};
+    return tmux_client_run(tmux, argv, NULL);
   }
 }
 
@@ -880,23 +1039,6 @@ static int parse_int_with_default(const char *value, int fallback) {
   return (int)parsed;
 }
 
-static int get_tmux_base_index(void) {
-  char *const argv[] = {"tmux", "show-options", "-gv", "base-index", NULL};
-  int status = 0;
-  char *output = capture_command_output(NULL, argv, &status);
-  int base_index = 0;
-
-  if (!output || status != 0) {
-    free(output);
-    return 0;
-  }
-
-  trim_trailing_newline(output);
-  base_index = parse_int_with_default(output, 0);
-  free(output);
-  return base_index;
-}
-
 static int int_vec_contains(const int *values, size_t count, int target) {
   size_t i;
   for (i = 0; i < count; ++i) {
@@ -907,20 +1049,37 @@ static int int_vec_contains(const int *values, size_t count, int target) {
   return 0;
 }
 
-static int get_next_tmux_window_index(const char *session_name) {
-  char *const argv[] = {"tmux", "list-windows", "-t", (char *)session_name,
-                        "-F", "#{window_index}", NULL};
-  int status = 0;
-  char *output = capture_command_output(NULL, argv, &status);
+// list-windows and the base-index lookup go out together and cost one round
+// trip.
+static int get_next_tmux_window_index(TmuxClient *tmux, const char *session_name) {
+  const char *const list_argv[] = {"list-windows", "-t", session_name,
+                                   "-F", "#{window_index}", NULL};
+  const char *const base_argv[] = {"show-options", "-gv", "base-index", NULL};
+  char *output = NULL;
+  char *base_output = NULL;
+  int listed;
+  int base_index = 0;
   int *indexes = NULL;
   size_t count = 0;
   size_t cap = 0;
   int candidate;
   char *cursor;
 
-  if (!output || status != 0) {
+  if (!tmux_client_queue(tmux, list_argv) || !tmux_client_queue(tmux, base_argv)) {
+    (void)tmux_client_sync(tmux);
+    return 0;
+  }
+
+  listed = tmux_client_result(tmux, &output);
+  if (tmux_client_result(tmux, &base_output)) {
+    trim_trailing_newline(base_output);
+    base_index = parse_int_with_default(base_output, 0);
+  }
+  free(base_output);
+
+  if (!listed) {
     free(output);
-    return get_tmux_base_index();
+    return base_index;
   }
 
   cursor = output;
@@ -945,14 +1104,14 @@ static int get_next_tmux_window_index(const char *session_name) {
         if (new_cap < cap) {
           free(indexes);
           free(output);
-          return get_tmux_base_index();
+          return base_index;
         }
 
         new_indexes = realloc(indexes, new_cap * sizeof(*new_indexes));
         if (!new_indexes) {
           free(indexes);
           free(output);
-          return get_tmux_base_index();
+          return base_index;
         }
 
         indexes = new_indexes;
@@ -963,7 +1122,7 @@ static int get_next_tmux_window_index(const char *session_name) {
     }
   }
 
-  candidate = get_tmux_base_index();
+  candidate = base_index;
   while (int_vec_contains(indexes, count, candidate)) {
     candidate++;
   }
@@ -973,287 +1132,1729 @@ static int get_next_tmux_window_index(const char *session_name) {
   return candidate;
 }
 
-static char *get_tmux_default_shell(void) {
-  char *const argv[] = {"tmux", "show-options", "-gv", "default-shell", NULL};
-  int status = 0;
-  char *output = capture_command_output(NULL, argv, &status);
-
-  if (!output || status != 0) {
-    free(output);
-    return xstrdup("sh");
-  }
+static char *get_tmux_default_shell(TmuxClient *tmux) {
+  const char *const argv[] = {"show-options", "-gv", "default-shell", NULL};
+  char *output = tmux_run_single_line(tmux, argv);
 
-  trim_trailing_newline(output);
-  if (output[0] == '\0') {
-    free(output);
+  if (!output) {
     return xstrdup("sh");
   }
-
   return output;
 }
 
-static char *get_tmux_current_window_name(void) {
+static char *get_tmux_current_window_name(TmuxClient **tmux, const char *start_dir) {
   const char *tmux_env = getenv("TMUX");
-  char *const argv[] = {"tmux", "display-message", "-p", "#{window_name}", NULL};
-  int status = 0;
-  char *output;
+  const char *pane = getenv("TMUX_PANE");
 
-  if (!tmux_env || tmux_env[0] == '\0') {
+  if (!tmux_env || tmux_env[0] == '\0' || !tmux_connect(tmux, start_dir)) {
     return NULL;
   }
 
-  output = capture_command_output(NULL, argv, &status);
-  if (!output || status != 0) {
-    free(output);
-    return NULL;
+  if (pane && pane[0] != '\0') {
+    const char *const argv[] = {"display-message", "-p", "-t", pane,
+                                "#{window_name}", NULL};
+    return tmux_run_single_line(*tmux, argv);
+  } else {
+    const char *const argv[] = {"display-message", "-p", "#{window_name}", NULL};
+    return tmux_run_single_line(*tmux, argv);
   }
+}
 
-  trim_trailing_newline(output);
-  if (output[0] == '\0') {
-    free(output);
-    return NULL;
+// The helpers below only queue their command; tmux_client_sync collects the
+// replies once a batch is complete.
+static int tmux_send_keys(TmuxClient *tmux, const char *target, const char *keys) {
+  const char *const argv[] = {"send-keys", "-t", target, keys, "C-m", NULL};
+  return tmux_client_queue(tmux, argv);
+}
+
+static int tmux_resize_pane(TmuxClient *tmux, const char *pane_id, int rows) {
+  char rows_buf[32];
+  const char *const argv[] = {"resize-pane", "-t", pane_id, "-y", rows_buf, NULL};
+  snprintf(rows_buf, sizeof(rows_buf), "%d", rows);
+  return tmux_client_queue(tmux, argv);
+}
+
+static int tmux_select_pane(TmuxClient *tmux, const char *pane_id) {
+  const char *const argv[] = {"select-pane", "-t", pane_id, NULL};
+  return tmux_client_queue(tmux, argv);
+}
+
+static int create_tmux_window(TmuxClient *tmux, const char *session_name,
+                              int target_index, const char *window_name,
+                              int *new_window_index) {
+  char target_buf[128];
+  const char *const argv[] = {"new-window", "-P", "-F", "#{window_index}",
+                              "-d", "-t", target_buf, "-n", window_name, NULL};
+  char *output;
+
+  snprintf(target_buf, sizeof(target_buf), "%s:%d", session_name, target_index);
+  output = tmux_run_single_line(tmux, argv);
+  if (!output) {
+    return 0;
   }
 
-  return output;
+  *new_window_index = parse_int_with_default(output, INT_MIN);
+  free(output);
+
+  return *new_window_index != INT_MIN;
 }
 
-static char *tmux_capture_single_line(const char *target, const char *format,
-                                      const char *subcommand) {
-  char *const argv[] = {"tmux", (char *)subcommand, "-P", "-F", (char *)format,
-                        "-t", (char *)target, "-v", NULL};
-  int status = 0;
-  char *output = capture_command_output(NULL, argv, &status);
-  if (!output || status != 0) {
-    free(output);
+static void start_tmux_shell_pane(TmuxClient *tmux, const char *repo_open_path,
+                                  int window_index, const char *preferred_shell) {
+  char target[128];
+  const char *const display_argv[] = {"display-message", "-p", "-t", target,
+                                      "#{pane_id}", NULL};
+  const char *const split_argv[] = {"split-window", "-P", "-F", "#{pane_id}",
+                                    "-t", target, "-v", NULL};
+  char *existing_pane_id = NULL;
+  char *new_pane_id = NULL;
+  char *cd_command;
+
+  if (!preferred_shell || preferred_shell[0] == '\0') {
+    return;
+  }
+
+  // Replies come back in queue order, so earlier fire-and-forget commands are
+  // collected first. The current pane is then looked up in the same round
+  // trip as the split.
+  snprintf(target, sizeof(target), "%s:%d", MAIN_TMUX_SESSION_NAME, window_index);
+  (void)tmux_client_sync(tmux);
+  if (!tmux_client_queue(tmux, display_argv) || !tmux_client_queue(tmux, split_argv)) {
+    (void)tmux_client_sync(tmux);
+    return;
+  }
+
+  if (tmux_client_result(tmux, &existing_pane_id)) {
+    existing_pane_id[strcspn(existing_pane_id, "\n")] = '\0';
+  }
+  if (tmux_client_result(tmux, &new_pane_id)) {
+    new_pane_id[strcspn(new_pane_id, "\n")] = '\0';
+  }
+
+  if (!existing_pane_id || existing_pane_id[0] == '\0' || !new_pane_id ||
+      new_pane_id[0] == '\0') {
+    free(existing_pane_id);
+    free(new_pane_id);
+    return;
+  }
+
+  if (!tmux_send_keys(tmux, new_pane_id, preferred_shell) ||
+      !tmux_client_sync(tmux)) {
+    free(existing_pane_id);
+    free(new_pane_id);
+    return;
+  }
+
+  if (shell_name_is_powershell(preferred_shell)) {
+    usleep(500000);
+  }
+
+  cd_command = build_shell_cd_command(preferred_shell, repo_open_path);
+  if (!cd_command) {
+    free(existing_pane_id);
+    free(new_pane_id);
+    return;
+  }
+
+  (void)tmux_send_keys(tmux, new_pane_id, cd_command);
+  (void)tmux_send_keys(tmux, new_pane_id, "clear");
+  (void)tmux_resize_pane(tmux, new_pane_id, 20);
+  (void)tmux_select_pane(tmux, existing_pane_id);
+  (void)tmux_client_sync(tmux);
+
+  free(cd_command);
+  free(existing_pane_id);
+  free(new_pane_id);
+}
+
+// Receives candidate names one at a time, whether they go into a vec or are
+// streamed straight into a running picker. Returning 0 stops the producer.
+typedef int (*CandidateFn)(void *ctx, const char *candidate);
+
+static int emit_to_vec(void *ctx, const char *candidate) {
+  return vec_push(ctx, candidate);
+}
+
+static int emit_to_picker(void *ctx, const char *candidate) {
+  return fzfPickerWrite(ctx, candidate);
+}
+
+typedef struct {
+  CandidateFn emit;
+  void *emit_ctx;
+  const StringVec *root_labels;
+  StringBuilder scratch;
+} DiscoveredListing;
+
+static int on_repo_discovered(void *ctx, size_t root_index,
+                              const char *relative_path) {
+  DiscoveredListing *listing = ctx;
+
+  // Repos under the primary root keep their bare relative name; the others
+  // are shown under their root so the name alone is enough to open them.
+  if (root_index == 0) {
+    return listing->emit(listing->emit_ctx, relative_path);
+  }
+
+  listing->scratch.len = 0;
+  if (!path_join(&listing->scratch, listing->root_labels->items[root_index],
+                 relative_path)) {
+    return 0;
+  }
+  return listing->emit(listing->emit_ctx, listing->scratch.data);
+}
+
+static unsigned repo_sort_flags(const OpConfig *config) {
+  return (config->sort_ignore_case ? SORT_IGNORE_CASE : 0u) |
+         (config->sort_natural ? SORT_NATURAL : 0u);
+}
+
+// Produces every repo candidate in listing order: straight out of the mapped
+// index for a flat root, or in discovery order while the roots are walked.
+static int repo_discovery_enabled(const OpConfig *config) {
+  return config->repo_root_count > 0 || config->max_depth > 1;
+}
+
+static int emit_repo_candidates(const OpConfig *config, const StringVec *roots,
+                                const StringVec *root_labels, RepoIndex *index,
+                                CandidateFn emit, void *emit_ctx) {
+  if (repo_discovery_enabled(config)) {
+    DiscoveredListing listing;
+    int ok;
+
+    listing.emit = emit;
+    listing.emit_ctx = emit_ctx;
+    listing.root_labels = root_labels;
+    sb_init(&listing.scratch);
+
+    ok = discover_repos((const char *const *)roots->items, roots->count,
+                        config->max_depth, on_repo_discovered, &listing);
+    sb_free(&listing.scratch);
+    return ok;
+  }
+
+  if (!repo_index_open(roots->items[0], repo_sort_flags(config), index)) {
+    return 0;
+  }
+
+  {
+    size_t i;
+    for (i = 0; i < index->count; ++i) {
+      if (!emit(emit_ctx, repo_index_name(index, i))) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+static char *abbreviate_home(const char *path) {
+  const char *home = getenv("HOME");
+  size_t home_len;
+
+  if (!home || home[0] == '\0') {
+    return xstrdup(path);
+  }
+
+  home_len = strlen(home);
+  while (home_len > 1 && home[home_len - 1] == '/') {
+    home_len--;
+  }
+
+  if (strncmp(path, home, home_len) == 0 &&
+      (path[home_len] == '/' || path[home_len] == '\0')) {
+    StringBuilder sb;
+    sb_init(&sb);
+    if (!sb_append_char(&sb, '~') || !sb_append(&sb, path + home_len)) {
+      sb_free(&sb);
+      return NULL;
+    }
+    return sb_take(&sb);
+  }
+
+  return xstrdup(path);
+}
+
+static int build_repo_roots(const OpConfig *config, const char *repo_dir_abs,
+                            StringVec *roots, StringVec *root_labels) {
+  size_t i;
+
+  vec_init(roots);
+  vec_init(root_labels);
+
+  if (!vec_push(roots, repo_dir_abs) || !vec_push(root_labels, "")) {
+    return 0;
+  }
+
+  for (i = 0; i < config->repo_root_count; ++i) {
+    char *root_abs = make_absolute_path(config->repo_roots[i]);
+    char *label;
+
+    if (!root_abs) {
+      fprintf(stderr, "Failed to expand repo root: %s\n", config->repo_roots[i]);
+      continue;
+    }
+
+    label = abbreviate_home(root_abs);
+    if (!label || !vec_push(roots, root_abs) || !vec_push(root_labels, label)) {
+      free(label);
+      free(root_abs);
+      return 0;
+    }
+
+    free(label);
+    free(root_abs);
+  }
+
+  return 1;
+}
+
+static char *resolve_repo_open_path(const char *repo_dir_abs, const char *name) {
+  if (name[0] == '/' || name[0] == '~') {
+    return make_absolute_path(name);
+  }
+  return join_path(repo_dir_abs, name);
+}
+
+static int repo_name_exists(const OpConfig *config, const char *repo_dir_abs,
+                            const char *name) {
+  struct stat statbuf;
+  char *path;
+  int exists;
+
+  if (findCustomEntry(config, name)) {
+    return 1;
+  }
+
+  path = resolve_repo_open_path(repo_dir_abs, name);
+  if (!path) {
+    return 0;
+  }
+
+  exists = stat(path, &statbuf) == 0 && S_ISDIR(statbuf.st_mode);
+  free(path);
+  return exists;
+}
+
+static int is_keyword(const char *name) {
+  return strcmp(name, CLONE_KEYWORD) == 0 ||
+         strcmp(name, NEW_REPO_KEYWORD) == 0 || strcmp(name, EXIT_KEYWORD) == 0;
+}
+
+// Drops candidates that were already sent ahead of the listing because of
+// their frecency.
+typedef struct {
+  CandidateFn emit;
+  void *emit_ctx;
+  const History *history;
+  const unsigned char *sent;
+  int stopped;
+} UnsentFilter;
+
+static int emit_unsent(void *ctx, const char *candidate) {
+  UnsentFilter *filter = ctx;
+  const HistoryEntry *entry = history_find(filter->history, candidate);
+
+  if (entry && filter->sent[entry - filter->history->entries]) {
+    return 1;
+  }
+  if (!filter->emit(filter->emit_ctx, candidate)) {
+    filter->stopped = 1;
+    return 0;
+  }
+  return 1;
+}
+
+// Produces the picker listing: previously opened repos first, most frecent on
+// top, then every other repo (from listed_repos when the caller already holds
+// them), with the keywords and custom entries last in their configured order.
+static int emit_picker_candidates(const OpConfig *config, const char *repo_dir_abs,
+                                  const StringVec *roots,
+                                  const StringVec *root_labels, RepoIndex *index,
+                                  const StringVec *listed_repos, History *history,
+                                  bool continuous, CandidateFn emit,
+                                  void *emit_ctx) {
+  UnsentFilter filter;
+  unsigned char *sent;
+  int listed = 1;
+  size_t i;
+
+  sent = calloc(history->count > 0 ? history->count : 1, 1);
+  if (!sent) {
+    fprintf(stderr, "Out of memory\n");
+    return 0;
+  }
+
+  filter.emit = emit;
+  filter.emit_ctx = emit_ctx;
+  filter.history = history;
+  filter.sent = sent;
+  filter.stopped = 0;
+
+  history_sort_by_score(history);
+  for (i = 0; i < history->count; ++i) {
+    const char *name = history->entries[i].repo;
+    if (is_keyword(name) || findCustomEntry(config, name) ||
+        !repo_name_exists(config, repo_dir_abs, name)) {
+      continue;
+    }
+    if (!emit(emit_ctx, name)) {
+      free(sent);
+      return 0;
+    }
+    sent[i] = 1;
+  }
+
+  if (listed_repos) {
+    for (i = 0; i < listed_repos->count && !filter.stopped; ++i) {
+      (void)emit_unsent(&filter, listed_repos->items[i]);
+    }
+  } else {
+    listed = emit_repo_candidates(config, roots, root_labels, index, emit_unsent,
+                                  &filter);
+  }
+
+  if (!listed && !filter.stopped) {
+    fprintf(stderr, "Failed to list repos under '%s'\n", roots->items[0]);
+  }
+
+  if (!filter.stopped && emit(emit_ctx, CLONE_KEYWORD) &&
+      emit(emit_ctx, NEW_REPO_KEYWORD)) {
+    for (i = 0; i < config->custom_entry_count && !filter.stopped; ++i) {
+      if (config->custom_entries[i].name) {
+        (void)emit_unsent(&filter, config->custom_entries[i].name);
+      }
+    }
+    if (continuous && !filter.stopped) {
+      (void)emit(emit_ctx, EXIT_KEYWORD);
+    }
+  }
+
+  free(sent);
+  return listed && !filter.stopped;
+}
+
+// Appends " [branch ↑ahead ↓behind age]" (≠ when the histories could not be
+// compared) to repo candidates. Keywords, custom entries and non-repos pass
+// through unchanged.
+typedef struct {
+  CandidateFn emit;
+  void *emit_ctx;
+  const OpConfig *config;
+  const char *repo_dir_abs;
+  GitRefCache *refs;
+  int64_t now;
+  StringBuilder line;
+} DecoratedListing;
+
+static void format_commit_age(char *out, size_t out_size, int64_t commit_time,
+                              int64_t now) {
+  int64_t age = now > commit_time ? now - commit_time : 0;
+
+  if (commit_time <= 0) {
+    out[0] = '\0';
+  } else if (age < 3600) {
+    snprintf(out, out_size, " %lldm", (long long)(age / 60));
+  } else if (age < 86400) {
+    snprintf(out, out_size, " %lldh", (long long)(age / 3600));
+  } else if (age < 86400 * 14) {
+    snprintf(out, out_size, " %lldd", (long long)(age / 86400));
+  } else if (age < 86400 * 60) {
+    snprintf(out, out_size, " %lldw", (long long)(age / (86400 * 7)));
+  } else if (age < 86400 * 365) {
+    snprintf(out, out_size, " %lldmo", (long long)(age / (86400 * 30)));
+  } else {
+    snprintf(out, out_size, " %lldy", (long long)(age / (86400 * 365)));
+  }
+}
+
+// dirty puts a "*" after the branch, as shell prompts do.
+static int append_head_decoration(StringBuilder *sb, const GitHeadInfo *info, bool dirty,
+                                  int64_t now) {
+  char counts[64] = "";
+  char age[32];
+
+  if (info->has_upstream && info->ahead < 0) {
+    snprintf(counts, sizeof(counts), " " DECORATION_DIVERGED);
+  } else if (info->has_upstream && (info->ahead > 0 || info->behind > 0)) {
+    int used = 0;
+    if (info->ahead > 0) {
+      used = snprintf(counts, sizeof(counts), " " DECORATION_AHEAD "%d", info->ahead);
+    }
+    if (info->behind > 0) {
+      snprintf(counts + used, sizeof(counts) - (size_t)used, " " DECORATION_BEHIND "%d",
+               info->behind);
+    }
+  }
+
+  format_commit_age(age, sizeof(age), info->commit_time, now);
+  return sb_append(sb, DECORATION_OPEN) && sb_append(sb, info->head) &&
+         (!dirty || sb_append_char(sb, '*')) && sb_append(sb, counts) &&
+         sb_append(sb, age) && sb_append_char(sb, ']');
+}
+
+static int emit_decorated(void *ctx, const char *candidate) {
+  DecoratedListing *listing = ctx;
+  GitHeadInfo info;
+  char *path;
+  int is_repo;
+
+  if (is_keyword(candidate) || findCustomEntry(listing->config, candidate)) {
+    return listing->emit(listing->emit_ctx, candidate);
+  }
+
+  path = resolve_repo_open_path(listing->repo_dir_abs, candidate);
+  is_repo = path && git_head_info(listing->refs, path, &info);
+  free(path);
+  if (!is_repo) {
+    return listing->emit(listing->emit_ctx, candidate);
+  }
+
+  listing->line.len = 0;
+  if (!sb_append(&listing->line, candidate) ||
+      !append_head_decoration(&listing->line, &info, false, listing->now)) {
+    return 0;
+  }
+  return listing->emit(listing->emit_ctx, listing->line.data);
+}
+
+// DecorateFn for the background pool: the inline decoration plus the dirty
+// marker, which needs a stat of every tracked file and so is only done off
+// the picker's critical path.
+static char *decorate_candidate(void *ctx, const char *candidate) {
+  const DecoratedListing *listing = ctx;
+  GitHeadInfo info;
+  StringBuilder sb;
+  char *path;
+  bool dirty = false;
+  int is_repo;
+
+  if (is_keyword(candidate) || findCustomEntry(listing->config, candidate)) {
     return NULL;
   }
-  trim_trailing_newline(output);
-  if (output[0] == '\0') {
-    free(output);
+
+  path = resolve_repo_open_path(listing->repo_dir_abs, candidate);
+  is_repo = path && git_head_info(listing->refs, path, &info);
+  if (is_repo) {
+    dirty = git_tree_state(path) == GIT_TREE_DIRTY;
+  }
+  free(path);
+  if (!is_repo) {
     return NULL;
   }
-  return output;
+
+  sb_init(&sb);
+  if (!sb_append(&sb, candidate) ||
+      !append_head_decoration(&sb, &info, dirty, listing->now)) {
+    sb_free(&sb);
+    return NULL;
+  }
+  return sb_take(&sb);
 }
 
-static char *tmux_display_single_line(const char *target, const char *format) {
-  char *const argv[] = {"tmux", "display-message", "-p", "-t", (char *)target,
-                        (char *)format, NULL};
-  int status = 0;
-  char *output = capture_command_output(NULL, argv, &status);
-  if (!output || status != 0) {
-    free(output);
+static void decorated_listing_init(DecoratedListing *listing, const OpConfig *config,
+                                   const char *repo_dir_abs, GitRefCache *refs,
+                                   CandidateFn emit, void *emit_ctx) {
+  listing->emit = emit;
+  listing->emit_ctx = emit_ctx;
+  listing->config = config;
+  listing->repo_dir_abs = repo_dir_abs;
+  listing->refs = refs;
+  listing->now = (int64_t)time(NULL);
+  sb_init(&listing->line);
+}
+
+// Cuts a picked line back to the bare candidate name.
+static void strip_repo_decoration(char *selection) {
+  size_t len = strlen(selection);
+  char *separator;
+
+  if (len == 0 || selection[len - 1] != ']') {
+    return;
+  }
+  separator = strrchr(selection, DECORATION_SEPARATOR);
+  if (separator && strncmp(separator, DECORATION_OPEN, sizeof(DECORATION_OPEN) - 1) == 0) {
+    *separator = '\0';
+  }
+}
+
+static char *build_daemon_request(const char *config_path, bool continuous,
+                                  bool decorate) {
+  StringBuilder sb;
+
+  sb_init(&sb);
+  if (!sb_append(&sb, DAEMON_LIST_REQUEST) ||
+      !sb_append(&sb, continuous ? " 1" : " 0") ||
+      !sb_append(&sb, decorate ? " 1 " : " 0 ") ||
+      !sb_append(&sb, config_path)) {
+    sb_free(&sb);
     return NULL;
   }
-  trim_trailing_newline(output);
-  if (output[0] == '\0') {
-    free(output);
+  return sb_take(&sb);
+}
+
+// Asks a running daemon for the prepared listing; returns 0 when there is no
+// daemon (or it serves another config) so the caller lists locally. When
+// lines is given it also receives every listed line.
+static int fetch_listing_from_daemon(const char *config_path, bool continuous,
+                                     bool decorate, FzfPicker *picker,
+                                     StringVec *lines) {
+  char *socket_path;
+  char *request;
+  char *response = NULL;
+  size_t response_len = 0;
+  size_t ok_len = sizeof(DAEMON_OK_LINE) - 1;
+
+  socket_path = daemon_socket_path();
+  request = build_daemon_request(config_path, continuous, decorate);
+  if (socket_path && request) {
+    response = daemon_request(socket_path, request, &response_len);
+  }
+  free(socket_path);
+  free(request);
+
+  if (!response || response_len < ok_len ||
+      memcmp(response, DAEMON_OK_LINE, ok_len) != 0) {
+    free(response);
+    return 0;
+  }
+
+  (void)fzfPickerWriteBlock(picker, response + ok_len, response_len - ok_len);
+
+  // The response already is one packed block of lines; keep it as they are.
+  if (lines) {
+    (void)vec_adopt_lines(lines, response, ok_len, response_len);
+  } else {
+    free(response);
+  }
+  return 1;
+}
+
+// Feeds the picker and keeps a copy of every line for the background
+// decoration.
+typedef struct {
+  FzfPicker *picker;
+  StringVec *lines;
+} ListingTee;
+
+static int emit_to_picker_and_vec(void *ctx, const char *candidate) {
+  ListingTee *tee = ctx;
+  return vec_push(tee->lines, candidate) && fzfPickerWrite(tee->picker, candidate);
+}
+
+typedef struct {
+  const FzfListen *listen;
+  char *action;
+} PickerReload;
+
+static int post_picker_reload(void *ctx) {
+  PickerReload *reload = ctx;
+  return fzfPostAction(reload->listen, reload->action);
+}
+
+// reload(<op> --emit-candidates <listing>), run by fzf through $SHELL.
+static char *build_reload_action(const char *listing_path) {
+  char *executable_path = get_current_executable_path();
+  char *quoted_executable = executable_path ? quote_for_posix_single(executable_path) : NULL;
+  char *quoted_listing = quote_for_posix_single(listing_path);
+  StringBuilder sb;
+
+  sb_init(&sb);
+  if (!quoted_executable || !quoted_listing || !sb_append(&sb, "reload(") ||
+      !sb_append(&sb, quoted_executable) || !sb_append(&sb, " --emit-candidates ") ||
+      !sb_append(&sb, quoted_listing) || !sb_append_char(&sb, ')')) {
+    sb_free(&sb);
+  }
+  free(executable_path);
+  free(quoted_executable);
+  free(quoted_listing);
+  return sb.data ? sb_take(&sb) : NULL;
+}
+
+// `op --emit-candidates <listing>`: what fzf's reload runs. Prints the
+// listing as the background decoration last published it.
+static int emit_candidates_file(const char *listing_path) {
+  char buffer[65536];
+  size_t got;
+  FILE *listing = fopen(listing_path, "r");
+
+  if (!listing) {
+    perror(listing_path);
+    return 1;
+  }
+  while ((got = fread(buffer, 1, sizeof(buffer), listing)) > 0) {
+    if (fwrite(buffer, 1, got, stdout) != got) {
+      break;
+    }
+  }
+  fclose(listing);
+  return fflush(stdout) == 0 ? 0 : 1;
+}
+
+// Fills the running picker with bare names, then decorates them on a thread
+// pool and pushes each refreshed listing into fzf through its --listen port.
+static void list_and_decorate_async(const OpConfig *config, const char *config_path,
+                                    const char *repo_dir_abs, const StringVec *roots,
+                                    const StringVec *root_labels, RepoIndex *index,
+                                    History *history, bool continuous, bool use_daemon,
+                                    FzfPicker *picker, const FzfListen *listen,
+                                    DecoratedListing *listing, StringVec *lines,
+                                    PickerReload *reload, char **listing_path,
+                                    DecorationRun **run) {
+  char file_name[64];
+
+  if (!use_daemon ||
+      !fetch_listing_from_daemon(config_path, continuous, false, picker, lines)) {
+    ListingTee tee;
+
+    tee.picker = picker;
+    tee.lines = lines;
+    (void)history_load(history);
+    (void)emit_picker_candidates(config, repo_dir_abs, roots, root_labels, index,
+                                 NULL, history, continuous, emit_to_picker_and_vec, &tee);
+  }
+  fzfPickerCloseInput(picker);
+
+  snprintf(file_name, sizeof(file_name), "picker-%ld.list", (long)getpid());
+  *listing_path = get_runtime_file_path(file_name);
+  reload->listen = listen;
+  reload->action = *listing_path ? build_reload_action(*listing_path) : NULL;
+  if (!reload->action) {
+    return;
+  }
+
+  *run = decoration_start((const char *const *)lines->items, lines->count,
+                          decorate_candidate, listing, *listing_path, post_picker_reload,
+                          reload);
+}
+
+// Opens fzf before anything is listed and streams candidates into it, so the
+// picker is usable while a large root is still being scanned. expect and
+// header are the --expect and --header arguments; *key is set to the key the
+// pick was accepted with ("" for Enter) and shares the returned block.
+static char *pick_repo(const OpConfig *config, const char *config_path,
+                       const char *repo_dir_abs, const StringVec *roots,
+                       const StringVec *root_labels, RepoIndex *index,
+                       History *history, GitRefCache *refs, bool continuous,
+                       bool use_daemon, const char *expect, const char *header,
+                       char **key) {
+  // Only the name is searched, not the branch decoration after it.
+  const char *fzf_args[] = {"--delimiter", "\t", "--nth", "1", "--tabstop", "1", expect,
+                            header, NULL};
+  FzfListen listen;
+  int listening =
+      config->async_decorations && fzfSupportsListen() && fzfListenReserve(&listen);
+  DecoratedListing listing;
+  DecorationRun *run = NULL;
+  PickerReload reload = {NULL, NULL};
+  char *listing_path = NULL;
+  StringVec lines;
+  FzfPicker *picker;
+  char *selection;
+
+  *key = NULL;
+  picker = fzfPickerOpenListening("op native > ", fzf_args, listening ? &listen : NULL);
+  if (!picker) {
+    return NULL;
+  }
+
+  vec_init(&lines);
+  decorated_listing_init(&listing, config, repo_dir_abs, refs, emit_to_picker, picker);
+  if (listening) {
+    list_and_decorate_async(config, config_path, repo_dir_abs, roots, root_labels, index,
+                            history, continuous, use_daemon, picker, &listen, &listing,
+                            &lines, &reload, &listing_path, &run);
+  } else if (!use_daemon ||
+             !fetch_listing_from_daemon(config_path, continuous, true, picker, NULL)) {
+    (void)history_load(history);
+    (void)emit_picker_candidates(config, repo_dir_abs, roots, root_labels, index,
+                                 NULL, history, continuous, emit_decorated, &listing);
+  }
+
+  selection = fzfPickerFinishWithKey(picker, key);
+
+  decoration_stop(run);
+  if (listing_path) {
+    size_t path_len = strlen(listing_path);
+    char *temp_path = malloc(path_len + 5);
+    unlink(listing_path);
+    if (temp_path) {
+      memcpy(temp_path, listing_path, path_len);
+      memcpy(temp_path + path_len, ".tmp", 5);
+      unlink(temp_path);
+      free(temp_path);
+    }
+  }
+  free(listing_path);
+  free(reload.action);
+  vec_free(&lines);
+  sb_free(&listing.line);
+  return selection;
+}
+
+typedef enum {
+  ACTION_NVIM_TMUX,
+  ACTION_NVIM,
+  ACTION_CD_HERE,
+  ACTION_CODE,
+  ACTION_CUSTOM_COMMAND,
+  ACTION_NEW_WORKTREE,
+} ActionKind;
+
+typedef struct {
+  const char *name;
+  ActionKind kind;
+  const OpCustomCommand *command; // ACTION_CUSTOM_COMMAND only
+  CommandTemplate *tmpl;          // custom commands and new-worktree
+  const char *key;                // repo picker key that runs it, NULL if none
+} Action;
+
+// The actions offered after a repo is picked, in menu order, with an
+// open-addressing index over their names. Built once per config, so a
+// selection resolves without walking the builtins and custom commands.
+typedef struct {
+  Action *actions;
+  size_t count;
+  uint32_t *slots; // action position + 1, 0 when empty
+  size_t slot_count;
+  char *menu; // fzf input, one name per line
+  // The repo picker accepts with any bound key (--expect) and says which key
+  // runs what in its header, so a keyed pick skips the action menu.
+  const Action *enter; // run on Enter, NULL to open the menu
+  char *picker_expect;
+  char *picker_header;
+} ActionTable;
+
+static void action_table_init(ActionTable *table) { memset(table, 0, sizeof(*table)); }
+
+static void action_table_free(ActionTable *table) {
+  size_t i;
+
+  for (i = 0; i < table->count; ++i) {
+    template_free(table->actions[i].tmpl);
+  }
+  free(table->actions);
+  free(table->slots);
+  free(table->menu);
+  free(table->picker_expect);
+  free(table->picker_header);
+  action_table_init(table);
+}
+
+// A name already in the index keeps its action, so insertion order is the
+// precedence order.
+static void action_table_index(ActionTable *table, size_t position) {
+  const char *name = table->actions[position].name;
+  size_t slot = fnv1a(name) & (table->slot_count - 1);
+
+  while (table->slots[slot] != 0) {
+    if (strcmp(table->actions[table->slots[slot] - 1].name, name) == 0) {
+      return;
+    }
+    slot = (slot + 1) & (table->slot_count - 1);
+  }
+  table->slots[slot] = (uint32_t)position + 1;
+}
+
+// The action the repo picker was accepted with: the first bound to key, or
+// the Enter action when key is empty.
+static const Action *action_table_find_key(const ActionTable *table, const char *key) {
+  size_t i;
+
+  if (!key || key[0] == '\0') {
+    return table->enter;
+  }
+  for (i = 0; i < table->count; ++i) {
+    if (table->actions[i].key && strcmp(table->actions[i].key, key) == 0) {
+      return &table->actions[i];
+    }
+  }
+  return NULL;
+}
+
+static const Action *action_table_find(const ActionTable *table, const char *name) {
+  size_t slot;
+
+  if (table->slot_count == 0) {
     return NULL;
   }
-  return output;
-}
+  slot = fnv1a(name) & (table->slot_count - 1);
+  while (table->slots[slot] != 0) {
+    const Action *action = &table->actions[table->slots[slot] - 1];
+    if (strcmp(action->name, name) == 0) {
+      return action;
+    }
+    slot = (slot + 1) & (table->slot_count - 1);
+  }
+  return NULL;
+}
+
+// Builds the repo picker's --expect list and header from the bound keys. A
+// custom command's key takes over a builtin's default binding; between
+// custom commands the first keeps it and the others are reported.
+static int action_table_bind_keys(ActionTable *table, const OpConfig *config) {
+  StringBuilder expect;
+  StringBuilder header;
+  size_t i;
+  size_t j;
+  int ok = 1;
+
+  for (i = 0; i < table->count; ++i) {
+    if (table->actions[i].kind != ACTION_CUSTOM_COMMAND || !table->actions[i].key) {
+      continue;
+    }
+    for (j = 0; j < table->count; ++j) {
+      if (table->actions[j].kind != ACTION_CUSTOM_COMMAND && table->actions[j].key &&
+          strcmp(table->actions[j].key, table->actions[i].key) == 0) {
+        table->actions[j].key = NULL;
+      }
+    }
+  }
+
+  if (config->enter_action) {
+    table->enter = action_table_find(table, config->enter_action);
+    if (!table->enter) {
+      fprintf(stderr, "enterAction '%s' is not an action; Enter opens the menu\n",
+              config->enter_action);
+    }
+  }
+
+  sb_init(&expect);
+  sb_init(&header);
+  ok = sb_append(&expect, "--expect=") && sb_append(&header, "--header=enter: ") &&
+       sb_append(&header, table->enter ? table->enter->name : "actions");
+  for (i = 0; i < table->count && ok; ++i) {
+    const Action *action = &table->actions[i];
+    const Action *bound;
+    if (!action->key) {
+      continue;
+    }
+    bound = action_table_find_key(table, action->key);
+    if (bound != action) {
+      fprintf(stderr, "Key '%s' of '%s' is already bound to '%s'; ignoring it\n",
+              action->key, action->name, bound->name);
+      continue;
+    }
+    ok = (expect.len == strlen("--expect=") || sb_append_char(&expect, ',')) &&
+         sb_append(&expect, action->key) && sb_append(&header, "  ") &&
+         sb_append(&header, action->key) && sb_append(&header, ": ") &&
+         sb_append(&header, action->name);
+  }
+  if (!ok) {
+    sb_free(&expect);
+    sb_free(&header);
+    return 0;
+  }
+  table->picker_expect = sb_take(&expect);
+  table->picker_header = sb_take(&header);
+  return table->picker_expect && table->picker_header;
+}
+
+static int action_table_build(ActionTable *table, const OpConfig *config) {
+  static const Action builtins[] = {
+      {"nvim-tmux", ACTION_NVIM_TMUX, NULL, NULL, NULL},
+      {"nvim", ACTION_NVIM, NULL, NULL, NULL},
+      {"cd-here", ACTION_CD_HERE, NULL, NULL, "ctrl-t"},
+      {"code", ACTION_CODE, NULL, NULL, "ctrl-o"},
+  };
+  size_t builtin_count = sizeof(builtins) / sizeof(builtins[0]);
+  size_t capacity = builtin_count + config->custom_command_count + 1;
+  StringBuilder menu;
+  size_t i;
+
+  action_table_init(table);
+  table->actions = calloc(capacity, sizeof(*table->actions));
+  for (table->slot_count = 1; table->slot_count < capacity * 2; table->slot_count <<= 1) {
+  }
+  table->slots = calloc(table->slot_count, sizeof(*table->slots));
+  if (!table->actions || !table->slots) {
+    action_table_free(table);
+    return 0;
+  }
+
+  for (i = 0; i < builtin_count; ++i) {
+    // A server has no desktop to open VS Code on.
+    if (builtins[i].kind == ACTION_CODE && config->is_server) {
+      continue;
+    }
+    table->actions[table->count++] = builtins[i];
+  }
+  for (i = 0; i < config->custom_command_count; ++i) {
+    if (config->custom_commands[i].name) {
+      Action *action = &table->actions[table->count++];
+      action->name = config->custom_commands[i].name;
+      action->kind = ACTION_CUSTOM_COMMAND;
+      action->command = &config->custom_commands[i];
+      action->key = config->custom_commands[i].key;
+      action->tmpl = template_compile(config->custom_commands[i].command
+                                          ? config->custom_commands[i].command
+                                          : "");
+      if (!action->tmpl) {
+        action_table_free(table);
+        return 0;
+      }
+    }
+  }
+  table->actions[table->count].name = BUILTIN_NEW_WORKTREE.name;
+  table->actions[table->count].kind = ACTION_NEW_WORKTREE;
+  table->actions[table->count].tmpl = template_compile(BUILTIN_NEW_WORKTREE.command);
+  if (!table->actions[table->count++].tmpl) {
+    action_table_free(table);
+    return 0;
+  }
+
+  sb_init(&menu);
+  for (i = 0; i < table->count; ++i) {
+    action_table_index(table, i);
+    if (!sb_append(&menu, table->actions[i].name) || !sb_append_char(&menu, '\n')) {
+      sb_free(&menu);
+      action_table_free(table);
+      return 0;
+    }
+  }
+  table->menu = sb_take(&menu);
+  if (!table->menu || !action_table_bind_keys(table, config)) {
+    action_table_free(table);
+    return 0;
+  }
+  return 1;
+}
+
+// What the {{variables}} in a command template can refer to.
+typedef struct {
+  const char *repo_open_path;
+  const char *selected_name;
+  const char *op_root;
+  const StringVec *roots;
+  GitRefCache *refs; // shared with the picker decorations
+} TemplateContext;
+
+// The configured root the repo lives under, else its parent directory.
+static char *containing_repo_root(const char *repo_open_path, const StringVec *roots) {
+  const char *best = NULL;
+  size_t best_len = 0;
+  size_t i;
+
+  for (i = 0; i < roots->count; ++i) {
+    size_t len = strlen(roots->items[i]);
+    if (len > best_len && strncmp(repo_open_path, roots->items[i], len) == 0 &&
+        repo_open_path[len] == '/') {
+      best = roots->items[i];
+      best_len = len;
+    }
+  }
+  return best ? xstrdup(best) : dirname_copy(repo_open_path);
+}
+
+// Looks up only the variables tmpl references, so a template without
+// {{branch}} or {{remote}} never touches .git. Values are double-quoted for a
+// shell unless quote is false (direct exec). Returns 0 when one is missing.
+static int template_values(const CommandTemplate *tmpl, const TemplateContext *context,
+                           bool quote, char *owned[TEMPLATE_VAR_COUNT],
+                           const char *values[TEMPLATE_VAR_COUNT]) {
+  unsigned used = template_variables(tmpl);
+  GitHeadInfo head;
+  int have_head = 0;
+  int var;
+
+  if (used & ((1u << TEMPLATE_VAR_BRANCH) | (1u << TEMPLATE_VAR_REMOTE))) {
+    have_head = git_head_info(context->refs, context->repo_open_path, &head);
+  }
+  if (used & (1u << TEMPLATE_VAR_PATH)) {
+    values[TEMPLATE_VAR_PATH] = context->repo_open_path;
+  }
+  if (used & (1u << TEMPLATE_VAR_OPROOT)) {
+    values[TEMPLATE_VAR_OPROOT] = context->op_root;
+  }
+  if (used & (1u << TEMPLATE_VAR_NAME)) {
+    values[TEMPLATE_VAR_NAME] = context->selected_name;
+  }
+  if (used & (1u << TEMPLATE_VAR_BRANCH)) {
+    values[TEMPLATE_VAR_BRANCH] = have_head ? head.head : "";
+  }
+  if (used & (1u << TEMPLATE_VAR_REMOTE)) {
+    values[TEMPLATE_VAR_REMOTE] = have_head ? head.remote : "";
+  }
+  if (used & (1u << TEMPLATE_VAR_ROOT)) {
+    owned[TEMPLATE_VAR_ROOT] = containing_repo_root(context->repo_open_path, context->roots);
+    values[TEMPLATE_VAR_ROOT] = owned[TEMPLATE_VAR_ROOT];
+  }
+
+  for (var = 0; var < TEMPLATE_VAR_COUNT; ++var) {
+    if (!(used & (1u << var))) {
+      continue;
+    }
+    if (!values[var]) {
+      return 0;
+    }
+    // {{oproot}} has always been inserted as typed.
+    if (quote && var != TEMPLATE_VAR_OPROOT) {
+      char *quoted = quote_for_double(values[var]);
+      if (!quoted) {
+        return 0;
+      }
+      free(owned[var]);
+      owned[var] = quoted;
+      values[var] = quoted;
+    }
+  }
+  return 1;
+}
+
+// Runs a command line in the kept-warm shell for its mode, starting that on
+// first use, or in a fresh one when none can be had.
+static int run_in_warm_shell(ShellCoprocess **warm_shell, bool login,
+                             const char *working_dir, const char *command) {
+  int status;
+
+  if (!*warm_shell) {
+    *warm_shell = shell_coprocess_start(login);
+  }
+  if (!*warm_shell) {
+    char *const argv[] = {"/bin/sh", login ? "-lc" : "-c", (char *)command, NULL};
+    return run_command_in_dir(working_dir, argv);
+  }
+
+  status = shell_coprocess_run(*warm_shell, working_dir, command);
+  if (status < 0) {
+    // It died (or could not be written to); the next command starts another.
+    fprintf(stderr, "Shell for '%s' exited unexpectedly\n", command);
+    shell_coprocess_stop(*warm_shell);
+    *warm_shell = NULL;
+  }
+  return status;
+}
+
+// warm_shells holds the kept-warm shells for OP_SHELL_SH and the login
+// shell (indexed by login), or is NULL to start one per command.
+static int execute_named_command(const char *name, const CommandTemplate *tmpl,
+                                 bool run_in_preferred_shell, OpShellMode shell,
+                                 const TemplateContext *context,
+                                 const char *preferred_shell,
+                                 ShellCoprocess **warm_shells) {
+  char *owned[TEMPLATE_VAR_COUNT] = {NULL};
+  const char *values[TEMPLATE_VAR_COUNT] = {NULL};
+  // Raw values keep going through a shell under "auto", so a command does not
+  // change meaning just because it has no shell syntax of its own.
+  bool direct = !run_in_preferred_shell && template_is_direct(tmpl) &&
+                (shell == OP_SHELL_NONE ||
+                 (shell == OP_SHELL_AUTO && !template_inserts_raw(tmpl)));
+  char *final_command = NULL;
+  char **argv = NULL;
+  int status = -1;
+  int var;
+
+  if (!run_in_preferred_shell && shell == OP_SHELL_NONE && !direct) {
+    fprintf(stderr,
+            "Command '%s' uses shell syntax; drop \"shell\": \"none\" to run it\n", name);
+    return -1;
+  }
+  if (!template_values(tmpl, context, !direct, owned, values)) {
+    goto cleanup;
+  }
+
+  // A plain command line needs no shell: skip the sh startup (and the login
+  // profile it would source) and exec the program itself.
+  if (direct) {
+    argv = template_render_argv(tmpl, values);
+    if (argv) {
+      status = run_command_in_dir(context->repo_open_path, argv);
+    }
+    goto cleanup;
+  }
+
+  final_command = template_render(tmpl, values);
+  if (!final_command) {
+    goto cleanup;
+  }
+  if (run_in_preferred_shell) {
+    status = invoke_here_in_preferred_shell(preferred_shell, final_command,
+                                            context->repo_open_path);
+  } else if (warm_shells) {
+    bool login = shell != OP_SHELL_SH;
+    status = run_in_warm_shell(&warm_shells[login], login, context->repo_open_path,
+                               final_command);
+  } else if (shell == OP_SHELL_SH) {
+    char *const sh_argv[] = {"/bin/sh", "-c", final_command, NULL};
+    status = run_command_in_dir(context->repo_open_path, sh_argv);
+  } else {
+    status = run_shell_command_in_dir(context->repo_open_path, final_command);
+  }
+
+cleanup:
+  free(final_command);
+  free(argv);
+  for (var = 0; var < TEMPLATE_VAR_COUNT; ++var) {
+    free(owned[var]);
+  }
+  return status;
+}
+
+typedef struct {
+  double score;
+  size_t position;
+} FrecencyKey;
+
+static int compare_frecency_keys(const void *left, const void *right) {
+  const FrecencyKey *a = left;
+  const FrecencyKey *b = right;
+
+  if (a->score != b->score) {
+    return a->score > b->score ? -1 : 1;
+  }
+  return a->position < b->position ? -1 : a->position > b->position;
+}
+
+// Stable reorder of vec by frecency; names never opened keep their relative
+// listing order behind the ones that were.
+static int order_by_frecency(StringVec *vec, const History *history) {
+  FrecencyKey *keys;
+  char **ordered;
+  size_t i;
+
+  if (history->count == 0 || vec->count < 2) {
+    return 1;
+  }
+
+  keys = malloc(vec->count * sizeof(*keys));
+  ordered = malloc(vec->count * sizeof(*ordered));
+  if (!keys || !ordered) {
+    free(keys);
+    free(ordered);
+    return 0;
+  }
+
+  for (i = 0; i < vec->count; ++i) {
+    const HistoryEntry *entry = history_find(history, vec->items[i]);
+    keys[i].score = entry ? entry->score : 0.0;
+    keys[i].position = i;
+  }
+
+  qsort(keys, vec->count, sizeof(*keys), compare_frecency_keys);
+  for (i = 0; i < vec->count; ++i) {
+    ordered[i] = vec->items[keys[i].position];
+  }
+  memcpy(vec->items, ordered, vec->count * sizeof(*ordered));
+
+  free(keys);
+  free(ordered);
+  return 1;
+}
+
+// Gathers every openable name (repos and custom entries, no keywords) for
+// in-process matching. Repos come most frecent first so ties rank by use; the
+// custom entries follow in their configured order. Names from the mapped
+// index are borrowed, not copied.
+static int collect_repo_candidates(const OpConfig *config, const StringVec *roots,
+                                   const StringVec *root_labels, RepoIndex *index,
+                                   const History *history, StringVec *output) {
+  size_t i;
+
+  vec_init(output);
+
+  if (repo_discovery_enabled(config)) {
+    if (!emit_repo_candidates(config, roots, root_labels, index, emit_to_vec,
+                              output)) {
+      vec_free(output);
+      return 0;
+    }
+  } else {
+    if (!repo_index_open(roots->items[0], repo_sort_flags(config), index) ||
+        !vec_reserve(output, index->count + config->custom_entry_count)) {
+      vec_free(output);
+      return 0;
+    }
+    for (i = 0; i < index->count; ++i) {
+      (void)vec_push_borrowed(output, repo_index_name(index, i));
+    }
+  }
+
+  if (!order_by_frecency(output, history)) {
+    vec_free(output);
+    return 0;
+  }
+
+  for (i = 0; i < config->custom_entry_count; ++i) {
+    if (config->custom_entries[i].name &&
+        !vec_push(output, config->custom_entries[i].name)) {
+      vec_free(output);
+      return 0;
+    }
+  }
 
-static int tmux_send_keys(const char *target, const char *keys) {
-  char *const argv[] = {"tmux", "send-keys", "-t", (char *)target, (char *)keys,
-                        "C-m", NULL};
-  return run_command_in_dir(NULL, argv) == 0;
+  return 1;
 }
 
-static int tmux_resize_pane(const char *pane_id, int rows) {
-  char rows_buf[32];
-  char *const argv[] = {"tmux", "resize-pane", "-t", (char *)pane_id, "-y",
-                        rows_buf, NULL};
-  snprintf(rows_buf, sizeof(rows_buf), "%d", rows);
-  return run_command_in_dir(NULL, argv) == 0;
-}
+// Ranks candidates against query; returns the number of matches written to
+// *out (best first), or -1 on failure.
+static long rank_candidates(const char *query, const StringVec *candidates,
+                            FuzzyMatch **out) {
+  FuzzyMatcher matcher;
+  FuzzyMatch *matches;
+  size_t matched;
+
+  *out = NULL;
+  matches = malloc((candidates->count > 0 ? candidates->count : 1) *
+                   sizeof(*matches));
+  if (!matches || !fuzzy_matcher_init(&matcher, query)) {
+    free(matches);
+    return -1;
+  }
 
-static int tmux_select_pane(const char *pane_id) {
-  char *const argv[] = {"tmux", "select-pane", "-t", (char *)pane_id, NULL};
-  return run_command_in_dir(NULL, argv) == 0;
+  matched = fuzzy_rank(&matcher, (const char *const *)candidates->items,
+                       candidates->count, matches);
+  fuzzy_matcher_free(&matcher);
+  *out = matches;
+  return (long)matched;
 }
 
-static int create_tmux_window(const char *session_name, int target_index,
-                              const char *window_name, int *new_window_index) {
-  char target_buf[128];
-  char *const argv[] = {"tmux", "new-window", "-P", "-F", "#{window_index}",
-                        "-d", "-t", target_buf, "-n", (char *)window_name, NULL};
-  int status = 0;
-  char *output;
+static char *resolve_repo_directory(const OpConfig *config) {
+  char *expanded;
+  char *absolute;
 
-  snprintf(target_buf, sizeof(target_buf), "%s:%d", session_name, target_index);
-  output = capture_command_output(NULL, argv, &status);
-  if (!output || status != 0) {
-    free(output);
-    return 0;
+  expanded = expand_tilde(config->repo_directory);
+  if (!expanded) {
+    fprintf(stderr, "Failed to expand repo directory: %s\n", config->repo_directory);
+    return NULL;
   }
 
-  trim_trailing_newline(output);
-  *new_window_index = parse_int_with_default(output, INT_MIN);
-  free(output);
+  absolute = make_absolute_path(expanded);
+  free(expanded);
+  if (!absolute) {
+    fprintf(stderr, "Failed to build absolute repo directory path\n");
+  }
+  return absolute;
+}
 
-  return *new_window_index != INT_MIN;
+// Everything the daemon keeps warm between requests. The repo listing is
+// rebuilt only after inotify reports a change under one of the roots.
+typedef struct {
+  const char *config_path;
+  struct timespec config_mtime;
+  OpConfig *config;
+  char *repo_dir_abs;
+  StringVec roots;
+  StringVec root_labels;
+  RepoIndex index;
+  StringVec repos;
+  bool have_repos;
+  History history;
+  GitRefCache *refs;
+} DaemonState;
+
+static void daemon_state_release_config(DaemonState *state) {
+  vec_free(&state->roots);
+  vec_free(&state->root_labels);
+  free(state->repo_dir_abs);
+  freeConfig(state->config);
+  state->repo_dir_abs = NULL;
+  state->config = NULL;
 }
 
-static void start_tmux_shell_pane(const char *repo_open_path, int window_index,
-                                  const char *preferred_shell) {
-  char target[128];
-  char *existing_pane_id;
-  char *new_pane_id;
-  char *cd_command;
+// Reloads config.json when its mtime moved; a broken edit keeps the last good
+// config in place.
+static int daemon_refresh_config(DaemonState *state) {
+  struct stat statbuf;
+  OpConfig *config;
+  char *repo_dir_abs;
+  StringVec roots;
+  StringVec root_labels;
 
-  if (!preferred_shell || preferred_shell[0] == '\0') {
-    return;
+  if (stat(state->config_path, &statbuf) != 0) {
+    return state->config != NULL;
   }
 
-  snprintf(target, sizeof(target), "%s:%d", MAIN_TMUX_SESSION_NAME, window_index);
-  existing_pane_id = tmux_display_single_line(target, "#{pane_id}");
-  if (!existing_pane_id) {
-    return;
+  if (state->config &&
+      statbuf.st_mtim.tv_sec == state->config_mtime.tv_sec &&
+      statbuf.st_mtim.tv_nsec == state->config_mtime.tv_nsec) {
+    return 1;
   }
 
-  new_pane_id = tmux_capture_single_line(target, "#{pane_id}", "split-window");
-  if (!new_pane_id) {
-    free(existing_pane_id);
-    return;
+  config = loadConfigs(state->config_path);
+  if (!config) {
+    return state->config != NULL;
   }
 
-  if (!tmux_send_keys(new_pane_id, preferred_shell)) {
-    free(existing_pane_id);
-    free(new_pane_id);
-    return;
+  repo_dir_abs = resolve_repo_directory(config);
+  if (!repo_dir_abs || !build_repo_roots(config, repo_dir_abs, &roots, &root_labels)) {
+    if (repo_dir_abs) {
+      vec_free(&roots);
+      vec_free(&root_labels);
+    }
+    free(repo_dir_abs);
+    freeConfig(config);
+    return state->config != NULL;
   }
 
-  if (shell_name_is_powershell(preferred_shell)) {
-    usleep(500000);
+  daemon_state_release_config(state);
+  state->config = config;
+  state->repo_dir_abs = repo_dir_abs;
+  state->roots = roots;
+  state->root_labels = root_labels;
+  state->config_mtime = statbuf.st_mtim;
+  state->have_repos = false;
+  return 1;
+}
+
+// Watches every root, plus each directory between a root and the repos found
+// below it when discovery goes deeper than one level.
+static void daemon_watch_repo_tree(DaemonState *state, OpDaemon *daemon) {
+  char *last_watched = NULL;
+  size_t shortest_root = SIZE_MAX;
+  size_t i;
+
+  for (i = 0; i < state->roots.count; ++i) {
+    size_t len = strlen(state->roots.items[i]);
+    if (!daemon_watch(daemon, state->roots.items[i])) {
+      fprintf(stderr, "Failed to watch '%s'\n", state->roots.items[i]);
+    }
+    if (len < shortest_root) {
+      shortest_root = len;
+    }
   }
 
-  cd_command = build_shell_cd_command(preferred_shell, repo_open_path);
-  if (!cd_command) {
-    free(existing_pane_id);
-    free(new_pane_id);
+  if (state->config->max_depth <= 1) {
     return;
   }
 
-  (void)tmux_send_keys(new_pane_id, cd_command);
-  (void)tmux_send_keys(new_pane_id, "clear");
-  (void)tmux_resize_pane(new_pane_id, 20);
-  (void)tmux_select_pane(existing_pane_id);
+  // Repos sharing a parent are listed together, so comparing against the
+  // previous parent skips most redundant inotify_add_watch calls.
+  for (i = 0; i < state->repos.count; ++i) {
+    char *path = resolve_repo_open_path(state->repo_dir_abs, state->repos.items[i]);
+    char *slash = path ? strrchr(path, '/') : NULL;
 
-  free(cd_command);
-  free(existing_pane_id);
-  free(new_pane_id);
-}
+    if (!slash) {
+      free(path);
+      continue;
+    }
+    *slash = '\0';
 
-static int build_directory_listing(const char *directory, StringVec *output) {
-  DIR *dir;
-  struct dirent *entry;
+    if (last_watched && strcmp(last_watched, path) == 0) {
+      free(path);
+      continue;
+    }
 
-  vec_init(output);
+    free(last_watched);
+    last_watched = xstrdup(path);
+    while (strlen(path) > shortest_root) {
+      (void)daemon_watch(daemon, path);
+      slash = strrchr(path, '/');
+      if (!slash) {
+        break;
+      }
+      *slash = '\0';
+    }
+    free(path);
+  }
+  free(last_watched);
+}
 
-  dir = opendir(directory);
-  if (!dir) {
-    perror("opendir");
-    return 0;
+static int daemon_refresh_repos(DaemonState *state, OpDaemon *daemon) {
+  if (!daemon_take_changes(daemon) && state->have_repos) {
+    return 1;
   }
 
-  while ((entry = readdir(dir)) != NULL) {
-    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-      continue;
-    }
+  vec_free(&state->repos);
+  vec_init(&state->repos);
+  state->have_repos = false;
 
-    if (!vec_push(output, entry->d_name)) {
-      closedir(dir);
-      vec_free(output);
-      return 0;
-    }
+  if (!daemon_unwatch_all(daemon)) {
+    return 0;
   }
 
-  closedir(dir);
-  if (output->count > 1) {
-    qsort(output->items, output->count, sizeof(*output->items), compare_strings);
+  if (!emit_repo_candidates(state->config, &state->roots, &state->root_labels,
+                            &state->index, emit_to_vec, &state->repos)) {
+    fprintf(stderr, "Failed to list repos under '%s'\n", state->repo_dir_abs);
+    return 0;
   }
 
+  daemon_watch_repo_tree(state, daemon);
+  state->have_repos = true;
   return 1;
 }
 
-static char *build_fzf_input_from_vec(const StringVec *vec) {
-  size_t i;
+static int emit_to_builder(void *ctx, const char *candidate) {
+  return sb_append(ctx, candidate) && sb_append_char(ctx, '\n');
+}
+
+// Serves "op1-list <continuous> <decorate> <config path>" with "OK" and the finished
+// picker listing. Requests for another config are refused so the client
+// lists locally.
+static char *handle_daemon_request(void *ctx, OpDaemon *daemon,
+                                   const char *request, size_t *response_len) {
+  DaemonState *state = ctx;
+  size_t prefix_len = strlen(DAEMON_LIST_REQUEST);
+  DecoratedListing listing;
+  bool continuous;
+  bool decorate;
   StringBuilder sb;
 
+  if (strncmp(request, DAEMON_LIST_REQUEST, prefix_len) != 0 ||
+      request[prefix_len] != ' ' ||
+      (request[prefix_len + 1] != '0' && request[prefix_len + 1] != '1') ||
+      request[prefix_len + 2] != ' ' ||
+      (request[prefix_len + 3] != '0' && request[prefix_len + 3] != '1') ||
+      request[prefix_len + 4] != ' ' ||
+      strcmp(request + prefix_len + 5, state->config_path) != 0) {
+    return NULL;
+  }
+  continuous = request[prefix_len + 1] == '1';
+  decorate = request[prefix_len + 3] == '1';
+
+  if (!daemon_refresh_config(state) || !daemon_refresh_repos(state, daemon)) {
+    return NULL;
+  }
+
+  (void)history_load(&state->history);
+
   sb_init(&sb);
-  for (i = 0; i < vec->count; ++i) {
-    if (!sb_append(&sb, vec->items[i]) || !sb_append_char(&sb, '\n')) {
-      sb_free(&sb);
-      return NULL;
-    }
+  decorated_listing_init(&listing, state->config, state->repo_dir_abs, state->refs,
+                         emit_to_builder, &sb);
+  if (!sb_append(&sb, DAEMON_OK_LINE) ||
+      !emit_picker_candidates(state->config, state->repo_dir_abs, &state->roots,
+                              &state->root_labels, &state->index, &state->repos,
+                              &state->history, continuous,
+                              decorate ? emit_decorated : emit_to_builder,
+                              decorate ? (void *)&listing : (void *)&sb)) {
+    sb_free(&listing.line);
+    sb_free(&sb);
+    return NULL;
   }
+  sb_free(&listing.line);
 
+  *response_len = sb.len;
   return sb_take(&sb);
 }
 
-static const OpCustomEntry *find_custom_entry_by_name(const OpConfig *config,
-                                                       const char *name) {
-  size_t i;
-  for (i = 0; i < config->custom_entry_count; ++i) {
-    if (config->custom_entries[i].name &&
-        strcmp(config->custom_entries[i].name, name) == 0) {
-      return &config->custom_entries[i];
-    }
+static int run_daemon(const char *config_path) {
+  DaemonState state;
+  OpDaemon *daemon;
+  char *socket_path;
+  int ok;
+
+  memset(&state, 0, sizeof(state));
+  state.config_path = config_path;
+  vec_init(&state.roots);
+  vec_init(&state.root_labels);
+  vec_init(&state.repos);
+  repo_index_init(&state.index);
+  history_init(&state.history);
+
+  if (!daemon_refresh_config(&state)) {
+    return 1;
   }
-  return NULL;
+
+  socket_path = daemon_socket_path();
+  if (!socket_path) {
+    fprintf(stderr, "Unable to determine daemon socket path\n");
+    daemon_state_release_config(&state);
+    return 1;
+  }
+
+  daemon = daemon_open(socket_path);
+  if (!daemon) {
+    free(socket_path);
+    daemon_state_release_config(&state);
+    return 1;
+  }
+
+  // Branch decorations are kept across requests and only re-read for repos
+  // whose refs changed; without the cache they are read every time.
+  state.refs = git_ref_cache_new();
+
+  // Warm the listing before the first client arrives.
+  (void)daemon_refresh_repos(&state, daemon);
+  printf("op daemon listening on %s\n", socket_path);
+  fflush(stdout);
+
+  ok = daemon_serve(daemon, handle_daemon_request, &state);
+
+  daemon_close(daemon);
+  free(socket_path);
+  vec_free(&state.repos);
+  repo_index_close(&state.index);
+  history_free(&state.history);
+  git_ref_cache_free(state.refs);
+  daemon_state_release_config(&state);
+  return ok ? 0 : 1;
+}
+
+typedef struct {
+  int64_t active; // ns; exact, unlike a double at this magnitude
+  size_t position;
+} ActivityKey;
+
+static int compare_activity_keys(const void *left, const void *right) {
+  const ActivityKey *a = left;
+  const ActivityKey *b = right;
+
+  if (a->active != b->active) {
+    return a->active > b->active ? -1 : 1;
+  }
+  return a->position < b->position ? -1 : a->position > b->position;
 }
 
-static const OpCustomCommand *find_custom_command_by_name(const OpConfig *config,
-                                                           const char *name) {
+// Orders repos most recently active first (the later of .git/HEAD and
+// .git/index moving), keeping listing order among the rest.
+static int order_by_activity(const RepoMetaTable *meta, size_t *order) {
+  ActivityKey *keys = malloc((meta->count > 0 ? meta->count : 1) * sizeof(*keys));
   size_t i;
-  for (i = 0; i < config->custom_command_count; ++i) {
-    if (config->custom_commands[i].name &&
-        strcmp(config->custom_commands[i].name, name) == 0) {
-      return &config->custom_commands[i];
-    }
+
+  if (!keys) {
+    return 0;
   }
-  return NULL;
+  for (i = 0; i < meta->count; ++i) {
+    keys[i].active = meta->head_mtime[i] > meta->index_mtime[i] ? meta->head_mtime[i]
+                                                                : meta->index_mtime[i];
+    keys[i].position = i;
+  }
+  qsort(keys, meta->count, sizeof(*keys), compare_activity_keys);
+  for (i = 0; i < meta->count; ++i) {
+    order[i] = keys[i].position;
+  }
+  free(keys);
+  return 1;
 }
 
-static int execute_named_command(const char *command_template, bool run_in_preferred_shell,
-                                 const char *repo_open_path, const char *op_root,
-                                 const char *preferred_shell) {
-  char *path_quoted = NULL;
-  char *command_with_path = NULL;
-  char *final_command = NULL;
-  int status;
+// `op --sync`: the open-time update for every listed repo, in parallel. The
+// repos are stat'ed in one batch up front, so non-repos are skipped without
+// a stat per job and the recently used repos are pulled first; the table
+// still lists them in listing order.
+static int run_sync(const OpConfig *config, const char *repo_dir_abs,
+                    const StringVec *roots, const StringVec *root_labels,
+                    RepoIndex *index, long jobs) {
+  RepoMetaTable meta;
+  StringVec names;
+  char **paths;
+  size_t *order = NULL;
+  size_t count;
+  size_t i;
+  int ok;
 
-  path_quoted = quote_for_double(repo_open_path);
-  if (!path_quoted) {
-    return -1;
+  vec_init(&names);
+  if (!emit_repo_candidates(config, roots, root_labels, index, emit_to_vec,
+                            &names)) {
+    fprintf(stderr, "Failed to list repos under '%s'\n", repo_dir_abs);
+    vec_free(&names);
+    return 1;
   }
 
-  command_with_path = replace_all(command_template, "{{path}}", path_quoted);
-  free(path_quoted);
-  if (!command_with_path) {
-    return -1;
+  count = names.count;
+  paths = calloc(count > 0 ? count : 1, sizeof(*paths));
+  if (!paths) {
+    fprintf(stderr, "Out of memory\n");
+    vec_free(&names);
+    return 1;
   }
 
-  final_command = replace_all(command_with_path, "{{oproot}}", op_root);
-  free(command_with_path);
-  if (!final_command) {
-    return -1;
+  ok = 1;
+  for (i = 0; i < count && ok; ++i) {
+    paths[i] = resolve_repo_open_path(repo_dir_abs, names.items[i]);
+    ok = paths[i] != NULL;
   }
 
-  if (run_in_preferred_shell) {
-    status = invoke_here_in_preferred_shell(preferred_shell, final_command,
-                                            repo_open_path);
+  memset(&meta, 0, sizeof(meta));
+  if (ok) {
+    order = malloc((count > 0 ? count : 1) * sizeof(*order));
+    ok = order && repo_meta_collect((const char *const *)paths, count, &meta) &&
+         order_by_activity(&meta, order);
+  }
+
+  if (!ok) {
+    fprintf(stderr, "Out of memory\n");
   } else {
-    status = run_shell_command_in_dir(repo_open_path, final_command);
+    if (jobs <= 0) {
+      jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    ok = sync_repos((const char *const *)names.items, (const char *const *)paths,
+                    meta.is_repo, order, count, jobs > 0 ? (size_t)jobs : 1);
   }
 
-  free(final_command);
-  return status;
+  repo_meta_free(&meta);
+  for (i = 0; i < count; ++i) {
+    free(paths[i]);
+  }
+  free(paths);
+  free(order);
+  vec_free(&names);
+  return ok ? 0 : 1;
+}
+
+static int same_repo_roots(const OpConfig *a, const OpConfig *b) {
+  size_t i;
+
+  if (strcmp(a->repo_directory, b->repo_directory) != 0 ||
+      a->repo_root_count != b->repo_root_count) {
+    return 0;
+  }
+  for (i = 0; i < a->repo_root_count; ++i) {
+    if (strcmp(a->repo_roots[i], b->repo_roots[i]) != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Puts a config the reloader parsed in place of the current one between
+// picker rounds. The roots, and the index opened over them, are rebuilt only
+// when the repo directory or the extra roots changed; the action table always
+// is, since it points into the config. On failure the old config stays.
+static int adopt_reloaded_config(OpConfig **config, OpConfig *reloaded,
+                                 char **repo_dir_abs, StringVec *repo_roots,
+                                 StringVec *repo_root_labels, RepoIndex *repo_index,
+                                 ActionTable *actions) {
+  ActionTable reloaded_actions;
+  StringVec roots;
+  StringVec root_labels;
+  char *reloaded_dir = NULL;
+
+  if (!action_table_build(&reloaded_actions, reloaded)) {
+    fprintf(stderr, "Out of memory while reloading config\n");
+    freeConfig(reloaded);
+    return 0;
+  }
+
+  if (!same_repo_roots(*config, reloaded)) {
+    reloaded_dir = resolve_repo_directory(reloaded);
+    if (!reloaded_dir || !build_repo_roots(reloaded, reloaded_dir, &roots, &root_labels)) {
+      if (reloaded_dir) {
+        vec_free(&roots);
+        vec_free(&root_labels);
+      }
+      fprintf(stderr, "Keeping the previous config: its repo roots could not be set up\n");
+      free(reloaded_dir);
+      action_table_free(&reloaded_actions);
+      freeConfig(reloaded);
+      return 0;
+    }
+
+    vec_free(repo_roots);
+    vec_free(repo_root_labels);
+    free(*repo_dir_abs);
+    repo_index_close(repo_index);
+    repo_index_init(repo_index);
+    *repo_roots = roots;
+    *repo_root_labels = root_labels;
+    *repo_dir_abs = reloaded_dir;
+  }
+
+  action_table_free(actions);
+  *actions = reloaded_actions;
+  freeConfig(*config);
+  *config = reloaded;
+  fprintf(stderr, "Reloaded %s\n", reloaded->config_path);
+  return 1;
 }
 
 static int usage(const char *prog) {
   fprintf(stderr,
-          "Usage: %s [--continuous|-c] [--no-repo-update] [--no-target]\n",
-          prog ? prog : "op-native");
+          "Usage: %s [--continuous|-c] [--no-repo-update] [--no-target]\n"
+          "          [--action <name>] [--filter <query>] [query...]\n"
+          "       %s --daemon | --no-daemon ...\n"
+          "       %s --sync [--jobs|-j <n>]\n"
+          "       %s --compile-config\n",
+          prog ? prog : "op-native", prog ? prog : "op-native",
+          prog ? prog : "op-native", prog ? prog : "op-native");
   return 1;
 }
 
@@ -1262,17 +2863,47 @@ int main(int argc, char **argv) {
   bool no_repo_update = false;
   bool no_target = false;
   bool attempted_tmux_window_target = false;
+  bool daemon_mode = false;
+  bool compile_config = false;
+  bool sync_mode = false;
+  long sync_jobs = 0;
+  bool jobs_given = false;
+  bool use_daemon = true;
   int argi;
+  int exit_code = 0;
+  const char *filter_query = NULL;
+  const char *forced_action = NULL;
+  StringBuilder repo_query;
+  // `op <query>` picked the repo; its action must not need a picker either.
+  bool query_pick = false;
 
   char *executable_path = NULL;
   char *executable_dir = NULL;
   char *config_path = NULL;
   OpConfig *config = NULL;
-  char *repo_dir_expanded = NULL;
   char *repo_dir_abs = NULL;
   char *op_root = NULL;
   char *rerun_with_repo = NULL;
+  RepoIndex repo_index;
+  ActionTable actions;
+  ConfigReloader *reloader = NULL;
+  ShellCoprocess *warm_shells[2] = {NULL, NULL};
+  // Branch decorations stay cached between picks until the refs move.
+  GitRefCache *refs = NULL;
+  History history;
+  TmuxClient *tmux = NULL;
+  StringVec repo_roots;
+  StringVec repo_root_labels;
+
+  if (argc > 2 && strcmp(argv[1], "--emit-candidates") == 0) {
+    return emit_candidates_file(argv[2]);
+  }
+
+  if (argc > 2 && strcmp(argv[1], "--pull-worker") == 0) {
+    return run_pull_worker(argv[2], argc > 3 && strcmp(argv[3], "--notify-tmux") == 0);
+  }
 
+  sb_init(&repo_query);
   for (argi = 1; argi < argc; ++argi) {
     if (strcmp(argv[argi], "--continuous") == 0 ||
         strcmp(argv[argi], "-c") == 0) {
@@ -1281,18 +2912,50 @@ int main(int argc, char **argv) {
       no_repo_update = true;
     } else if (strcmp(argv[argi], "--no-target") == 0) {
       no_target = true;
+    } else if (strcmp(argv[argi], "--sync") == 0) {
+      sync_mode = true;
+    } else if ((strcmp(argv[argi], "--jobs") == 0 || strcmp(argv[argi], "-j") == 0) &&
+               argi + 1 < argc) {
+      sync_jobs = strtol(argv[++argi], NULL, 10);
+      jobs_given = true;
+    } else if (strcmp(argv[argi], "--daemon") == 0) {
+      daemon_mode = true;
+    } else if (strcmp(argv[argi], "--no-daemon") == 0) {
+      use_daemon = false;
+    } else if (strcmp(argv[argi], "--compile-config") == 0) {
+      compile_config = true;
+    } else if (strcmp(argv[argi], "--filter") == 0 && argi + 1 < argc) {
+      filter_query = argv[++argi];
+    } else if (strcmp(argv[argi], "--action") == 0 && argi + 1 < argc) {
+      forced_action = argv[++argi];
     } else if (strcmp(argv[argi], "--help") == 0 ||
                strcmp(argv[argi], "-h") == 0) {
+      sb_free(&repo_query);
       return usage(argv[0]);
+    } else if (argv[argi][0] != '-') {
+      if ((repo_query.len > 0 && !sb_append_char(&repo_query, ' ')) ||
+          !sb_append(&repo_query, argv[argi])) {
+        fprintf(stderr, "Out of memory\n");
+        sb_free(&repo_query);
+        return 1;
+      }
     } else {
       fprintf(stderr, "Unknown argument: %s\n", argv[argi]);
+      sb_free(&repo_query);
       return usage(argv[0]);
     }
   }
 
+  if (jobs_given && !sync_mode) {
+    fprintf(stderr, "--jobs only applies to --sync\n");
+    sb_free(&repo_query);
+    return usage(argv[0]);
+  }
+
   executable_path = get_current_executable_path();
   if (!executable_path) {
     fprintf(stderr, "Unable to determine executable path\n");
+    sb_free(&repo_query);
     return 1;
   }
 
@@ -1312,28 +2975,34 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-  config = loadConfigs(config_path);
-  if (!config) {
+  if (compile_config) {
+    exit_code = compileConfigCache(config_path) ? 0 : 1;
+    sb_free(&repo_query);
     free(executable_path);
     free(executable_dir);
     free(config_path);
-    return 1;
+    return exit_code;
   }
 
-  repo_dir_expanded = expand_tilde(config->repo_directory);
-  if (!repo_dir_expanded) {
-    fprintf(stderr, "Failed to expand repo directory: %s\n", config->repo_directory);
+  if (daemon_mode) {
+    exit_code = run_daemon(config_path);
+    sb_free(&repo_query);
+    free(executable_path);
+    free(executable_dir);
+    free(config_path);
+    return exit_code;
+  }
+
+  config = loadConfigs(config_path);
+  if (!config) {
     free(executable_path);
     free(executable_dir);
     free(config_path);
-    freeConfig(config);
     return 1;
   }
 
-  repo_dir_abs = make_absolute_path(repo_dir_expanded);
-  free(repo_dir_expanded);
+  repo_dir_abs = resolve_repo_directory(config);
   if (!repo_dir_abs) {
-    fprintf(stderr, "Failed to build absolute repo directory path\n");
     free(executable_path);
     free(executable_dir);
     free(config_path);
@@ -1352,55 +3021,114 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-  while (1) {
-    StringVec options;
-    StringVec action_options;
-    char *options_input = NULL;
-    char *selected_repo_raw = NULL;
-    char *selected_repo = NULL;
-    char *repo_open_path = NULL;
-    char *action_input = NULL;
-    char *selected_action = NULL;
-    const OpCustomEntry *custom_entry;
+  repo_index_init(&repo_index);
+  action_table_init(&actions);
+  history_init(&history);
+  if (!build_repo_roots(config, repo_dir_abs, &repo_roots, &repo_root_labels)) {
+    fprintf(stderr, "Out of memory\n");
+    vec_free(&repo_roots);
+    vec_free(&repo_root_labels);
+    free(executable_path);
+    free(executable_dir);
+    free(config_path);
+    free(repo_dir_abs);
+    free(op_root);
+    freeConfig(config);
+    return 1;
+  }
 
-    vec_init(&options);
-    vec_init(&action_options);
+  if (sync_mode) {
+    exit_code = run_sync(config, repo_dir_abs, &repo_roots, &repo_root_labels,
+                         &repo_index, sync_jobs);
+    goto cleanup;
+  }
 
-    if (!build_directory_listing(repo_dir_abs, &options)) {
-      fprintf(stderr, "Failed to list repo directory '%s'\n", repo_dir_abs);
-      goto loop_cleanup;
+  if (filter_query || repo_query.len > 0) {
+    StringVec candidates;
+    FuzzyMatch *matches = NULL;
+    long matched;
+
+    (void)history_load(&history);
+    if (!collect_repo_candidates(config, &repo_roots, &repo_root_labels,
+                                 &repo_index, &history, &candidates)) {
+      fprintf(stderr, "Failed to list repos under '%s'\n", repo_dir_abs);
+      exit_code = 1;
+      goto cleanup;
     }
 
-    if (!vec_push(&options, CLONE_KEYWORD) || !vec_push(&options, NEW_REPO_KEYWORD)) {
+    matched = rank_candidates(filter_query ? filter_query : repo_query.data,
+                              &candidates, &matches);
+    if (matched < 0) {
       fprintf(stderr, "Out of memory\n");
-      goto loop_cleanup;
+      exit_code = 1;
+    } else if (filter_query) {
+      long i;
+      for (i = 0; i < matched; ++i) {
+        printf("%s\n", candidates.items[matches[i].index]);
+      }
+      exit_code = matched > 0 ? 0 : 1;
+    } else if (matched == 0) {
+      fprintf(stderr, "No repo matches '%s'\n", repo_query.data);
+      exit_code = 1;
+    } else {
+      rerun_with_repo = xstrdup(candidates.items[matches[0].index]);
+      exit_code = rerun_with_repo ? 0 : 1;
+      query_pick = rerun_with_repo != NULL;
     }
 
-    {
-      size_t i;
-      for (i = 0; i < config->custom_entry_count; ++i) {
-        if (config->custom_entries[i].name &&
-            !vec_push(&options, config->custom_entries[i].name)) {
-          fprintf(stderr, "Out of memory\n");
-          goto loop_cleanup;
-        }
-      }
+    free(matches);
+    vec_free(&candidates);
+    if (filter_query || exit_code != 0) {
+      goto cleanup;
     }
+  }
 
-    if (continuous && !vec_push(&options, EXIT_KEYWORD)) {
-      fprintf(stderr, "Out of memory\n");
-      goto loop_cleanup;
+  if (!action_table_build(&actions, config)) {
+    fprintf(stderr, "Out of memory\n");
+    exit_code = 1;
+    goto cleanup;
+  }
+
+  // Without a cache the decorations are read uncached.
+  refs = git_ref_cache_new();
+
+  // A long-lived picker pane follows config.json edits without a restart.
+  if (continuous) {
+    reloader = config_reloader_start(config_path, config);
+  }
+
+  while (1) {
+    const Action *action;
+    const Action *keyed_action = NULL;
+    bool picked_by_query = false;
+    char *selected_repo_raw = NULL;
+    char *selected_repo = NULL;
+    char *repo_open_path = NULL;
+    char *selected_action = NULL;
+    const OpCustomEntry *custom_entry;
+
+    if (reloader) {
+      OpConfig *reloaded = config_reloader_take(reloader);
+      if (reloaded) {
+        (void)adopt_reloaded_config(&config, reloaded, &repo_dir_abs, &repo_roots,
+                                    &repo_root_labels, &repo_index, &actions);
+        if (!config->persistent_shell) {
+          shell_coprocess_stop(warm_shells[0]);
+          shell_coprocess_stop(warm_shells[1]);
+          warm_shells[0] = warm_shells[1] = NULL;
+        }
+      }
     }
 
     if (!continuous && !no_target && !attempted_tmux_window_target &&
         !rerun_with_repo) {
-      char *tmux_window_name = get_tmux_current_window_name();
+      char *tmux_window_name = get_tmux_current_window_name(&tmux, repo_dir_abs);
       attempted_tmux_window_target = true;
 
       if (tmux_window_name && strcmp(tmux_window_name, CLONE_KEYWORD) != 0 &&
           strcmp(tmux_window_name, NEW_REPO_KEYWORD) != 0 &&
           strcmp(tmux_window_name, EXIT_KEYWORD) != 0 &&
-          vec_contains(&options, tmux_window_name)) {
+          repo_name_exists(config, repo_dir_abs, tmux_window_name)) {
         rerun_with_repo = tmux_window_name;
         tmux_window_name = NULL;
       }
@@ -1411,13 +3139,18 @@ int main(int argc, char **argv) {
     if (rerun_with_repo && rerun_with_repo[0] != '\0') {
       selected_repo_raw = rerun_with_repo;
       rerun_with_repo = NULL;
+      picked_by_query = query_pick;
+      query_pick = false;
     } else {
-      options_input = build_fzf_input_from_vec(&options);
-      if (!options_input) {
-        fprintf(stderr, "Out of memory\n");
-        goto loop_cleanup;
+      char *picked_key;
+      selected_repo_raw = pick_repo(config, config_path, repo_dir_abs, &repo_roots,
+                                    &repo_root_labels, &repo_index, &history, refs,
+                                    continuous, use_daemon, actions.picker_expect,
+                                    actions.picker_header, &picked_key);
+      // The key lives in selected_repo_raw's block, so resolve it now.
+      if (selected_repo_raw) {
+        keyed_action = action_table_find_key(&actions, picked_key);
       }
-      selected_repo_raw = askChoicesWithPrompt(options_input, "op native > ");
     }
 
     if (!selected_repo_raw || selected_repo_raw[0] == '\0') {
@@ -1429,6 +3162,9 @@ int main(int argc, char **argv) {
     selected_repo = trim_copy(selected_repo_raw);
     free(selected_repo_raw);
     selected_repo_raw = NULL;
+    if (selected_repo) {
+      strip_repo_decoration(selected_repo);
+    }
 
     if (!selected_repo || selected_repo[0] == '\0') {
       goto loop_cleanup;
@@ -1481,7 +3217,7 @@ int main(int argc, char **argv) {
       goto loop_cleanup;
     }
 
-    custom_entry = find_custom_entry_by_name(config, selected_repo);
+    custom_entry = findCustomEntry(config, selected_repo);
     if (custom_entry) {
       char *custom_path_expanded;
       if (!custom_entry->linux_path) {
@@ -1503,83 +3239,81 @@ int main(int argc, char **argv) {
         goto loop_cleanup;
       }
     } else {
-      repo_open_path = join_path(repo_dir_abs, selected_repo);
+      repo_open_path = resolve_repo_open_path(repo_dir_abs, selected_repo);
       if (!repo_open_path) {
         fprintf(stderr, "Out of memory\n");
         goto loop_cleanup;
       }
     }
 
-    if (!vec_push(&action_options, "nvim-tmux") || !vec_push(&action_options, "nvim") ||
-        !vec_push(&action_options, "cd-here")) {
-      fprintf(stderr, "Out of memory\n");
-      goto loop_cleanup;
-    }
-
-    if (!config->is_server && !vec_push(&action_options, "code")) {
-      fprintf(stderr, "Out of memory\n");
-      goto loop_cleanup;
-    }
-
-    {
-      size_t i;
-      for (i = 0; i < config->custom_command_count; ++i) {
-        if (config->custom_commands[i].name &&
-            !vec_push(&action_options, config->custom_commands[i].name)) {
-          fprintf(stderr, "Out of memory\n");
-          goto loop_cleanup;
-        }
+    if (forced_action) {
+      if (!action_table_find(&actions, forced_action)) {
+        fprintf(stderr, "Unknown action: %s\n", forced_action);
+        forced_action = NULL;
+        exit_code = 1;
+        goto loop_cleanup;
       }
-    }
-
-    if (!vec_push(&action_options, BUILTIN_NEW_WORKTREE.name)) {
-      fprintf(stderr, "Out of memory\n");
+      selected_action = xstrdup(forced_action);
+      forced_action = NULL;
+    } else if (keyed_action) {
+      selected_action = xstrdup(keyed_action->name);
+    } else if (picked_by_query && actions.enter) {
+      selected_action = xstrdup(actions.enter->name);
+    } else if (picked_by_query && !isatty(STDIN_FILENO)) {
+      // Headless (e.g. a tmux binding): there is no terminal to ask on.
+      fprintf(stderr, "No action for '%s': pass --action or set enterAction\n",
+              selected_repo);
+      exit_code = 1;
       goto loop_cleanup;
+    } else {
+      selected_action = askChoices(actions.menu);
     }
-
-    action_input = build_fzf_input_from_vec(&action_options);
-    if (!action_input) {
-      fprintf(stderr, "Out of memory\n");
+    if (!selected_action || selected_action[0] == '\0') {
       goto loop_cleanup;
     }
 
-    selected_action = askChoices(action_input);
-    if (!selected_action || selected_action[0] == '\0') {
-      goto loop_cleanup;
+    if (!history_record(selected_repo, selected_action)) {
+      fprintf(stderr, "Failed to record '%s' in history\n", selected_repo);
     }
 
-    if (strcmp(selected_action, "nvim") == 0) {
+    action = action_table_find(&actions, selected_action);
+    if (!action) {
+      printf("No option selected\n");
+    } else if (action->kind == ACTION_NVIM) {
+      const char *tmux_env = getenv("TMUX");
       char *const nvim_argv[] = {"nvim", repo_open_path, NULL};
-      update_repo_if_clean(repo_open_path, no_repo_update);
+      start_repo_update(config, executable_path, repo_open_path, no_repo_update,
+                        tmux_env && tmux_env[0] != '\0');
       (void)run_command_in_dir(NULL, nvim_argv);
-    } else if (strcmp(selected_action, "code") == 0) {
+    } else if (action->kind == ACTION_CODE) {
       char *const code_argv[] = {"code", repo_open_path, NULL};
       (void)run_command_in_dir(NULL, code_argv);
-    } else if (strcmp(selected_action, "cd-here") == 0) {
+    } else if (action->kind == ACTION_CD_HERE) {
       (void)open_preferred_shell_in_dir(config->preferred_shell, repo_open_path);
-    } else if (strcmp(selected_action, "nvim-tmux") == 0) {
+    } else if (action->kind == ACTION_NVIM_TMUX) {
       int target_window_index;
       int new_window_index;
       char target_window[128];
       char *main_shell = NULL;
       char *main_cd_command = NULL;
 
-      update_repo_if_clean(repo_open_path, no_repo_update);
+      start_repo_update(config, executable_path, repo_open_path, no_repo_update, true);
 
-      if (!ensure_tmux_session(MAIN_TMUX_SESSION_NAME, repo_dir_abs)) {
+      if (!tmux_connect(&tmux, repo_dir_abs) ||
+          !ensure_tmux_session(tmux, MAIN_TMUX_SESSION_NAME, repo_dir_abs)) {
         fprintf(stderr, "Failed to ensure tmux session '%s'\n",
                 MAIN_TMUX_SESSION_NAME);
         goto loop_cleanup;
       }
 
-      target_window_index = get_next_tmux_window_index(MAIN_TMUX_SESSION_NAME);
-      if (!create_tmux_window(MAIN_TMUX_SESSION_NAME, target_window_index,
+      target_window_index = get_next_tmux_window_index(tmux, MAIN_TMUX_SESSION_NAME);
+      if (!create_tmux_window(tmux, MAIN_TMUX_SESSION_NAME, target_window_index,
                               selected_repo, &new_window_index)) {
         fprintf(stderr, "Failed to create tmux window for %s\n", selected_repo);
         goto loop_cleanup;
       }
 
-      main_shell = get_tmux_default_shell();
+      main_shell = get_tmux_default_shell(tmux);
       if (!main_shell) {
         fprintf(stderr, "Failed to read tmux default shell\n");
         goto loop_cleanup;
@@ -1594,39 +3328,40 @@ int main(int argc, char **argv) {
 
       snprintf(target_window, sizeof(target_window), "%s:%d", MAIN_TMUX_SESSION_NAME,
                new_window_index);
-      (void)tmux_send_keys(target_window, main_cd_command);
-      (void)tmux_send_keys(target_window, "nvim .");
-      start_tmux_shell_pane(repo_open_path, new_window_index, config->preferred_shell);
+      (void)tmux_send_keys(tmux, target_window, main_cd_command);
+      (void)tmux_send_keys(tmux, target_window, "nvim .");
+      start_tmux_shell_pane(tmux, repo_open_path, new_window_index,
+                            config->preferred_shell);
+      (void)tmux_client_sync(tmux);
       printf("Opening nvim in tmux session '%s'\n", MAIN_TMUX_SESSION_NAME);
 
       free(main_shell);
       free(main_cd_command);
     } else {
-      const OpCustomCommand *custom_command =
-          find_custom_command_by_name(config, selected_action);
-
-      if (custom_command) {
-        (void)execute_named_command(custom_command->command,
-                                    custom_command->run_in_preferred_shell,
-                                    repo_open_path, op_root, config->preferred_shell);
-      } else if (strcmp(selected_action, BUILTIN_NEW_WORKTREE.name) == 0) {
-        (void)execute_named_command(BUILTIN_NEW_WORKTREE.command,
-                                    BUILTIN_NEW_WORKTREE.run_in_preferred_shell,
-                                    repo_open_path, op_root, config->preferred_shell);
-      } else {
-        printf("No option selected\n");
-      }
+      TemplateContext context;
+      bool in_preferred_shell = action->kind == ACTION_CUSTOM_COMMAND
+                                    ? action->command->run_in_preferred_shell
+                                    : BUILTIN_NEW_WORKTREE.run_in_preferred_shell;
+      OpShellMode shell = action->kind == ACTION_CUSTOM_COMMAND
+                              ? action->command->shell
+                              : BUILTIN_NEW_WORKTREE.shell;
+
+      context.repo_open_path = repo_open_path;
+      context.selected_name = selected_repo;
+      context.op_root = op_root;
+      context.roots = &repo_roots;
+      context.refs = refs;
+      (void)execute_named_command(action->name, action->tmpl, in_preferred_shell, shell,
+                                  &context, config->preferred_shell,
+                                  continuous && config->persistent_shell ? warm_shells
+                                                                         : NULL);
     }
 
   loop_cleanup:
-    free(options_input);
     free(selected_repo_raw);
     free(selected_repo);
     free(repo_open_path);
-    free(action_input);
     free(selected_action);
-    vec_free(&options);
-    vec_free(&action_options);
 
     if (!continuous) {
       break;
@@ -1635,18 +3370,26 @@ int main(int argc, char **argv) {
     continue;
 
   loop_exit:
-    free(options_input);
     free(selected_repo_raw);
     free(selected_repo);
     free(repo_open_path);
-    free(action_input);
     free(selected_action);
-    vec_free(&options);
-    vec_free(&action_options);
     break;
   }
 
+cleanup:
+  sb_free(&repo_query);
   free(rerun_with_repo);
+  config_reloader_stop(reloader);
+  shell_coprocess_stop(warm_shells[0]);
+  shell_coprocess_stop(warm_shells[1]);
+  git_ref_cache_free(refs);
+  action_table_free(&actions);
+  repo_index_close(&repo_index);
+  history_free(&history);
+  tmux_client_close(tmux);
+  vec_free(&repo_roots);
+  vec_free(&repo_root_labels);
   free(op_root);
   free(repo_dir_abs);
   freeConfig(config);
@@ -1654,5 +3397,5 @@ int main(int argc, char **argv) {
   free(executable_dir);
   free(executable_path);
 
-  return 0;
+  return exit_code;
 }
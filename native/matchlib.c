@@ -0,0 +1,452 @@
+#include "matchlib.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MATCH_HAVE_X86 1
+#endif
+
+// Scoring constants mirror fzf's algo.go so rankings line up with the
+// interactive picker.
+#define SCORE_MATCH 16
+#define SCORE_GAP_START (-3)
+#define SCORE_GAP_EXTENSION (-1)
+#define BONUS_BOUNDARY (SCORE_MATCH / 2)
+#define BONUS_NON_WORD (SCORE_MATCH / 2)
+#define BONUS_CAMEL123 (BONUS_BOUNDARY + SCORE_GAP_EXTENSION)
+#define BONUS_CONSECUTIVE (-(SCORE_GAP_START + SCORE_GAP_EXTENSION))
+#define BONUS_FIRST_CHAR_MULTIPLIER 2
+#define BONUS_BOUNDARY_WHITE (BONUS_BOUNDARY + 2)
+#define BONUS_BOUNDARY_DELIMITER (BONUS_BOUNDARY + 1)
+
+typedef enum {
+  CHAR_WHITE,
+  CHAR_NON_WORD,
+  CHAR_DELIMITER,
+  CHAR_LOWER,
+  CHAR_UPPER,
+  CHAR_LETTER,
+  CHAR_NUMBER
+} CharClass;
+
+static CharClass char_class_of(unsigned char ch) {
+  if (ch >= 'a' && ch <= 'z') {
+    return CHAR_LOWER;
+  }
+  if (ch >= 'A' && ch <= 'Z') {
+    return CHAR_UPPER;
+  }
+  if (ch >= '0' && ch <= '9') {
+    return CHAR_NUMBER;
+  }
+  if (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r') {
+    return CHAR_WHITE;
+  }
+  if (ch == '/' || ch == ',' || ch == ':' || ch == ';' || ch == '|') {
+    return CHAR_DELIMITER;
+  }
+  if (ch >= 0x80) {
+    return CHAR_LETTER;
+  }
+  return CHAR_NON_WORD;
+}
+
+static int bonus_for(CharClass prev, CharClass cls) {
+  if (cls > CHAR_NON_WORD) {
+    if (prev == CHAR_WHITE) {
+      return BONUS_BOUNDARY_WHITE;
+    }
+    if (prev == CHAR_DELIMITER) {
+      return BONUS_BOUNDARY_DELIMITER;
+    }
+    if (prev == CHAR_NON_WORD) {
+      return BONUS_BOUNDARY;
+    }
+  }
+
+  if ((prev == CHAR_LOWER && cls == CHAR_UPPER) ||
+      (prev != CHAR_NUMBER && cls == CHAR_NUMBER)) {
+    return BONUS_CAMEL123;
+  }
+
+  if (cls == CHAR_NON_WORD || cls == CHAR_DELIMITER) {
+    return BONUS_NON_WORD;
+  }
+  if (cls == CHAR_WHITE) {
+    return BONUS_BOUNDARY_WHITE;
+  }
+  return 0;
+}
+
+static unsigned char fold(unsigned char ch) {
+  return (ch >= 'A' && ch <= 'Z') ? (unsigned char)(ch | 0x20) : ch;
+}
+
+static int is_ascii_letter(unsigned char ch) {
+  return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+}
+
+// Finds the next position >= from holding needle. For case-insensitive
+// letters, OR-ing 0x20 into the haystack folds both cases onto the
+// lowercase needle in a single compare.
+static size_t find_char_scalar(const unsigned char *text, size_t len, size_t from,
+                               unsigned char needle, unsigned char fold_mask) {
+  size_t i;
+  for (i = from; i < len; ++i) {
+    if ((text[i] | fold_mask) == needle) {
+      return i;
+    }
+  }
+  return len;
+}
+
+#ifdef MATCH_HAVE_X86
+static size_t find_char_sse2(const unsigned char *text, size_t len, size_t from,
+                             unsigned char needle, unsigned char fold_mask) {
+  const __m128i want = _mm_set1_epi8((char)needle);
+  const __m128i mask = _mm_set1_epi8((char)fold_mask);
+  size_t i = from;
+
+  for (; i + 16 <= len; i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(text + i));
+    int bits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(chunk, mask), want));
+    if (bits) {
+      return i + (size_t)__builtin_ctz((unsigned)bits);
+    }
+  }
+  return find_char_scalar(text, len, i, needle, fold_mask);
+}
+
+__attribute__((target("avx2"))) static size_t
+find_char_avx2(const unsigned char *text, size_t len, size_t from,
+               unsigned char needle, unsigned char fold_mask) {
+  const __m256i want = _mm256_set1_epi8((char)needle);
+  const __m256i mask = _mm256_set1_epi8((char)fold_mask);
+  size_t i = from;
+
+  for (; i + 32 <= len; i += 32) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i *)(text + i));
+    unsigned bits = (unsigned)_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_or_si256(chunk, mask), want));
+    if (bits) {
+      return i + (size_t)__builtin_ctz(bits);
+    }
+  }
+  return find_char_sse2(text, len, i, needle, fold_mask);
+}
+#endif
+
+typedef size_t (*FindCharFn)(const unsigned char *, size_t, size_t, unsigned char,
+                             unsigned char);
+
+static FindCharFn select_find_char(void) {
+#ifdef MATCH_HAVE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return find_char_avx2;
+  }
+  return find_char_sse2;
+#else
+  return find_char_scalar;
+#endif
+}
+
+static FindCharFn find_char_impl;
+
+static size_t find_char(const unsigned char *text, size_t len, size_t from,
+                        unsigned char needle, unsigned char fold_mask) {
+  if (!find_char_impl) {
+    find_char_impl = select_find_char();
+  }
+  return find_char_impl(text, len, from, needle, fold_mask);
+}
+
+// Cheap rejection pass: the term has to appear as a subsequence. Records the
+// first feasible position of every pattern char in first_positions.
+static int find_subsequence(const FuzzyTerm *term, const unsigned char *text,
+                            size_t len, size_t *first_positions) {
+  size_t pos = 0;
+  size_t i;
+
+  for (i = 0; i < term->len; ++i) {
+    unsigned char ch = (unsigned char)term->text[i];
+    unsigned char mask = (!term->case_sensitive && is_ascii_letter(ch)) ? 0x20 : 0;
+    pos = find_char(text, len, pos, mask ? fold(ch) : ch, mask);
+    if (pos >= len) {
+      return 0;
+    }
+    first_positions[i] = pos++;
+  }
+  return 1;
+}
+
+static int ensure_scratch(FuzzyMatcher *matcher, size_t needed) {
+  int16_t *scratch;
+
+  if (needed <= matcher->scratch_cap) {
+    return 1;
+  }
+
+  scratch = realloc(matcher->scratch, needed * sizeof(*scratch));
+  if (!scratch) {
+    return 0;
+  }
+  matcher->scratch = scratch;
+  matcher->scratch_cap = needed;
+  return 1;
+}
+
+static int max_int(int a, int b) { return a > b ? a : b; }
+
+// fzf's FuzzyMatchV2: a Smith-Waterman style pass that keeps, per pattern
+// row, the best score so far (H) and the length of the consecutive run ending
+// at each column (C). Only two rows are kept since positions aren't needed.
+static int score_term(FuzzyMatcher *matcher, const FuzzyTerm *term,
+                      const unsigned char *text, size_t len, int *score) {
+  size_t first_positions[256];
+  size_t f0;
+  size_t width;
+  size_t row;
+  size_t col;
+  int16_t *bonus;
+  int16_t *prev_h;
+  int16_t *prev_c;
+  int16_t *cur_h;
+  int16_t *cur_c;
+  int best = 0;
+
+  if (term->len == 0) {
+    *score = 0;
+    return 1;
+  }
+  if (term->len > sizeof(first_positions) / sizeof(first_positions[0]) ||
+      !find_subsequence(term, text, len, first_positions)) {
+    return 0;
+  }
+
+  f0 = first_positions[0];
+  width = len - f0;
+  if (!ensure_scratch(matcher, width * 5)) {
+    return 0;
+  }
+
+  bonus = matcher->scratch;
+  prev_h = bonus + width;
+  prev_c = prev_h + width;
+  cur_h = prev_c + width;
+  cur_c = cur_h + width;
+
+  {
+    CharClass prev = f0 > 0 ? char_class_of(text[f0 - 1]) : CHAR_WHITE;
+    unsigned char want = (unsigned char)term->text[0];
+    int prev_score = 0;
+    int in_gap = 0;
+
+    if (!term->case_sensitive) {
+      want = fold(want);
+    }
+
+    for (col = 0; col < width; ++col) {
+      unsigned char have = text[f0 + col];
+      CharClass cls = char_class_of(have);
+
+      bonus[col] = (int16_t)bonus_for(prev, cls);
+      prev = cls;
+
+      if ((term->case_sensitive ? have : fold(have)) == want) {
+        cur_h[col] = (int16_t)(SCORE_MATCH + bonus[col] * BONUS_FIRST_CHAR_MULTIPLIER);
+        cur_c[col] = 1;
+        if (term->len == 1 && cur_h[col] > best) {
+          best = cur_h[col];
+        }
+        in_gap = 0;
+      } else {
+        cur_h[col] = (int16_t)max_int(
+            prev_score + (in_gap ? SCORE_GAP_EXTENSION : SCORE_GAP_START), 0);
+        cur_c[col] = 0;
+        in_gap = 1;
+      }
+      prev_score = cur_h[col];
+    }
+  }
+
+  for (row = 1; row < term->len; ++row) {
+    unsigned char want = (unsigned char)term->text[row];
+    size_t first_col = first_positions[row] - f0;
+    int in_gap = 0;
+    int16_t *swap;
+
+    swap = prev_h;
+    prev_h = cur_h;
+    cur_h = swap;
+    swap = prev_c;
+    prev_c = cur_c;
+    cur_c = swap;
+
+    if (!term->case_sensitive) {
+      want = fold(want);
+    }
+
+    // first_col > 0 always holds here since every row starts past row 0.
+    cur_h[first_col - 1] = 0;
+    for (col = first_col; col < width; ++col) {
+      unsigned char have = text[f0 + col];
+      int s1 = 0;
+      int s2 = cur_h[col - 1] + (in_gap ? SCORE_GAP_EXTENSION : SCORE_GAP_START);
+      int consecutive = 0;
+      int cell;
+
+      if ((term->case_sensitive ? have : fold(have)) == want) {
+        int b = bonus[col];
+
+        s1 = prev_h[col - 1] + SCORE_MATCH;
+        consecutive = prev_c[col - 1] + 1;
+        if (consecutive > 1) {
+          int first_bonus = bonus[col - (size_t)consecutive + 1];
+          if (b >= BONUS_BOUNDARY && b > first_bonus) {
+            // A new word boundary starts a new chunk.
+            consecutive = 1;
+          } else {
+            b = max_int(b, max_int(BONUS_CONSECUTIVE, first_bonus));
+          }
+        }
+
+        if (s1 + b < s2) {
+          s1 += bonus[col];
+          consecutive = 0;
+        } else {
+          s1 += b;
+        }
+      }
+
+      cur_c[col] = (int16_t)consecutive;
+      in_gap = s1 < s2;
+      cell = max_int(max_int(s1, s2), 0);
+      cur_h[col] = (int16_t)cell;
+
+      if (row + 1 == term->len && cell > best) {
+        best = cell;
+      }
+    }
+  }
+
+  *score = best;
+  return 1;
+}
+
+int fuzzy_matcher_init(FuzzyMatcher *matcher, const char *query) {
+  char *cursor;
+
+  memset(matcher, 0, sizeof(*matcher));
+  matcher->storage = strdup(query ? query : "");
+  if (!matcher->storage) {
+    return 0;
+  }
+
+  cursor = matcher->storage;
+  while (*cursor && matcher->term_count < FUZZY_MAX_TERMS) {
+    FuzzyTerm *term;
+    char *end;
+
+    while (*cursor == ' ') {
+      cursor++;
+    }
+    if (!*cursor) {
+      break;
+    }
+
+    end = cursor;
+    while (*end && *end != ' ') {
+      end++;
+    }
+
+    term = &matcher->terms[matcher->term_count++];
+    term->text = cursor;
+    term->len = (size_t)(end - cursor);
+    term->case_sensitive = 0;
+    {
+      size_t i;
+      for (i = 0; i < term->len; ++i) {
+        if (cursor[i] >= 'A' && cursor[i] <= 'Z') {
+          term->case_sensitive = 1;
+          break;
+        }
+      }
+    }
+
+    if (*end) {
+      *end = '\0';
+      end++;
+    }
+    cursor = end;
+  }
+
+  return 1;
+}
+
+int fuzzy_matcher_score(FuzzyMatcher *matcher, const char *text, size_t len,
+                        int *score) {
+  int total = 0;
+  size_t i;
+
+  for (i = 0; i < matcher->term_count; ++i) {
+    int term_score = 0;
+    if (!score_term(matcher, &matcher->terms[i], (const unsigned char *)text, len,
+                    &term_score)) {
+      return 0;
+    }
+    total += term_score;
+  }
+
+  *score = total;
+  return 1;
+}
+
+static int compare_matches(const void *left, const void *right) {
+  const FuzzyMatch *a = left;
+  const FuzzyMatch *b = right;
+
+  // Same tiebreak as fzf's default: score, then shorter text, then input order.
+  if (a->score != b->score) {
+    return a->score > b->score ? -1 : 1;
+  }
+  if (a->len != b->len) {
+    return a->len < b->len ? -1 : 1;
+  }
+  if (a->index != b->index) {
+    return a->index < b->index ? -1 : 1;
+  }
+  return 0;
+}
+
+size_t fuzzy_rank(FuzzyMatcher *matcher, const char *const *candidates,
+                  size_t count, FuzzyMatch *matches) {
+  size_t matched = 0;
+  size_t i;
+
+  for (i = 0; i < count; ++i) {
+    size_t len = strlen(candidates[i]);
+    int score = 0;
+
+    if (fuzzy_matcher_score(matcher, candidates[i], len, &score)) {
+      matches[matched].index = i;
+      matches[matched].score = score;
+      matches[matched].len = len;
+      matched++;
+    }
+  }
+
+  // An empty query keeps input order, like fzf.
+  if (matcher->term_count > 0 && matched > 1) {
+    qsort(matches, matched, sizeof(*matches), compare_matches);
+  }
+  return matched;
+}
+
+void fuzzy_matcher_free(FuzzyMatcher *matcher) {
+  free(matcher->storage);
+  free(matcher->scratch);
+  memset(matcher, 0, sizeof(*matcher));
+}
@@ -0,0 +1,38 @@
+#ifndef match_lib_included
+#define match_lib_included
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FUZZY_MAX_TERMS 8
+
+typedef struct {
+  const char *text;
+  size_t len;
+  int case_sensitive;
+} FuzzyTerm;
+
+// A parsed query: space separated terms that must all match, each scored
+// with fzf's fuzzy (v2) model. Smart case applies per term.
+typedef struct {
+  char *storage;
+  FuzzyTerm terms[FUZZY_MAX_TERMS];
+  size_t term_count;
+  int16_t *scratch;
+  size_t scratch_cap;
+} FuzzyMatcher;
+
+typedef struct {
+  size_t index;
+  int score;
+  size_t len;
+} FuzzyMatch;
+
+int fuzzy_matcher_init(FuzzyMatcher *matcher, const char *query);
+int fuzzy_matcher_score(FuzzyMatcher *matcher, const char *text, size_t len,
+                        int *score);
+size_t fuzzy_rank(FuzzyMatcher *matcher, const char *const *candidates,
+                  size_t count, FuzzyMatch *matches);
+void fuzzy_matcher_free(FuzzyMatcher *matcher);
+
+#endif // match_lib_included
@@ -0,0 +1,373 @@
+#include "metalib.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define META_RING_ENTRIES 256
+#define META_MAX_WORKERS 16
+// Below this many calls setting up a ring or threads costs more than it saves.
+#define META_INLINE_LIMIT 16
+
+typedef enum {
+  META_GIT,
+  META_HEAD,
+  META_INDEX,
+  META_KIND_COUNT,
+} MetaKind;
+
+static const char *const META_SUFFIXES[META_KIND_COUNT] = {
+    [META_GIT] = "/.git",
+    [META_HEAD] = "/.git/HEAD",
+    [META_INDEX] = "/.git/index",
+};
+
+// Request r stats META_SUFFIXES[r % META_KIND_COUNT] under repo
+// r / META_KIND_COUNT; its path starts at paths + path_offsets[r].
+typedef struct {
+  RepoMetaTable *table;
+  char *paths;
+  size_t *path_offsets;
+  size_t count;
+  size_t next; // thread pool only
+} MetaBatch;
+
+static const char *request_path(const MetaBatch *batch, size_t request) {
+  return batch->paths + batch->path_offsets[request];
+}
+
+static unsigned request_mask(size_t request) {
+  return request % META_KIND_COUNT == META_GIT ? STATX_TYPE : STATX_MTIME;
+}
+
+static void record_result(MetaBatch *batch, size_t request, const struct statx *st) {
+  size_t repo = request / META_KIND_COUNT;
+  int64_t mtime = (int64_t)st->stx_mtime.tv_sec * 1000000000LL + st->stx_mtime.tv_nsec;
+
+  switch ((MetaKind)(request % META_KIND_COUNT)) {
+  case META_GIT:
+    // Whatever .git resolves to counts, as with stat(): a worktree's .git
+    // file and a .git symlink both mark a repo.
+    batch->table->is_repo[repo] = 1;
+    break;
+  case META_HEAD:
+    batch->table->head_mtime[repo] = mtime;
+    break;
+  default:
+    batch->table->index_mtime[repo] = mtime;
+    break;
+  }
+}
+
+static void stat_request(MetaBatch *batch, size_t request) {
+  struct statx st;
+
+  if (statx(AT_FDCWD, request_path(batch, request), 0, request_mask(request), &st) == 0) {
+    record_result(batch, request, &st);
+  }
+}
+
+typedef struct {
+  int fd;
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+  unsigned entries;
+} MetaRing;
+
+static void ring_close(MetaRing *ring) {
+  if (ring->sqes && ring->sqes != MAP_FAILED) {
+    munmap(ring->sqes, ring->sqes_size);
+  }
+  if (ring->cq_ring && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) {
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  }
+  if (ring->sq_ring && ring->sq_ring != MAP_FAILED) {
+    munmap(ring->sq_ring, ring->sq_ring_size);
+  }
+  if (ring->fd >= 0) {
+    close(ring->fd);
+  }
+}
+
+// Sets up the ring by hand (no liburing): the submission and completion
+// rings and the SQE array are mapped from the io_uring fd.
+static int ring_open(MetaRing *ring) {
+  struct io_uring_params params;
+  char *sq;
+  char *cq;
+
+  memset(ring, 0, sizeof(*ring));
+  memset(&params, 0, sizeof(params));
+  ring->fd = (int)syscall(__NR_io_uring_setup, META_RING_ENTRIES, &params);
+  if (ring->fd < 0) {
+    return 0;
+  }
+
+  ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_ring_size > ring->sq_ring_size) {
+      ring->sq_ring_size = ring->cq_ring_size;
+    }
+    ring->cq_ring_size = ring->sq_ring_size;
+  }
+
+  ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == MAP_FAILED) {
+    ring_close(ring);
+    return 0;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cq_ring = ring->sq_ring;
+  } else {
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+  }
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+    ring_close(ring);
+    return 0;
+  }
+
+  sq = ring->sq_ring;
+  cq = ring->cq_ring;
+  ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+  ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  ring->entries = params.sq_entries;
+  return 1;
+}
+
+// Keeps up to a ring's worth of IORING_OP_STATX in flight, each with its own
+// statx buffer (a slot) until its completion is reaped. Returns 0 when the
+// ring is unusable, or the kernel cannot statx through it, so the caller
+// falls back to threads.
+static int collect_with_ring(MetaBatch *batch) {
+  MetaRing ring;
+  struct statx *results;
+  size_t *slot_requests;
+  unsigned *free_slots;
+  unsigned free_count;
+  size_t next = 0;
+  size_t done = 0;
+  int ok = 1;
+  unsigned i;
+
+  if (!ring_open(&ring)) {
+    return 0;
+  }
+  results = malloc(ring.entries * sizeof(*results));
+  slot_requests = malloc(ring.entries * sizeof(*slot_requests));
+  free_slots = malloc(ring.entries * sizeof(*free_slots));
+  if (!results || !slot_requests || !free_slots) {
+    ok = 0;
+    goto cleanup;
+  }
+  for (i = 0; i < ring.entries; ++i) {
+    free_slots[i] = i;
+  }
+  free_count = ring.entries;
+
+  while (done < batch->count && ok) {
+    unsigned tail = *ring.sq_tail;
+    unsigned head;
+    unsigned pending;
+    long entered;
+
+    while (next < batch->count && free_count > 0) {
+      unsigned slot = free_slots[--free_count];
+      unsigned index = tail & *ring.sq_mask;
+      struct io_uring_sqe *sqe = &ring.sqes[index];
+
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_STATX;
+      sqe->fd = AT_FDCWD;
+      sqe->addr = (uint64_t)(uintptr_t)request_path(batch, next);
+      sqe->len = request_mask(next);
+      sqe->off = (uint64_t)(uintptr_t)&results[slot];
+      sqe->statx_flags = 0;
+      sqe->user_data = slot;
+      ring.sq_array[index] = index;
+      slot_requests[slot] = next++;
+      tail++;
+    }
+    __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+    // Whatever the kernel has not consumed yet, including entries left over
+    // from an interrupted call.
+    pending = tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    entered = syscall(__NR_io_uring_enter, ring.fd, pending, 1, IORING_ENTER_GETEVENTS,
+                      NULL, 0);
+    if (entered < 0 && errno != EINTR) {
+      ok = 0;
+      break;
+    }
+
+    head = *ring.cq_head;
+    while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+      const struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+      unsigned slot = (unsigned)cqe->user_data;
+
+      if (cqe->res == 0) {
+        record_result(batch, slot_requests[slot], &results[slot]);
+      } else if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+        // Kernels before 5.6 reject the opcode itself.
+        ok = 0;
+      }
+      free_slots[free_count++] = slot;
+      done++;
+      head++;
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  // Never leave statx writing into buffers that are about to be freed.
+  while (ok == 0 && free_count < ring.entries && results) {
+    unsigned head;
+    if (syscall(__NR_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+        errno != EINTR) {
+      break;
+    }
+    head = *ring.cq_head;
+    while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+      free_count++;
+      head++;
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+  }
+
+cleanup:
+  ring_close(&ring);
+  free(results);
+  free(slot_requests);
+  free(free_slots);
+  return ok;
+}
+
+static void *meta_worker(void *arg) {
+  MetaBatch *batch = arg;
+
+  while (1) {
+    size_t request = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+    if (request >= batch->count) {
+      break;
+    }
+    stat_request(batch, request);
+  }
+  return NULL;
+}
+
+// Mostly waiting on the filesystem, so well more threads than cores.
+static void collect_with_threads(MetaBatch *batch) {
+  pthread_t workers[META_MAX_WORKERS];
+  long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t wanted = cpu_count > 0 ? (size_t)cpu_count * 4 : 4;
+  size_t started = 0;
+  size_t i;
+
+  if (wanted > META_MAX_WORKERS) {
+    wanted = META_MAX_WORKERS;
+  }
+  batch->next = 0;
+  while (started < wanted && started < batch->count &&
+         pthread_create(&workers[started], NULL, meta_worker, batch) == 0) {
+    started++;
+  }
+  // Whatever no thread could be started for is done here.
+  meta_worker(batch);
+  for (i = 0; i < started; ++i) {
+    pthread_join(workers[i], NULL);
+  }
+}
+
+int repo_meta_collect(const char *const *paths, size_t count, RepoMetaTable *table) {
+  MetaBatch batch;
+  size_t total = 0;
+  size_t cursor = 0;
+  size_t i;
+
+  memset(table, 0, sizeof(*table));
+  memset(&batch, 0, sizeof(batch));
+  table->count = count;
+  table->is_repo = calloc(count > 0 ? count : 1, sizeof(*table->is_repo));
+  table->head_mtime = calloc(count > 0 ? count : 1, sizeof(*table->head_mtime));
+  table->index_mtime = calloc(count > 0 ? count : 1, sizeof(*table->index_mtime));
+
+  batch.table = table;
+  batch.count = count * META_KIND_COUNT;
+  for (i = 0; i < count; ++i) {
+    size_t len = strlen(paths[i]);
+    int kind;
+    for (kind = 0; kind < META_KIND_COUNT; ++kind) {
+      total += len + strlen(META_SUFFIXES[kind]) + 1;
+    }
+  }
+  batch.paths = malloc(total > 0 ? total : 1);
+  batch.path_offsets = malloc((batch.count > 0 ? batch.count : 1) * sizeof(size_t));
+  if (!table->is_repo || !table->head_mtime || !table->index_mtime || !batch.paths ||
+      !batch.path_offsets) {
+    free(batch.paths);
+    free(batch.path_offsets);
+    repo_meta_free(table);
+    return 0;
+  }
+
+  // Every path the kernel will read stays put in one block until the end.
+  for (i = 0; i < batch.count; ++i) {
+    const char *path = paths[i / META_KIND_COUNT];
+    const char *suffix = META_SUFFIXES[i % META_KIND_COUNT];
+    size_t len = strlen(path);
+    size_t suffix_len = strlen(suffix);
+
+    batch.path_offsets[i] = cursor;
+    memcpy(batch.paths + cursor, path, len);
+    memcpy(batch.paths + cursor + len, suffix, suffix_len + 1);
+    cursor += len + suffix_len + 1;
+  }
+
+  if (batch.count <= META_INLINE_LIMIT) {
+    for (i = 0; i < batch.count; ++i) {
+      stat_request(&batch, i);
+    }
+  } else if (!collect_with_ring(&batch)) {
+    collect_with_threads(&batch);
+  }
+
+  free(batch.paths);
+  free(batch.path_offsets);
+  return 1;
+}
+
+void repo_meta_free(RepoMetaTable *table) {
+  free(table->is_repo);
+  free(table->head_mtime);
+  free(table->index_mtime);
+  memset(table, 0, sizeof(*table));
+}
@@ -0,0 +1,23 @@
+#ifndef meta_lib_included
+#define meta_lib_included
+
+#include <stddef.h>
+#include <stdint.h>
+
+// What a listing needs to know about each repo on disk, one array per field
+// indexed by listing position.
+typedef struct {
+  size_t count;
+  unsigned char *is_repo; // .git exists (followed if a symlink), as stat() sees it
+  int64_t *head_mtime;    // .git/HEAD, in ns; 0 when missing
+  int64_t *index_mtime;   // .git/index, in ns; 0 when missing
+} RepoMetaTable;
+
+// Stats .git, .git/HEAD and .git/index under every path. The calls are
+// batched through io_uring so thousands of repos on a slow filesystem
+// (NFS) are in flight at once; without io_uring a pool of threads calls
+// statx instead. Returns 0 only when memory ran out.
+int repo_meta_collect(const char *const *paths, size_t count, RepoMetaTable *table);
+void repo_meta_free(RepoMetaTable *table);
+
+#endif // meta_lib_included
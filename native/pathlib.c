@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <pwd.h>
 
@@ -108,3 +109,64 @@ char* make_absolute_path(const char* path) {
     free(expanded);
     return absolute;
 }
+
+// Resolve <xdg_value or fallback>/op, creating it when missing, and join
+// file_name onto it.
+static char* get_op_file_path(const char* xdg_value, const char* fallback,
+                              const char* file_name) {
+    char* base;
+
+    if (xdg_value && xdg_value[0] == '/') {
+        base = strdup(xdg_value);
+    } else {
+        base = expand_tilde(fallback);
+    }
+    if (!base) {
+        return NULL;
+    }
+
+    size_t base_len = strlen(base);
+    size_t name_len = strlen(file_name);
+    char* path = malloc(base_len + sizeof("/op/") + name_len);
+    if (!path) {
+        free(base);
+        return NULL;
+    }
+
+    strcpy(path, base);
+    free(base);
+
+    // Parent directories may legitimately exist already
+    mkdir(path, 0755);
+    strcat(path, "/op");
+    mkdir(path, 0755);
+    strcat(path, "/");
+    strcat(path, file_name);
+
+    return path; // Caller must free()
+}
+
+// Per-user op cache directory ($XDG_CACHE_HOME/op or ~/.cache/op)
+char* get_cache_file_path(const char* file_name) {
+    return get_op_file_path(getenv("XDG_CACHE_HOME"), "~/.cache", file_name);
+}
+
+// Per-user op data directory ($XDG_DATA_HOME/op or ~/.local/share/op)
+char* get_data_file_path(const char* file_name) {
+    char* local = expand_tilde("~/.local");
+    if (local) {
+        mkdir(local, 0755);
+        free(local);
+    }
+    return get_op_file_path(getenv("XDG_DATA_HOME"), "~/.local/share", file_name);
+}
+
+// Per-user op runtime directory for sockets ($XDG_RUNTIME_DIR/op), falling
+// back to the cache directory when no runtime directory is provided.
+char* get_runtime_file_path(const char* file_name) {
+    const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (runtime_dir && runtime_dir[0] == '/') {
+        return get_op_file_path(runtime_dir, NULL, file_name);
+    }
+    return get_cache_file_path(file_name);
+}
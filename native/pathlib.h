@@ -3,5 +3,8 @@
 
 char* expand_tilde(const char* path);
 char* make_absolute_path(const char* path);
+char* get_cache_file_path(const char* file_name);
+char* get_data_file_path(const char* file_name);
+char* get_runtime_file_path(const char* file_name);
 
 #endif // path_lib_included
@@ -0,0 +1,207 @@
+#include "reloadlib.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+// Editors either rewrite the file or rename a temporary over it, so the
+// directory is watched and events are matched on the file name.
+#define RELOAD_WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR)
+// Saves often arrive as a burst of events; parse once it goes quiet.
+#define RELOAD_SETTLE_MS 50
+
+struct ConfigReloader {
+  char *config_path;
+  // The resolved path, so a symlinked config is watched where it lives.
+  char *watch_path;
+  const char *config_name;
+  int inotify_fd;
+  int stop_pipe[2];
+  pthread_t thread;
+
+  pthread_mutex_t lock;
+  uint64_t current_fingerprint;
+  OpConfig *pending;
+  uint64_t pending_fingerprint;
+};
+
+// Reads every queued event; returns 1 if one of them names the config file.
+static int drain_events(ConfigReloader *reloader) {
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  int touched = 0;
+
+  while (1) {
+    ssize_t got = read(reloader->inotify_fd, buffer, sizeof(buffer));
+    char *cursor = buffer;
+
+    if (got <= 0) {
+      return touched;
+    }
+    while (cursor < buffer + got) {
+      const struct inotify_event *event = (const struct inotify_event *)cursor;
+      if (event->len > 0 && strcmp(event->name, reloader->config_name) == 0) {
+        touched = 1;
+      }
+      cursor += sizeof(*event) + event->len;
+    }
+  }
+}
+
+static void offer_config(ConfigReloader *reloader, OpConfig *config) {
+  uint64_t fingerprint = configFingerprint(config);
+
+  pthread_mutex_lock(&reloader->lock);
+  if (reloader->pending) {
+    freeConfig(reloader->pending);
+    reloader->pending = NULL;
+  }
+  // An edit that was reverted before anyone took it is not a change either.
+  if (fingerprint != reloader->current_fingerprint) {
+    reloader->pending = config;
+    reloader->pending_fingerprint = fingerprint;
+    config = NULL;
+  }
+  pthread_mutex_unlock(&reloader->lock);
+  freeConfig(config);
+}
+
+static void *reload_thread(void *arg) {
+  ConfigReloader *reloader = arg;
+  struct pollfd fds[2];
+
+  fds[0].fd = reloader->inotify_fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = reloader->stop_pipe[0];
+  fds[1].events = POLLIN;
+
+  while (1) {
+    int touched;
+    OpConfig *config;
+
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (fds[1].revents) {
+      break;
+    }
+
+    touched = drain_events(reloader);
+    while (poll(fds, 1, RELOAD_SETTLE_MS) > 0) {
+      touched |= drain_events(reloader);
+    }
+    if (!touched) {
+      continue;
+    }
+
+    // loadConfigs reports parse errors itself; the last good config stays.
+    config = loadConfigs(reloader->config_path);
+    if (config) {
+      offer_config(reloader, config);
+    }
+  }
+  return NULL;
+}
+
+ConfigReloader *config_reloader_start(const char *config_path, const OpConfig *current) {
+  ConfigReloader *reloader = calloc(1, sizeof(*reloader));
+  char *slash;
+
+  if (!reloader) {
+    return NULL;
+  }
+  reloader->inotify_fd = -1;
+  reloader->stop_pipe[0] = -1;
+  reloader->stop_pipe[1] = -1;
+  reloader->current_fingerprint = configFingerprint(current);
+  pthread_mutex_init(&reloader->lock, NULL);
+
+  reloader->config_path = strdup(config_path);
+  reloader->watch_path = realpath(config_path, NULL);
+  if (!reloader->watch_path) {
+    reloader->watch_path = strdup(config_path);
+  }
+  if (!reloader->config_path || !reloader->watch_path) {
+    goto fail;
+  }
+
+  slash = strrchr(reloader->watch_path, '/');
+  reloader->config_name = slash ? slash + 1 : reloader->watch_path;
+  reloader->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (reloader->inotify_fd < 0 || pipe2(reloader->stop_pipe, O_CLOEXEC) != 0) {
+    goto fail;
+  }
+
+  if (slash) {
+    int added;
+    *slash = '\0';
+    added = inotify_add_watch(reloader->inotify_fd,
+                              slash == reloader->watch_path ? "/" : reloader->watch_path,
+                              RELOAD_WATCH_MASK);
+    *slash = '/';
+    if (added < 0) {
+      goto fail;
+    }
+  } else if (inotify_add_watch(reloader->inotify_fd, ".", RELOAD_WATCH_MASK) < 0) {
+    goto fail;
+  }
+
+  if (pthread_create(&reloader->thread, NULL, reload_thread, reloader) != 0) {
+    goto fail;
+  }
+  return reloader;
+
+fail:
+  if (reloader->inotify_fd >= 0) {
+    close(reloader->inotify_fd);
+  }
+  if (reloader->stop_pipe[0] >= 0) {
+    close(reloader->stop_pipe[0]);
+    close(reloader->stop_pipe[1]);
+  }
+  pthread_mutex_destroy(&reloader->lock);
+  free(reloader->config_path);
+  free(reloader->watch_path);
+  free(reloader);
+  return NULL;
+}
+
+OpConfig *config_reloader_take(ConfigReloader *reloader) {
+  OpConfig *config;
+
+  pthread_mutex_lock(&reloader->lock);
+  config = reloader->pending;
+  if (config) {
+    reloader->current_fingerprint = reloader->pending_fingerprint;
+    reloader->pending = NULL;
+  }
+  pthread_mutex_unlock(&reloader->lock);
+  return config;
+}
+
+void config_reloader_stop(ConfigReloader *reloader) {
+  if (!reloader) {
+    return;
+  }
+
+  while (write(reloader->stop_pipe[1], "x", 1) < 0 && errno == EINTR) {
+  }
+  pthread_join(reloader->thread, NULL);
+
+  close(reloader->inotify_fd);
+  close(reloader->stop_pipe[0]);
+  close(reloader->stop_pipe[1]);
+  freeConfig(reloader->pending);
+  pthread_mutex_destroy(&reloader->lock);
+  free(reloader->config_path);
+  free(reloader->watch_path);
+  free(reloader);
+}
@@ -0,0 +1,19 @@
+#ifndef reload_lib_included
+#define reload_lib_included
+
+#include "configlib.h"
+
+// Watches config.json with inotify and re-parses it on a background thread
+// after every save, so a long-running picker can pick edits up between
+// iterations. Saves that leave every setting as it was, and saves that fail
+// to parse, never surface.
+typedef struct ConfigReloader ConfigReloader;
+
+// current is the config in use; only its fingerprint is kept. Returns NULL
+// when the config directory cannot be watched.
+ConfigReloader *config_reloader_start(const char *config_path, const OpConfig *current);
+// Hands over the newest differing config parsed since the last call, or NULL.
+OpConfig *config_reloader_take(ConfigReloader *reloader);
+void config_reloader_stop(ConfigReloader *reloader);
+
+#endif // reload_lib_included
@@ -0,0 +1,178 @@
+#include "shelllib.h"
+#include "spawnlib.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Keeps the socket clear of the fds the shell is handed (0-3).
+#define SHELL_FD_FLOOR 10
+
+struct ShellCoprocess {
+  pid_t pid;
+  int fd; // the shell's stdin: commands go in, exit statuses come back
+};
+
+// SIGINT is trapped rather than ignored so ^C still stops the command (traps
+// reset in subshells) while the shell itself keeps running. op ignores SIGINT
+// for as long as it waits on the command, see shell_coprocess_run.
+static const char SHELL_PRELUDE[] = "trap : INT\n";
+
+static int send_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return 0;
+    }
+    data += sent;
+    len -= (size_t)sent;
+  }
+  return 1;
+}
+
+ShellCoprocess *shell_coprocess_start(bool login) {
+  char *const sh_argv[] = {"/bin/sh", "-s", NULL};
+  char *const login_argv[] = {"/bin/sh", "-l", "-s", NULL};
+  ShellCoprocess *shell;
+  int pair[2];
+  int child_fd;
+  int fds[4] = {-1, -1, -1, STDIN_FILENO};
+
+  // A socket rather than two pipes: one fd both ways, and a shell that died
+  // shows up as EPIPE/EOF instead of SIGPIPE.
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) {
+    perror("socketpair");
+    return NULL;
+  }
+  child_fd = fcntl(pair[1], F_DUPFD_CLOEXEC, SHELL_FD_FLOOR);
+  close(pair[1]);
+  shell = calloc(1, sizeof(*shell));
+  if (child_fd < 0 || !shell) {
+    if (child_fd >= 0) {
+      close(child_fd);
+    }
+    close(pair[0]);
+    free(shell);
+    return NULL;
+  }
+
+  // fd 3 is op's stdin for the commands; the shell reads its own from fd 0.
+  fds[0] = child_fd;
+  shell->pid = spawn_process_fds(NULL, login ? login_argv : sh_argv, fds, 4);
+  close(child_fd);
+  shell->fd = pair[0];
+  if (shell->pid < 0 || !send_all(shell->fd, SHELL_PRELUDE, sizeof(SHELL_PRELUDE) - 1)) {
+    shell_coprocess_stop(shell);
+    return NULL;
+  }
+  return shell;
+}
+
+static void append_single_quoted(char **out, const char *text) {
+  char *cursor = *out;
+
+  *cursor++ = '\'';
+  for (; *text; ++text) {
+    if (*text == '\'') {
+      memcpy(cursor, "'\\''", 4);
+      cursor += 4;
+    } else {
+      *cursor++ = *text;
+    }
+  }
+  *cursor++ = '\'';
+  *out = cursor;
+}
+
+static size_t single_quoted_size(const char *text) {
+  size_t size = 2;
+
+  for (; *text; ++text) {
+    size += *text == '\'' ? 4 : 1;
+  }
+  return size;
+}
+
+// Reads the "<status>\n" the shell writes back after each command.
+static int read_status(int fd) {
+  char line[16];
+  size_t len = 0;
+
+  while (len < sizeof(line) - 1) {
+    ssize_t got = read(fd, line + len, 1);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      return -1;
+    }
+    if (line[len] == '\n') {
+      line[len] = '\0';
+      return atoi(line);
+    }
+    len++;
+  }
+  return -1;
+}
+
+int shell_coprocess_run(ShellCoprocess *shell, const char *working_dir,
+                        const char *command) {
+  static const char open_frame[] = "( cd -- ";
+  static const char eval_frame[] = " && eval ";
+  static const char close_frame[] = " ) <&3 3<&-; echo $? >&0\n";
+  struct sigaction ignore_sigint;
+  struct sigaction previous_sigint;
+  char *frame;
+  char *cursor;
+  int status;
+
+  frame = malloc(sizeof(open_frame) + single_quoted_size(working_dir) +
+                 sizeof(eval_frame) + single_quoted_size(command) +
+                 sizeof(close_frame));
+  if (!frame) {
+    return -1;
+  }
+
+  // The command is quoted and eval'd inside the subshell, so even a syntax
+  // error only ends the subshell.
+  cursor = frame;
+  memcpy(cursor, open_frame, sizeof(open_frame) - 1);
+  cursor += sizeof(open_frame) - 1;
+  append_single_quoted(&cursor, working_dir);
+  memcpy(cursor, eval_frame, sizeof(eval_frame) - 1);
+  cursor += sizeof(eval_frame) - 1;
+  append_single_quoted(&cursor, command);
+  memcpy(cursor, close_frame, sizeof(close_frame) - 1);
+  cursor += sizeof(close_frame) - 1;
+
+  // ^C reaches the whole foreground group; it is meant for the command, not
+  // for op waiting on it.
+  memset(&ignore_sigint, 0, sizeof(ignore_sigint));
+  ignore_sigint.sa_handler = SIG_IGN;
+  sigemptyset(&ignore_sigint.sa_mask);
+  sigaction(SIGINT, &ignore_sigint, &previous_sigint);
+  status = send_all(shell->fd, frame, (size_t)(cursor - frame)) ? read_status(shell->fd) : -1;
+  sigaction(SIGINT, &previous_sigint, NULL);
+  free(frame);
+  return status;
+}
+
+void shell_coprocess_stop(ShellCoprocess *shell) {
+  if (!shell) {
+    return;
+  }
+  // EOF on its stdin ends the shell once the current command is done.
+  close(shell->fd);
+  if (shell->pid > 0) {
+    (void)spawn_wait(shell->pid);
+  }
+  free(shell);
+}
@@ -0,0 +1,20 @@
+#ifndef shell_lib_included
+#define shell_lib_included
+
+#include <stdbool.h>
+
+// A /bin/sh kept running to run command lines one after another, so repeated
+// commands skip shell startup (and, for a login shell, the profile). Each
+// command runs in a subshell of it: cd, exit and variable changes do not
+// leak into the next one. Output goes straight to op's stdout/stderr and the
+// command reads op's stdin.
+typedef struct ShellCoprocess ShellCoprocess;
+
+ShellCoprocess *shell_coprocess_start(bool login);
+// Runs command in working_dir and returns its exit status, or -1 when the
+// shell is gone (a new one is needed).
+int shell_coprocess_run(ShellCoprocess *shell, const char *working_dir,
+                        const char *command);
+void shell_coprocess_stop(ShellCoprocess *shell);
+
+#endif // shell_lib_included
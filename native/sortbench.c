@@ -0,0 +1,149 @@
+// Times sort_name_offsets against the qsort_r + strcmp sort it replaced.
+// Build and run with `make bench`.
+#include "sortlib.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define BENCH_NAMES 50000
+#define BENCH_ROUNDS 7
+
+static int compare_names(const void *a, const void *b, void *names) {
+  return strcmp((const char *)names + *(const uint32_t *)a,
+                (const char *)names + *(const uint32_t *)b);
+}
+
+static int compare_names_ignore_case(const void *a, const void *b, void *names) {
+  return strcasecmp((const char *)names + *(const uint32_t *)a,
+                    (const char *)names + *(const uint32_t *)b);
+}
+
+// Equal names may land in either order, so compare the names themselves.
+static int same_order(const uint32_t *a, const uint32_t *b, size_t count,
+                      const char *names) {
+  size_t i;
+
+  for (i = 0; i < count; ++i) {
+    if (strcmp(names + a[i], names + b[i]) != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static double now_ms(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1e6;
+}
+
+// Repo-like names that share long prefixes, in a fixed pseudo-random order.
+static char *make_names(uint32_t *offsets, size_t count) {
+  static const char *const parts[] = {"api", "Billing", "core", "data", "edge",
+                                      "Identity", "jobs", "search"};
+  char *names = malloc(count * 64);
+  size_t len = 0;
+  uint32_t seed = 12345;
+  size_t i;
+
+  if (!names) {
+    return NULL;
+  }
+  for (i = 0; i < count; ++i) {
+    seed = seed * 1103515245u + 12345u;
+    offsets[i] = (uint32_t)len;
+    len += (size_t)sprintf(names + len, "company-service-%s-%s-%u",
+                           parts[(seed >> 16) % 8], parts[(seed >> 8) % 8],
+                           (unsigned)((seed >> 4) % 100000)) + 1;
+  }
+  return names;
+}
+
+static double time_qsort(uint32_t *work, const uint32_t *input, size_t count,
+                         char *names, int (*compare)(const void *, const void *, void *)) {
+  double best = 0.0;
+  int round;
+
+  for (round = 0; round < BENCH_ROUNDS; ++round) {
+    double start;
+    double elapsed;
+    memcpy(work, input, count * sizeof(*work));
+    start = now_ms();
+    qsort_r(work, count, sizeof(*work), compare, names);
+    elapsed = now_ms() - start;
+    if (round == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  return best;
+}
+
+static double time_multikey(uint32_t *work, const uint32_t *input, size_t count,
+                            const char *names, unsigned flags) {
+  double best = 0.0;
+  int round;
+
+  for (round = 0; round < BENCH_ROUNDS; ++round) {
+    double start;
+    double elapsed;
+    memcpy(work, input, count * sizeof(*work));
+    start = now_ms();
+    if (!sort_name_offsets(work, count, names, flags)) {
+      return -1.0;
+    }
+    elapsed = now_ms() - start;
+    if (round == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  return best;
+}
+
+int main(void) {
+  uint32_t *input = malloc(BENCH_NAMES * sizeof(*input));
+  uint32_t *expected = malloc(BENCH_NAMES * sizeof(*expected));
+  uint32_t *actual = malloc(BENCH_NAMES * sizeof(*actual));
+  char *names = NULL;
+  double plain_qsort, plain_multikey, case_qsort, case_multikey;
+  int ok = 0;
+
+  if (!input || !expected || !actual || !(names = make_names(input, BENCH_NAMES))) {
+    fprintf(stderr, "Out of memory\n");
+    goto cleanup;
+  }
+
+  plain_qsort = time_qsort(expected, input, BENCH_NAMES, names, compare_names);
+  plain_multikey = time_multikey(actual, input, BENCH_NAMES, names, 0);
+  if (plain_multikey < 0.0) {
+    fprintf(stderr, "Out of memory\n");
+    goto cleanup;
+  }
+  if (!same_order(expected, actual, BENCH_NAMES, names)) {
+    fprintf(stderr, "Multikey order differs from strcmp order\n");
+    goto cleanup;
+  }
+  case_qsort = time_qsort(expected, input, BENCH_NAMES, names, compare_names_ignore_case);
+  case_multikey = time_multikey(actual, input, BENCH_NAMES, names, SORT_IGNORE_CASE);
+  if (case_multikey < 0.0) {
+    fprintf(stderr, "Out of memory\n");
+    goto cleanup;
+  }
+
+  printf("%d names, best of %d:\n", BENCH_NAMES, BENCH_ROUNDS);
+  printf("  qsort_r strcmp      %7.2f ms\n", plain_qsort);
+  printf("  multikey            %7.2f ms\n", plain_multikey);
+  printf("  qsort_r strcasecmp  %7.2f ms\n", case_qsort);
+  printf("  multikey ignorecase %7.2f ms\n", case_multikey);
+  ok = 1;
+
+cleanup:
+  free(names);
+  free(actual);
+  free(expected);
+  free(input);
+  return ok ? 0 : 1;
+}
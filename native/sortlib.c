@@ -0,0 +1,206 @@
+#include "sortlib.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Below this many items the partitioning costs more than it saves.
+#define SORT_INSERTION_THRESHOLD 12
+
+// word caches the key's next 8 bytes from the current depth, big-endian and
+// zero-padded after the NUL, so one integer compare settles 8 bytes and the
+// partitions read the item array sequentially instead of chasing key.
+typedef struct {
+  const unsigned char *key;
+  uint64_t word;
+  uint32_t offset;
+} SortItem;
+
+static void swap_items(SortItem *a, SortItem *b) {
+  SortItem tmp = *a;
+  *a = *b;
+  *b = tmp;
+}
+
+// Only called for keys that did not end before depth.
+static void load_words(SortItem *items, size_t count, size_t depth) {
+  size_t i;
+
+  for (i = 0; i < count; ++i) {
+    const unsigned char *cursor = items[i].key + depth;
+    uint64_t word = 0;
+    int shift;
+
+    for (shift = 56; shift >= 0 && *cursor; shift -= 8) {
+      word |= (uint64_t)*cursor++ << shift;
+    }
+    items[i].word = word;
+  }
+}
+
+// All items share their first depth key bytes and have their words loaded.
+static void insertion_sort(SortItem *items, size_t count, size_t depth) {
+  size_t i;
+
+  for (i = 1; i < count; ++i) {
+    SortItem item = items[i];
+    size_t j = i;
+
+    while (j > 0) {
+      const SortItem *prev = &items[j - 1];
+      if (prev->word < item.word ||
+          (prev->word == item.word &&
+           ((item.word & 0xff) == 0 ||
+            strcmp((const char *)prev->key + depth + 8,
+                   (const char *)item.key + depth + 8) <= 0))) {
+        break;
+      }
+      items[j] = items[j - 1];
+      --j;
+    }
+    items[j] = item;
+  }
+}
+
+static size_t median_of_three(const SortItem *items, size_t a, size_t b, size_t c) {
+  uint64_t va = items[a].word;
+  uint64_t vb = items[b].word;
+  uint64_t vc = items[c].word;
+
+  if (va < vb) {
+    return vb < vc ? b : (va < vc ? c : a);
+  }
+  return vb > vc ? b : (va < vc ? a : c);
+}
+
+// Bentley & Sedgewick's multikey quicksort, eight key bytes at a time: a
+// three-way partition on the word at depth, recursing into the smaller and
+// larger parts at the same depth and moving on to the next word within the
+// equal part.
+static void multikey_sort(SortItem *items, size_t count, size_t depth) {
+  while (count > SORT_INSERTION_THRESHOLD) {
+    size_t pivot = median_of_three(items, 0, count / 2, count - 1);
+    uint64_t value;
+    size_t lt = 0;
+    size_t gt = count;
+    size_t i = 1;
+
+    swap_items(&items[0], &items[pivot]);
+    value = items[0].word;
+    while (i < gt) {
+      uint64_t word = items[i].word;
+      if (word < value) {
+        swap_items(&items[lt++], &items[i++]);
+      } else if (word > value) {
+        swap_items(&items[i], &items[--gt]);
+      } else {
+        ++i;
+      }
+    }
+
+    multikey_sort(items, lt, depth);
+    multikey_sort(items + gt, count - gt, depth);
+    if ((value & 0xff) == 0) {
+      // Every key in the middle ended within this word; they are equal.
+      return;
+    }
+    items += lt;
+    count = gt - lt;
+    depth += 8;
+    load_words(items, count, depth);
+  }
+  insertion_sort(items, count, depth);
+}
+
+// Writes the key for name: lower-cased letters for SORT_IGNORE_CASE, and
+// for SORT_NATURAL each digit run as '0', its length without leading zeros
+// and those digits, so a longer number sorts after a shorter one.
+static unsigned char *write_sort_key(unsigned char *out, const char *name,
+                                     unsigned flags) {
+  const unsigned char *cursor = (const unsigned char *)name;
+
+  while (*cursor) {
+    if ((flags & SORT_NATURAL) && *cursor >= '0' && *cursor <= '9') {
+      const unsigned char *digits = cursor;
+      size_t len;
+
+      while (*digits == '0' && digits[1] >= '0' && digits[1] <= '9') {
+        digits++;
+      }
+      for (len = 0; digits[len] >= '0' && digits[len] <= '9' && len < 255; ++len) {
+      }
+      *out++ = '0';
+      *out++ = (unsigned char)len;
+      memcpy(out, digits, len);
+      out += len;
+      cursor = digits + len;
+      continue;
+    }
+    *out++ = (flags & SORT_IGNORE_CASE) && *cursor >= 'A' && *cursor <= 'Z'
+                 ? (unsigned char)(*cursor - 'A' + 'a')
+                 : *cursor;
+    cursor++;
+  }
+  *out++ = '\0';
+  return out;
+}
+
+// An upper bound on what write_sort_key writes: two extra bytes per digit.
+static size_t sort_key_size(const char *name, unsigned flags) {
+  size_t size = 1;
+
+  for (; *name; ++name) {
+    size += (flags & SORT_NATURAL) && *name >= '0' && *name <= '9' ? 3 : 1;
+  }
+  return size;
+}
+
+int sort_name_offsets(uint32_t *offsets, size_t count, const char *names,
+                      unsigned flags) {
+  unsigned char *keys = NULL;
+  SortItem *items;
+  size_t i;
+
+  if (count < 2) {
+    return 1;
+  }
+
+  items = malloc(count * sizeof(*items));
+  if (!items) {
+    return 0;
+  }
+
+  if (flags == 0) {
+    for (i = 0; i < count; ++i) {
+      items[i].key = (const unsigned char *)names + offsets[i];
+      items[i].offset = offsets[i];
+    }
+  } else {
+    size_t key_size = 0;
+    unsigned char *out;
+
+    for (i = 0; i < count; ++i) {
+      key_size += sort_key_size(names + offsets[i], flags);
+    }
+    keys = malloc(key_size);
+    if (!keys) {
+      free(items);
+      return 0;
+    }
+    out = keys;
+    for (i = 0; i < count; ++i) {
+      items[i].key = out;
+      items[i].offset = offsets[i];
+      out = write_sort_key(out, names + offsets[i], flags);
+    }
+  }
+
+  load_words(items, count, 0);
+  multikey_sort(items, count, 0);
+  for (i = 0; i < count; ++i) {
+    offsets[i] = items[i].offset;
+  }
+
+  free(keys);
+  free(items);
+  return 1;
+}
@@ -0,0 +1,19 @@
+#ifndef sort_lib_included
+#define sort_lib_included
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SORT_IGNORE_CASE 1u // ASCII letters compare as lower case
+#define SORT_NATURAL 2u     // digit runs compare by value: "r9" before "r10"
+
+// Orders offsets into a blob of NUL-terminated names with a multikey
+// quicksort: names are compared one byte position at a time, so a long
+// shared prefix is examined once per partition instead of once per
+// comparison. With flags set, each name is first turned into a sort key
+// that compares bytewise in the wanted order. Returns 0 when the keys could
+// not be allocated (offsets are left as they were).
+int sort_name_offsets(uint32_t *offsets, size_t count, const char *names,
+                      unsigned flags);
+
+#endif // sort_lib_included
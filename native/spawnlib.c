@@ -0,0 +1,334 @@
+#include "spawnlib.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define SPAWN_CACHE_SIZE 16
+#define SPAWN_CAPTURE_CHUNK 65536
+#define SPAWN_CAPTURE_PIPE_SIZE (1024 * 1024)
+
+extern char **environ;
+
+typedef struct {
+  char *name;
+  char *path;
+} ResolvedCommand;
+
+// Every command op runs comes from a short fixed set (git, tmux, fzf, the
+// user's shell and editor), so a small table per process is enough. Paths in
+// it are freed on eviction, so resolved_lock is held from the lookup until
+// the spawn that uses the path has returned.
+static ResolvedCommand resolved_commands[SPAWN_CACHE_SIZE];
+static size_t resolved_count = 0;
+static pthread_mutex_t resolved_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int is_executable_file(const char *path) {
+  struct stat statbuf;
+  return stat(path, &statbuf) == 0 && S_ISREG(statbuf.st_mode) &&
+         access(path, X_OK) == 0;
+}
+
+static char *search_path(const char *name) {
+  const char *path_env = getenv("PATH");
+  const char *cursor;
+  size_t name_len = strlen(name);
+
+  if (!path_env) {
+    path_env = "/usr/local/bin:/usr/bin:/bin";
+  }
+
+  cursor = path_env;
+  while (1) {
+    const char *end = strchr(cursor, ':');
+    size_t dir_len = end ? (size_t)(end - cursor) : strlen(cursor);
+    char candidate[PATH_MAX];
+
+    // An empty PATH element means the current directory.
+    if (dir_len == 0) {
+      if (name_len + 1 <= sizeof(candidate)) {
+        memcpy(candidate, name, name_len + 1);
+        if (is_executable_file(candidate)) {
+          return strdup(candidate);
+        }
+      }
+    } else if (dir_len + 1 + name_len + 1 <= sizeof(candidate)) {
+      memcpy(candidate, cursor, dir_len);
+      candidate[dir_len] = '/';
+      memcpy(candidate + dir_len + 1, name, name_len + 1);
+      if (is_executable_file(candidate)) {
+        return strdup(candidate);
+      }
+    }
+
+    if (!end) {
+      return NULL;
+    }
+    cursor = end + 1;
+  }
+}
+
+static void forget_resolved(const char *name) {
+  size_t i;
+  for (i = 0; i < resolved_count; ++i) {
+    if (strcmp(resolved_commands[i].name, name) == 0) {
+      free(resolved_commands[i].name);
+      free(resolved_commands[i].path);
+      resolved_commands[i] = resolved_commands[--resolved_count];
+      return;
+    }
+  }
+}
+
+// Looks name up on PATH once per process. Names containing a slash are used
+// as given. Called with resolved_lock held.
+static const char *spawn_resolve(const char *name) {
+  char *path;
+  size_t i;
+
+  if (strchr(name, '/')) {
+    return name;
+  }
+
+  for (i = 0; i < resolved_count; ++i) {
+    if (strcmp(resolved_commands[i].name, name) == 0) {
+      return resolved_commands[i].path;
+    }
+  }
+
+  path = search_path(name);
+  if (!path) {
+    return NULL;
+  }
+
+  if (resolved_count == SPAWN_CACHE_SIZE) {
+    free(resolved_commands[0].name);
+    free(resolved_commands[0].path);
+    memmove(&resolved_commands[0], &resolved_commands[1],
+            (SPAWN_CACHE_SIZE - 1) * sizeof(resolved_commands[0]));
+    resolved_count--;
+  }
+
+  resolved_commands[resolved_count].name = strdup(name);
+  if (!resolved_commands[resolved_count].name) {
+    free(path);
+    return NULL;
+  }
+  resolved_commands[resolved_count].path = path;
+  return resolved_commands[resolved_count++].path;
+}
+
+static int spawn_resolved(pid_t *pid, const char *path, const char *working_dir,
+                          char *const argv[], const int fds[], size_t fd_count,
+                          char *const envp[]) {
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attributes;
+  sigset_t default_signals;
+  size_t i;
+  int error;
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawnattr_init(&attributes);
+
+  // Children must not inherit op's ignored SIGPIPE (see fzfPickerOpen).
+  sigemptyset(&default_signals);
+  sigaddset(&default_signals, SIGPIPE);
+  posix_spawnattr_setsigdefault(&attributes, &default_signals);
+  posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF);
+
+  error = 0;
+  for (i = fd_count; i-- > 0 && !error;) {
+    if (fds[i] >= 0 && fds[i] != (int)i) {
+      error = posix_spawn_file_actions_adddup2(&actions, fds[i], (int)i);
+    }
+  }
+  if (!error && working_dir) {
+    error = posix_spawn_file_actions_addchdir_np(&actions, working_dir);
+  }
+  if (!error) {
+    error = posix_spawn(pid, path, &actions, &attributes, argv, envp);
+  }
+
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attributes);
+  return error;
+}
+
+// Starts argv[0] (resolved through the PATH cache) with fds[i] as its fd i,
+// or the inherited one for -1, and envp as its environment. Targets are
+// filled highest first, so a source may be a lower target (fds[3] =
+// STDIN_FILENO) but never a higher one. Returns the pid, or -1 after
+// reporting why nothing was started.
+pid_t spawn_process_env(const char *working_dir, char *const argv[], const int fds[],
+                        size_t fd_count, char *const envp[]) {
+  const char *path;
+  pid_t pid = -1;
+  int error;
+
+  pthread_mutex_lock(&resolved_lock);
+  path = spawn_resolve(argv[0]);
+  if (!path) {
+    pthread_mutex_unlock(&resolved_lock);
+    fprintf(stderr, "Command not found: %s\n", argv[0]);
+    return -1;
+  }
+
+  error = spawn_resolved(&pid, path, working_dir, argv, fds, fd_count, envp);
+  if (error == ENOENT && path != argv[0]) {
+    // The cached binary went away (e.g. upgraded); look it up again.
+    forget_resolved(argv[0]);
+    path = spawn_resolve(argv[0]);
+    error = path ? spawn_resolved(&pid, path, working_dir, argv, fds, fd_count, envp)
+                 : ENOENT;
+  }
+  pthread_mutex_unlock(&resolved_lock);
+
+  if (error != 0) {
+    fprintf(stderr, "Failed to start %s: %s\n", argv[0], strerror(error));
+    return -1;
+  }
+  return pid;
+}
+
+pid_t spawn_process_fds(const char *working_dir, char *const argv[], const int fds[],
+                        size_t fd_count) {
+  return spawn_process_env(working_dir, argv, fds, fd_count, environ);
+}
+
+pid_t spawn_process_io(const char *working_dir, char *const argv[], int stdin_fd,
+                       int stdout_fd, int stderr_fd) {
+  const int fds[] = {stdin_fd, stdout_fd, stderr_fd};
+  return spawn_process_fds(working_dir, argv, fds, 3);
+}
+
+pid_t spawn_process(const char *working_dir, char *const argv[], int stdin_fd,
+                    int stdout_fd) {
+  return spawn_process_io(working_dir, argv, stdin_fd, stdout_fd, -1);
+}
+
+// Returns the exit code, or -1 if the child did not exit normally.
+int spawn_wait(pid_t pid) {
+  int status = 0;
+
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) {
+      perror("waitpid");
+      return -1;
+    }
+  }
+
+  if (WIFEXITED(status)) {
+    return WEXITSTATUS(status);
+  }
+  return -1;
+}
+
+int spawn_run(const char *working_dir, char *const argv[]) {
+  pid_t pid = spawn_process(working_dir, argv, -1, -1);
+  if (pid < 0) {
+    return -1;
+  }
+  return spawn_wait(pid);
+}
+
+// Runs argv and returns everything it wrote to stdout (and stderr when
+// merge_stderr is set), NUL-terminated. Output is read straight into the
+// result buffer in large chunks.
+char *spawn_capture(const char *working_dir, char *const argv[], int merge_stderr,
+                    size_t *output_len, int *exit_code) {
+  int pipefd[2];
+  char *output = NULL;
+  size_t len = 0;
+  size_t cap = 0;
+  int failed = 0;
+  int status;
+  pid_t pid;
+
+  if (exit_code) {
+    *exit_code = -1;
+  }
+
+  if (pipe2(pipefd, O_CLOEXEC) != 0) {
+    perror("pipe");
+    return NULL;
+  }
+  (void)fcntl(pipefd[0], F_SETPIPE_SZ, SPAWN_CAPTURE_PIPE_SIZE);
+
+  pid = spawn_process_io(working_dir, argv, -1, pipefd[1],
+                         merge_stderr ? pipefd[1] : -1);
+  close(pipefd[1]);
+  if (pid < 0) {
+    close(pipefd[0]);
+    return NULL;
+  }
+
+  while (1) {
+    ssize_t bytes_read;
+
+    if (!failed && cap - len < SPAWN_CAPTURE_CHUNK + 1) {
+      size_t new_cap = cap == 0 ? SPAWN_CAPTURE_CHUNK * 2 : cap * 2;
+      char *new_output = new_cap > cap ? realloc(output, new_cap) : NULL;
+      if (!new_output) {
+        // Keep draining so the child is not blocked on a full pipe.
+        failed = 1;
+      } else {
+        output = new_output;
+        cap = new_cap;
+      }
+    }
+
+    if (failed) {
+      char discard[4096];
+      bytes_read = read(pipefd[0], discard, sizeof(discard));
+    } else {
+      bytes_read = read(pipefd[0], output + len, cap - len - 1);
+    }
+
+    if (bytes_read < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      failed = 1;
+      break;
+    }
+    if (bytes_read == 0) {
+      break;
+    }
+    if (!failed) {
+      len += (size_t)bytes_read;
+    }
+  }
+
+  close(pipefd[0]);
+  status = spawn_wait(pid);
+
+  if (failed) {
+    free(output);
+    return NULL;
+  }
+
+  if (!output) {
+    output = malloc(1);
+    if (!output) {
+      return NULL;
+    }
+  }
+  output[len] = '\0';
+
+  if (output_len) {
+    *output_len = len;
+  }
+  if (exit_code) {
+    *exit_code = status;
+  }
+  return output;
+}
@@ -0,0 +1,20 @@
+#ifndef spawn_lib_included
+#define spawn_lib_included
+
+#include <stddef.h>
+#include <sys/types.h>
+
+pid_t spawn_process(const char *working_dir, char *const argv[], int stdin_fd,
+                    int stdout_fd);
+pid_t spawn_process_fds(const char *working_dir, char *const argv[], const int fds[],
+                        size_t fd_count);
+pid_t spawn_process_env(const char *working_dir, char *const argv[], const int fds[],
+                        size_t fd_count, char *const envp[]);
+pid_t spawn_process_io(const char *working_dir, char *const argv[], int stdin_fd,
+                       int stdout_fd, int stderr_fd);
+int spawn_wait(pid_t pid);
+int spawn_run(const char *working_dir, char *const argv[]);
+char *spawn_capture(const char *working_dir, char *const argv[], int merge_stderr,
+                    size_t *output_len, int *exit_code);
+
+#endif // spawn_lib_included
@@ -0,0 +1,522 @@
+#include "synclib.h"
+#include "gitlib.h"
+#include "spawnlib.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SYNC_TAIL_SIZE 512
+#define SYNC_REDRAW_INTERVAL_NS 100000000L
+#define SYNC_POLL_INTERVAL_MS 50
+
+typedef enum {
+  SYNC_QUEUED,
+  SYNC_CHECKING,
+  SYNC_PULLING,
+  SYNC_UPDATED,
+  SYNC_CURRENT,
+  SYNC_DIRTY,
+  SYNC_SKIPPED,
+  SYNC_FAILED,
+  SYNC_STATE_COUNT
+} SyncState;
+
+static const char *const SYNC_STATE_LABELS[SYNC_STATE_COUNT] = {
+    "queued", "checking", "pulling", "updated",
+    "current", "dirty",   "skipped", "failed",
+};
+
+typedef struct {
+  const char *name;
+  const char *path;
+  int is_repo; // -1 until checked
+  SyncState state;
+  pid_t pid;
+  int pidfd;
+  int out_fd;
+  size_t output_bytes;
+  char tail[SYNC_TAIL_SIZE];
+  size_t tail_len;
+  char *detail;
+  struct timespec started;
+} SyncJob;
+
+typedef struct {
+  SyncJob *jobs;
+  size_t count;
+  const size_t *schedule; // start order, NULL for listing order
+  size_t next;
+  size_t running;
+  size_t counts[SYNC_STATE_COUNT];
+  int epoll_fd;
+  int null_fd;
+  int polling;
+  int live;
+  int live_lines;
+  struct timespec last_redraw;
+  struct timespec started;
+} SyncRun;
+
+static long elapsed_ns(const struct timespec *since) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long)(now.tv_sec - since->tv_sec) * 1000000000L +
+         (now.tv_nsec - since->tv_nsec);
+}
+
+// epoll keys carry the job index and whether the fd is the job's pidfd.
+static uint64_t event_key(size_t index, int is_pidfd) {
+  return ((uint64_t)index << 1) | (is_pidfd ? 1u : 0u);
+}
+
+static int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+  (void)pid;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+static void keep_tail(SyncJob *job, const char *data, size_t len) {
+  job->output_bytes += len;
+  if (len >= SYNC_TAIL_SIZE) {
+    memcpy(job->tail, data + len - SYNC_TAIL_SIZE, SYNC_TAIL_SIZE);
+    job->tail_len = SYNC_TAIL_SIZE;
+    return;
+  }
+  if (job->tail_len + len > SYNC_TAIL_SIZE) {
+    size_t drop = job->tail_len + len - SYNC_TAIL_SIZE;
+    memmove(job->tail, job->tail + drop, job->tail_len - drop);
+    job->tail_len -= drop;
+  }
+  memcpy(job->tail + job->tail_len, data, len);
+  job->tail_len += len;
+}
+
+// Reads whatever the child has written so far without blocking; helpers such
+// as an ssh control master can keep the pipe open after git itself exits.
+static void drain_output(SyncJob *job) {
+  char chunk[4096];
+
+  while (job->out_fd >= 0) {
+    ssize_t got = read(job->out_fd, chunk, sizeof(chunk));
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      if (got == 0) {
+        close(job->out_fd);
+        job->out_fd = -1;
+      }
+      return;
+    }
+    keep_tail(job, chunk, (size_t)got);
+  }
+}
+
+// The reason a repo failed: git's last "fatal:"/"error:" line, falling back
+// to the last non-empty line of output.
+static char *failure_reason(const SyncJob *job) {
+  size_t best_start = 0;
+  size_t best_end = 0;
+  size_t start = 0;
+  int best_is_error = 0;
+  char *line;
+
+  while (start < job->tail_len) {
+    const char *newline = memchr(job->tail + start, '\n', job->tail_len - start);
+    size_t end = newline ? (size_t)(newline - job->tail) : job->tail_len;
+    size_t trimmed = end;
+    int is_error;
+
+    while (trimmed > start &&
+           (job->tail[trimmed - 1] == '\r' || job->tail[trimmed - 1] == ' ')) {
+      trimmed--;
+    }
+
+    is_error = (trimmed - start >= 6 && memcmp(job->tail + start, "fatal:", 6) == 0) ||
+               (trimmed - start >= 6 && memcmp(job->tail + start, "error:", 6) == 0);
+    if (trimmed > start && (is_error || !best_is_error)) {
+      best_start = start;
+      best_end = trimmed;
+      best_is_error = is_error;
+    }
+    start = end + 1;
+  }
+
+  if (best_end == best_start) {
+    return NULL;
+  }
+
+  line = malloc(best_end - best_start + 1);
+  if (line) {
+    memcpy(line, job->tail + best_start, best_end - best_start);
+    line[best_end - best_start] = '\0';
+  }
+  return line;
+}
+
+static void clear_live_block(SyncRun *run) {
+  if (run->live && run->live_lines > 0) {
+    printf("\033[%dA\033[J", run->live_lines);
+    run->live_lines = 0;
+  }
+}
+
+static void draw_live_block(SyncRun *run) {
+  size_t i;
+
+  if (!run->live) {
+    return;
+  }
+
+  clear_live_block(run);
+  printf("[%zu/%zu] %zu running, %zu updated, %zu dirty, %zu failed\n",
+         run->counts[SYNC_UPDATED] + run->counts[SYNC_CURRENT] +
+             run->counts[SYNC_DIRTY] + run->counts[SYNC_SKIPPED] +
+             run->counts[SYNC_FAILED],
+         run->count, run->running, run->counts[SYNC_UPDATED],
+         run->counts[SYNC_DIRTY], run->counts[SYNC_FAILED]);
+  run->live_lines = 1;
+
+  for (i = 0; i < run->count; ++i) {
+    const SyncJob *job = &run->jobs[i];
+    if (job->state == SYNC_CHECKING || job->state == SYNC_PULLING) {
+      printf("  %-8s %s (%.1fs)\n", SYNC_STATE_LABELS[job->state], job->name,
+             (double)elapsed_ns(&job->started) / 1e9);
+      run->live_lines++;
+    }
+  }
+
+  fflush(stdout);
+  clock_gettime(CLOCK_MONOTONIC, &run->last_redraw);
+}
+
+static void finish_job(SyncRun *run, SyncJob *job, SyncState state) {
+  job->state = state;
+  run->counts[state]++;
+
+  if (state == SYNC_SKIPPED) {
+    return;
+  }
+
+  clear_live_block(run);
+  if (job->detail) {
+    printf("  %-8s %s: %s\n", SYNC_STATE_LABELS[state], job->name, job->detail);
+  } else {
+    printf("  %-8s %s\n", SYNC_STATE_LABELS[state], job->name);
+  }
+  if (!run->live) {
+    fflush(stdout);
+  }
+}
+
+static int launch_git(SyncRun *run, size_t index, char *const argv[],
+                      int capture_stderr) {
+  SyncJob *job = &run->jobs[index];
+  struct epoll_event event;
+  int pipefd[2];
+
+  if (pipe2(pipefd, O_CLOEXEC) != 0) {
+    return 0;
+  }
+
+  job->pid = spawn_process_io(job->path, argv, run->null_fd, pipefd[1],
+                              capture_stderr ? pipefd[1] : run->null_fd);
+  close(pipefd[1]);
+  if (job->pid < 0) {
+    close(pipefd[0]);
+    return 0;
+  }
+
+  // Only op's end is non-blocking; git keeps a normal blocking stdout.
+  (void)fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
+  job->out_fd = pipefd[0];
+  job->output_bytes = 0;
+  job->tail_len = 0;
+
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.u64 = event_key(index, 0);
+  (void)epoll_ctl(run->epoll_fd, EPOLL_CTL_ADD, job->out_fd, &event);
+
+  job->pidfd = open_pidfd(job->pid);
+  if (job->pidfd >= 0) {
+    event.data.u64 = event_key(index, 1);
+    (void)epoll_ctl(run->epoll_fd, EPOLL_CTL_ADD, job->pidfd, &event);
+  } else {
+    run->polling = 1;
+  }
+  return 1;
+}
+
+static void start_next_job(SyncRun *run) {
+  while (run->next < run->count) {
+    size_t index = run->schedule ? run->schedule[run->next++] : run->next++;
+    SyncJob *job = &run->jobs[index];
+    char *const status_argv[] = {"git", "status", "--porcelain", "--untracked-files=no",
+                                 NULL};
+    char *const pull_argv[] = {"git", "pull", NULL};
+    GitTreeState tree_state;
+    struct stat statbuf;
+    char git_path[4096];
+
+    // Worktrees have a .git file rather than a directory.
+    if (job->is_repo < 0) {
+      job->is_repo = snprintf(git_path, sizeof(git_path), "%s/.git", job->path) <
+                         (int)sizeof(git_path) &&
+                     stat(git_path, &statbuf) == 0;
+    }
+    if (!job->is_repo) {
+      finish_job(run, job, SYNC_SKIPPED);
+      continue;
+    }
+
+    // Most repos are settled from .git/index alone, skipping one git run.
+    tree_state = git_tree_state(job->path);
+    if (tree_state == GIT_TREE_DIRTY) {
+      finish_job(run, job, SYNC_DIRTY);
+      continue;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &job->started);
+    if (tree_state == GIT_TREE_CLEAN) {
+      if (!launch_git(run, index, pull_argv, 1)) {
+        job->detail = strdup("could not start git pull");
+        finish_job(run, job, SYNC_FAILED);
+        continue;
+      }
+      job->state = SYNC_PULLING;
+      run->running++;
+      return;
+    }
+
+    if (!launch_git(run, index, status_argv, 0)) {
+      job->detail = strdup("could not start git status");
+      finish_job(run, job, SYNC_FAILED);
+      continue;
+    }
+
+    job->state = SYNC_CHECKING;
+    run->running++;
+    return;
+  }
+}
+
+static void job_exited(SyncRun *run, size_t index, int exit_code) {
+  SyncJob *job = &run->jobs[index];
+
+  drain_output(job);
+  if (job->out_fd >= 0) {
+    close(job->out_fd);
+    job->out_fd = -1;
+  }
+  if (job->pidfd >= 0) {
+    close(job->pidfd);
+    job->pidfd = -1;
+  }
+  job->pid = -1;
+
+  if (job->state == SYNC_CHECKING) {
+    char *const pull_argv[] = {"git", "pull", NULL};
+
+    if (exit_code != 0) {
+      job->detail = strdup("git status failed");
+    } else if (job->output_bytes > 0) {
+      finish_job(run, job, SYNC_DIRTY);
+      run->running--;
+      return;
+    } else if (launch_git(run, index, pull_argv, 1)) {
+      job->state = SYNC_PULLING;
+      clock_gettime(CLOCK_MONOTONIC, &job->started);
+      return;
+    } else {
+      job->detail = strdup("could not start git pull");
+    }
+    finish_job(run, job, SYNC_FAILED);
+    run->running--;
+    return;
+  }
+
+  run->running--;
+  if (exit_code != 0) {
+    job->detail = failure_reason(job);
+    finish_job(run, job, SYNC_FAILED);
+  } else if (memmem(job->tail, job->tail_len, "Already up to date",
+                    sizeof("Already up to date") - 1) != NULL) {
+    finish_job(run, job, SYNC_CURRENT);
+  } else {
+    finish_job(run, job, SYNC_UPDATED);
+  }
+}
+
+static void reap_job(SyncRun *run, size_t index, int blocking) {
+  SyncJob *job = &run->jobs[index];
+  int status = 0;
+  pid_t reaped;
+
+  do {
+    reaped = waitpid(job->pid, &status, blocking ? 0 : WNOHANG);
+  } while (reaped < 0 && errno == EINTR);
+
+  if (reaped == job->pid) {
+    job_exited(run, index, WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+  } else if (reaped < 0) {
+    job_exited(run, index, -1);
+  }
+}
+
+static void print_summary(const SyncRun *run) {
+  size_t i;
+  int state;
+
+  printf("\nSynced %zu repos in %.1fs: %zu updated, %zu up to date, %zu dirty, "
+         "%zu failed",
+         run->count - run->counts[SYNC_SKIPPED],
+         (double)elapsed_ns(&run->started) / 1e9, run->counts[SYNC_UPDATED],
+         run->counts[SYNC_CURRENT], run->counts[SYNC_DIRTY],
+         run->counts[SYNC_FAILED]);
+  if (run->counts[SYNC_SKIPPED] > 0) {
+    printf(", %zu skipped (not git)", run->counts[SYNC_SKIPPED]);
+  }
+  printf("\n");
+
+  for (state = SYNC_DIRTY; state <= SYNC_FAILED; ++state) {
+    if (state == SYNC_SKIPPED || run->counts[state] == 0) {
+      continue;
+    }
+    printf("%s:\n", state == SYNC_DIRTY ? "Dirty" : "Failed");
+    for (i = 0; i < run->count; ++i) {
+      const SyncJob *job = &run->jobs[i];
+      if ((int)job->state != state) {
+        continue;
+      }
+      if (job->detail) {
+        printf("  %s: %s\n", job->name, job->detail);
+      } else {
+        printf("  %s\n", job->name);
+      }
+    }
+  }
+  fflush(stdout);
+}
+
+int sync_repos(const char *const *names, const char *const *paths,
+               const unsigned char *is_repo, const size_t *schedule, size_t count,
+               size_t max_workers) {
+  SyncRun run;
+  size_t i;
+  int ok;
+
+  memset(&run, 0, sizeof(run));
+  run.count = count;
+  run.schedule = schedule;
+  run.live = isatty(STDOUT_FILENO);
+  clock_gettime(CLOCK_MONOTONIC, &run.started);
+  if (max_workers == 0) {
+    max_workers = 1;
+  }
+
+  run.jobs = calloc(count > 0 ? count : 1, sizeof(*run.jobs));
+  run.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  run.null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+  if (!run.jobs || run.epoll_fd < 0 || run.null_fd < 0) {
+    perror("sync");
+    free(run.jobs);
+    if (run.epoll_fd >= 0) {
+      close(run.epoll_fd);
+    }
+    if (run.null_fd >= 0) {
+      close(run.null_fd);
+    }
+    return 0;
+  }
+
+  for (i = 0; i < count; ++i) {
+    run.jobs[i].name = names[i];
+    run.jobs[i].path = paths[i];
+    run.jobs[i].is_repo = is_repo ? is_repo[i] : -1;
+    run.jobs[i].pid = -1;
+    run.jobs[i].pidfd = -1;
+    run.jobs[i].out_fd = -1;
+  }
+
+  // A pull must never stop to ask for credentials on a terminal nobody is
+  // watching, and "Already up to date" is matched in C-locale output.
+  setenv("GIT_TERMINAL_PROMPT", "0", 1);
+  setenv("LC_ALL", "C", 1);
+
+  while (run.running < max_workers && run.next < run.count) {
+    start_next_job(&run);
+  }
+  draw_live_block(&run);
+
+  while (run.running > 0) {
+    struct epoll_event events[32];
+    int timeout = run.polling || run.live ? SYNC_POLL_INTERVAL_MS : -1;
+    int ready = epoll_wait(run.epoll_fd, events, 32, timeout);
+    int e;
+
+    if (ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("epoll_wait");
+      break;
+    }
+
+    for (e = 0; e < ready; ++e) {
+      size_t index = (size_t)(events[e].data.u64 >> 1);
+      SyncJob *job = &run.jobs[index];
+
+      if (events[e].data.u64 & 1) {
+        if (job->pid > 0) {
+          reap_job(&run, index, 1);
+        }
+      } else {
+        drain_output(job);
+      }
+    }
+
+    // Without pidfds (kernels before 5.3) exits are picked up by polling.
+    if (run.polling) {
+      for (i = 0; i < run.count; ++i) {
+        if (run.jobs[i].pid > 0 && run.jobs[i].pidfd < 0) {
+          reap_job(&run, i, 0);
+        }
+      }
+    }
+
+    while (run.running < max_workers && run.next < run.count) {
+      start_next_job(&run);
+    }
+
+    if (run.live && elapsed_ns(&run.last_redraw) >= SYNC_REDRAW_INTERVAL_NS) {
+      draw_live_block(&run);
+    }
+  }
+
+  clear_live_block(&run);
+  print_summary(&run);
+  ok = run.counts[SYNC_FAILED] == 0;
+
+  for (i = 0; i < count; ++i) {
+    free(run.jobs[i].detail);
+  }
+  free(run.jobs);
+  close(run.epoll_fd);
+  close(run.null_fd);
+  return ok;
+}
@@ -0,0 +1,15 @@
+#ifndef sync_lib_included
+#define sync_lib_included
+
+#include <stddef.h>
+
+// Runs the open-time update (a dirty check of tracked files, then git pull when
+// clean) across every repo with up to max_workers at once, printing a live
+// status table. is_repo, when given, says up front which paths have a .git;
+// otherwise each job checks. schedule, when given, is the order the jobs are
+// started in; the table keeps listing order. Returns 1 when no repo failed.
+int sync_repos(const char *const *names, const char *const *paths,
+               const unsigned char *is_repo, const size_t *schedule, size_t count,
+               size_t max_workers);
+
+#endif // sync_lib_included
@@ -0,0 +1,386 @@
+#include "templatelib.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define TEMPLATE_ENV_PREFIX "env:"
+
+typedef enum {
+  SEGMENT_LITERAL,
+  SEGMENT_VARIABLE,
+  SEGMENT_ENV,
+  SEGMENT_WORD_END, // only in CommandTemplate.words
+} SegmentKind;
+
+typedef struct {
+  SegmentKind kind;
+  TemplateVar var;   // SEGMENT_VARIABLE
+  const char *text;  // literal text, or the NUL-terminated variable name
+  size_t len;
+} TemplateSegment;
+
+struct CommandTemplate {
+  TemplateSegment *segments;
+  size_t segment_count;
+  unsigned variables;
+  int has_env; // references {{env:NAME}}
+  char *text;  // owned copy the segments point into
+
+  // The words sh would pass to exec, with quotes removed from the literals
+  // and SEGMENT_WORD_END after each word; NULL when it needs a real shell.
+  TemplateSegment *words;
+  size_t word_segment_count;
+  size_t word_count;
+  char *word_text; // unquoted literals the word segments point into
+};
+
+static const char *const VARIABLE_NAMES[TEMPLATE_VAR_COUNT] = {
+    [TEMPLATE_VAR_PATH] = "path",     [TEMPLATE_VAR_OPROOT] = "oproot",
+    [TEMPLATE_VAR_NAME] = "name",     [TEMPLATE_VAR_BRANCH] = "branch",
+    [TEMPLATE_VAR_ROOT] = "root",     [TEMPLATE_VAR_REMOTE] = "remote",
+};
+
+static void add_literal(CommandTemplate *tmpl, const char *text, size_t len) {
+  TemplateSegment *last = tmpl->segment_count > 0
+                              ? &tmpl->segments[tmpl->segment_count - 1]
+                              : NULL;
+
+  if (len == 0) {
+    return;
+  }
+  // Unknown placeholders are kept as text, so merge them with their
+  // neighbours instead of leaving extra segments behind.
+  if (last && last->kind == SEGMENT_LITERAL && last->text + last->len == text) {
+    last->len += len;
+    return;
+  }
+  tmpl->segments[tmpl->segment_count].kind = SEGMENT_LITERAL;
+  tmpl->segments[tmpl->segment_count].text = text;
+  tmpl->segments[tmpl->segment_count].len = len;
+  tmpl->segment_count++;
+}
+
+// Classifies the name between "{{" and "}}"; returns 0 for unknown names.
+static int add_reference(CommandTemplate *tmpl, char *name, size_t len) {
+  TemplateSegment *segment = &tmpl->segments[tmpl->segment_count];
+  size_t prefix_len = sizeof(TEMPLATE_ENV_PREFIX) - 1;
+  int var;
+
+  if (len > prefix_len && strncmp(name, TEMPLATE_ENV_PREFIX, prefix_len) == 0) {
+    segment->kind = SEGMENT_ENV;
+    segment->text = name + prefix_len;
+    segment->len = len - prefix_len;
+    name[len] = '\0';
+    tmpl->has_env = 1;
+    tmpl->segment_count++;
+    return 1;
+  }
+
+  for (var = 0; var < TEMPLATE_VAR_COUNT; ++var) {
+    if (strlen(VARIABLE_NAMES[var]) == len && strncmp(name, VARIABLE_NAMES[var], len) == 0) {
+      segment->kind = SEGMENT_VARIABLE;
+      segment->var = (TemplateVar)var;
+      segment->text = VARIABLE_NAMES[var];
+      segment->len = len;
+      tmpl->variables |= 1u << var;
+      tmpl->segment_count++;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Characters that make sh do more than split words when they are not quoted.
+static int is_shell_special(char c) {
+  return strchr("|&;<>()$`\\*?[]{}!\n", c) != NULL;
+}
+
+typedef struct {
+  CommandTemplate *tmpl;
+  char *out;       // next free byte of word_text
+  int in_word;
+  int first_word;  // still in argv[0], where NAME=value means an assignment
+} WordSplitter;
+
+static void word_add(WordSplitter *splitter, SegmentKind kind, TemplateVar var,
+                     const char *text, size_t len) {
+  CommandTemplate *tmpl = splitter->tmpl;
+  TemplateSegment *last = tmpl->word_segment_count > 0
+                              ? &tmpl->words[tmpl->word_segment_count - 1]
+                              : NULL;
+
+  splitter->in_word = 1;
+  if (kind == SEGMENT_LITERAL && last && last->kind == SEGMENT_LITERAL) {
+    last->len += len;
+    return;
+  }
+  tmpl->words[tmpl->word_segment_count].kind = kind;
+  tmpl->words[tmpl->word_segment_count].var = var;
+  tmpl->words[tmpl->word_segment_count].text = text;
+  tmpl->words[tmpl->word_segment_count].len = len;
+  tmpl->word_segment_count++;
+}
+
+static void word_end(WordSplitter *splitter) {
+  if (!splitter->in_word) {
+    return;
+  }
+  splitter->tmpl->words[splitter->tmpl->word_segment_count++].kind = SEGMENT_WORD_END;
+  splitter->tmpl->word_count++;
+  splitter->in_word = 0;
+  splitter->first_word = 0;
+}
+
+static void word_add_char(WordSplitter *splitter, char c) {
+  *splitter->out = c;
+  word_add(splitter, SEGMENT_LITERAL, TEMPLATE_VAR_COUNT, splitter->out, 1);
+  splitter->out++;
+}
+
+// Fills tmpl->words; returns 0 as soon as something needs a real shell.
+static int split_words(CommandTemplate *tmpl) {
+  WordSplitter splitter = {tmpl, tmpl->word_text, 0, 1};
+  char quote = '\0';
+  size_t i;
+
+  for (i = 0; i < tmpl->segment_count; ++i) {
+    const TemplateSegment *segment = &tmpl->segments[i];
+    size_t j;
+
+    if (segment->kind != SEGMENT_LITERAL) {
+      word_add(&splitter, segment->kind, segment->var, segment->text, segment->len);
+      continue;
+    }
+
+    for (j = 0; j < segment->len; ++j) {
+      char c = segment->text[j];
+
+      if (quote == '\'') {
+        if (c == '\'') {
+          quote = '\0';
+        } else {
+          word_add_char(&splitter, c);
+        }
+      } else if (quote == '"') {
+        if (c == '"') {
+          quote = '\0';
+        } else if (c == '$' || c == '`' || c == '\\') {
+          return 0;
+        } else {
+          word_add_char(&splitter, c);
+        }
+      } else if (c == ' ' || c == '\t') {
+        word_end(&splitter);
+      } else if (c == '\'' || c == '"') {
+        quote = c;
+        splitter.in_word = 1;
+      } else if (is_shell_special(c) || (!splitter.in_word && (c == '#' || c == '~')) ||
+                 (splitter.first_word && c == '=')) {
+        return 0;
+      } else {
+        word_add_char(&splitter, c);
+      }
+    }
+  }
+
+  if (quote != '\0') {
+    return 0;
+  }
+  word_end(&splitter);
+  return tmpl->word_count > 0;
+}
+
+// Sizes the word buffers and splits; a template that needs a shell simply
+// ends up without words.
+static int compile_words(CommandTemplate *tmpl) {
+  size_t text_len = 0;
+  size_t i;
+
+  for (i = 0; i < tmpl->segment_count; ++i) {
+    if (tmpl->segments[i].kind == SEGMENT_LITERAL) {
+      text_len += tmpl->segments[i].len;
+    }
+  }
+  // Each literal byte or reference adds at most one segment and closes at
+  // most one word.
+  tmpl->words =
+      malloc((2 * (text_len + tmpl->segment_count) + 1) * sizeof(*tmpl->words));
+  tmpl->word_text = malloc(text_len + 1);
+  if (!tmpl->words || !tmpl->word_text) {
+    return 0;
+  }
+
+  if (!split_words(tmpl)) {
+    free(tmpl->words);
+    free(tmpl->word_text);
+    tmpl->words = NULL;
+    tmpl->word_text = NULL;
+    tmpl->word_segment_count = 0;
+    tmpl->word_count = 0;
+  }
+  return 1;
+}
+
+CommandTemplate *template_compile(const char *text) {
+  CommandTemplate *tmpl = calloc(1, sizeof(*tmpl));
+  size_t max_segments = 1;
+  const char *scan;
+  char *cursor;
+
+  if (!tmpl) {
+    return NULL;
+  }
+
+  // Each "{{" can split off at most a reference and the literal after it.
+  for (scan = strstr(text, "{{"); scan; scan = strstr(scan + 2, "{{")) {
+    max_segments += 2;
+  }
+  tmpl->text = strdup(text);
+  tmpl->segments = malloc(max_segments * sizeof(*tmpl->segments));
+  if (!tmpl->text || !tmpl->segments) {
+    template_free(tmpl);
+    return NULL;
+  }
+
+  cursor = tmpl->text;
+  while (*cursor) {
+    char *open = strstr(cursor, "{{");
+    char *close = open ? strstr(open + 2, "}}") : NULL;
+
+    if (!open || !close) {
+      add_literal(tmpl, cursor, strlen(cursor));
+      break;
+    }
+    // In "{{{{path}}" the reference is the innermost "{{" before the "}}".
+    while ((scan = strstr(open + 1, "{{")) != NULL && scan < close) {
+      open = (char *)scan;
+    }
+
+    add_literal(tmpl, cursor, (size_t)(open - cursor));
+    if (!add_reference(tmpl, open + 2, (size_t)(close - open - 2))) {
+      add_literal(tmpl, open, (size_t)(close + 2 - open));
+    }
+    cursor = close + 2;
+  }
+
+  if (!compile_words(tmpl)) {
+    template_free(tmpl);
+    return NULL;
+  }
+  return tmpl;
+}
+
+void template_free(CommandTemplate *tmpl) {
+  if (!tmpl) {
+    return;
+  }
+  free(tmpl->words);
+  free(tmpl->word_text);
+  free(tmpl->segments);
+  free(tmpl->text);
+  free(tmpl);
+}
+
+unsigned template_variables(const CommandTemplate *tmpl) { return tmpl->variables; }
+
+static const char *segment_value(const TemplateSegment *segment,
+                                 const char *const values[TEMPLATE_VAR_COUNT],
+                                 size_t *len) {
+  const char *value;
+
+  switch (segment->kind) {
+  case SEGMENT_VARIABLE:
+    value = values[segment->var];
+    break;
+  case SEGMENT_ENV:
+    value = getenv(segment->text);
+    break;
+  default:
+    *len = segment->len;
+    return segment->text;
+  }
+  if (!value) {
+    value = "";
+  }
+  *len = strlen(value);
+  return value;
+}
+
+char *template_render(const CommandTemplate *tmpl,
+                      const char *const values[TEMPLATE_VAR_COUNT]) {
+  size_t total = 1;
+  size_t len;
+  size_t i;
+  char *output;
+  char *out;
+
+  for (i = 0; i < tmpl->segment_count; ++i) {
+    (void)segment_value(&tmpl->segments[i], values, &len);
+    total += len;
+  }
+
+  output = malloc(total);
+  if (!output) {
+    return NULL;
+  }
+
+  out = output;
+  for (i = 0; i < tmpl->segment_count; ++i) {
+    const char *value = segment_value(&tmpl->segments[i], values, &len);
+    memcpy(out, value, len);
+    out += len;
+  }
+  *out = '\0';
+  return output;
+}
+
+int template_is_direct(const CommandTemplate *tmpl) { return tmpl->words != NULL; }
+
+int template_inserts_raw(const CommandTemplate *tmpl) {
+  return tmpl->has_env || (tmpl->variables & (1u << TEMPLATE_VAR_OPROOT)) != 0;
+}
+
+char **template_render_argv(const CommandTemplate *tmpl,
+                            const char *const values[TEMPLATE_VAR_COUNT]) {
+  size_t total = 0;
+  size_t len;
+  size_t word = 0;
+  size_t i;
+  char **argv;
+  char *out;
+
+  if (!tmpl->words) {
+    return NULL;
+  }
+
+  for (i = 0; i < tmpl->word_segment_count; ++i) {
+    if (tmpl->words[i].kind == SEGMENT_WORD_END) {
+      total++;
+    } else {
+      (void)segment_value(&tmpl->words[i], values, &len);
+      total += len;
+    }
+  }
+
+  argv = malloc((tmpl->word_count + 1) * sizeof(*argv) + total);
+  if (!argv) {
+    return NULL;
+  }
+
+  out = (char *)(argv + tmpl->word_count + 1);
+  argv[0] = out;
+  for (i = 0; i < tmpl->word_segment_count; ++i) {
+    const char *value;
+
+    if (tmpl->words[i].kind == SEGMENT_WORD_END) {
+      *out++ = '\0';
+      argv[++word] = out;
+      continue;
+    }
+    value = segment_value(&tmpl->words[i], values, &len);
+    memcpy(out, value, len);
+    out += len;
+  }
+  argv[word] = NULL;
+  return argv;
+}
@@ -0,0 +1,43 @@
+#ifndef template_lib_included
+#define template_lib_included
+
+// Custom command templates are split once into literal text and {{variable}}
+// references, so rendering is a single copy into an exactly sized buffer and
+// the caller only looks up the variables a template actually uses.
+// {{env:NAME}} expands to $NAME at render time; unknown {{...}} stay as typed.
+typedef enum {
+  TEMPLATE_VAR_PATH,
+  TEMPLATE_VAR_OPROOT,
+  TEMPLATE_VAR_NAME,
+  TEMPLATE_VAR_BRANCH,
+  TEMPLATE_VAR_ROOT,
+  TEMPLATE_VAR_REMOTE,
+  TEMPLATE_VAR_COUNT,
+} TemplateVar;
+
+typedef struct CommandTemplate CommandTemplate;
+
+CommandTemplate *template_compile(const char *text);
+void template_free(CommandTemplate *tmpl);
+// Has bit (1u << var) set for every variable the template references.
+unsigned template_variables(const CommandTemplate *tmpl);
+// values[var] must be non-NULL for every referenced variable. Returns a
+// malloc'd command.
+char *template_render(const CommandTemplate *tmpl,
+                      const char *const values[TEMPLATE_VAR_COUNT]);
+// Whether the template is a plain command line sh would only split into
+// words: whitespace, '...' and "..." quoting and {{...}} references, with no
+// expansions, globs, redirections or operators. Such templates can be exec'd
+// without a shell.
+int template_is_direct(const CommandTemplate *tmpl);
+// Whether the template inserts a value unquoted ({{env:NAME}} or {{oproot}}).
+// A shell word-splits and expands such a value where direct exec would pass
+// it as one literal word.
+int template_inserts_raw(const CommandTemplate *tmpl);
+// Splits a direct template into a NULL-terminated argv with each value
+// inserted verbatim (no quoting needed). The vector and its strings are one
+// malloc'd block. Returns NULL for templates that are not direct.
+char **template_render_argv(const CommandTemplate *tmpl,
+                            const char *const values[TEMPLATE_VAR_COUNT]);
+
+#endif // template_lib_included
@@ -0,0 +1,340 @@
+#include "tmuxlib.h"
+#include "spawnlib.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define TMUX_MAX_ATTACH_ARGS 16
+#define TMUX_CLIENT_FLAGS_MIN_MAJOR 3
+#define TMUX_CLIENT_FLAGS_MIN_MINOR 2
+
+struct TmuxClient {
+  pid_t pid;
+  int fd;
+  int dead;
+  size_t pending_replies;
+  char *out;
+  size_t out_len;
+  size_t out_cap;
+  char *in;
+  size_t in_len;
+  size_t in_cap;
+};
+
+static int buffer_append(char **data, size_t *len, size_t *cap, const char *text,
+                         size_t text_len) {
+  if (*len + text_len + 1 > *cap) {
+    size_t new_cap = *cap == 0 ? 512 : *cap;
+    char *new_data;
+    while (new_cap < *len + text_len + 1) {
+      if (new_cap > SIZE_MAX / 2) {
+        return 0;
+      }
+      new_cap *= 2;
+    }
+    new_data = realloc(*data, new_cap);
+    if (!new_data) {
+      return 0;
+    }
+    *data = new_data;
+    *cap = new_cap;
+  }
+
+  memcpy(*data + *len, text, text_len);
+  *len += text_len;
+  (*data)[*len] = '\0';
+  return 1;
+}
+
+TmuxClient *tmux_client_open(const char *const *attach_argv) {
+  const char *argv[TMUX_MAX_ATTACH_ARGS + 3];
+  int fds[2];
+  TmuxClient *client;
+  size_t argc = 0;
+
+  argv[argc++] = "tmux";
+  argv[argc++] = "-C";
+  while (attach_argv && attach_argv[argc - 2]) {
+    if (argc - 2 >= TMUX_MAX_ATTACH_ARGS) {
+      return NULL;
+    }
+    argv[argc] = attach_argv[argc - 2];
+    argc++;
+  }
+  argv[argc] = NULL;
+
+  // A socket instead of two pipes: one fd both ways, and writes to a client
+  // that already exited fail with EPIPE instead of raising SIGPIPE.
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+    perror("socketpair");
+    return NULL;
+  }
+
+  client = calloc(1, sizeof(*client));
+  if (!client) {
+    close(fds[0]);
+    close(fds[1]);
+    return NULL;
+  }
+
+  client->pid = spawn_process(NULL, (char *const *)argv, fds[1], fds[1]);
+  close(fds[1]);
+  if (client->pid < 0) {
+    close(fds[0]);
+    free(client);
+    return NULL;
+  }
+
+  client->fd = fds[0];
+  return client;
+}
+
+int tmux_client_is_alive(const TmuxClient *client) {
+  return client && !client->dead;
+}
+
+// Single-quotes every argument for tmux's command parser; a quote inside an
+// argument is written as '\''.
+static int append_quoted(TmuxClient *client, const char *arg) {
+  const char *cursor;
+
+  if (strchr(arg, '\n')) {
+    return 0;
+  }
+
+  if (!buffer_append(&client->out, &client->out_len, &client->out_cap, "'", 1)) {
+    return 0;
+  }
+  for (cursor = arg; *cursor; ++cursor) {
+    const char *piece = *cursor == '\'' ? "'\\''" : cursor;
+    size_t piece_len = *cursor == '\'' ? 4 : 1;
+    if (!buffer_append(&client->out, &client->out_len, &client->out_cap, piece,
+                       piece_len)) {
+      return 0;
+    }
+  }
+  return buffer_append(&client->out, &client->out_len, &client->out_cap, "'", 1);
+}
+
+int tmux_client_queue(TmuxClient *client, const char *const *argv) {
+  size_t start_len = client->out_len;
+  size_t i;
+
+  if (client->dead) {
+    return 0;
+  }
+
+  for (i = 0; argv[i]; ++i) {
+    if ((i > 0 && !buffer_append(&client->out, &client->out_len,
+                                 &client->out_cap, " ", 1)) ||
+        !append_quoted(client, argv[i])) {
+      client->out_len = start_len;
+      return 0;
+    }
+  }
+
+  if (!buffer_append(&client->out, &client->out_len, &client->out_cap, "\n", 1)) {
+    client->out_len = start_len;
+    return 0;
+  }
+
+  client->pending_replies++;
+  return 1;
+}
+
+static int flush_queue(TmuxClient *client) {
+  size_t done = 0;
+
+  while (done < client->out_len) {
+    ssize_t written =
+        send(client->fd, client->out + done, client->out_len - done, MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      client->dead = 1;
+      return 0;
+    }
+    done += (size_t)written;
+  }
+
+  client->out_len = 0;
+  return 1;
+}
+
+// Returns the next complete line (without '\n') from the client, valid until
+// the next call, or NULL once the client is gone.
+static char *read_line(TmuxClient *client, size_t *consumed) {
+  while (1) {
+    char *newline = client->in_len > 0 ? memchr(client->in, '\n', client->in_len)
+                                       : NULL;
+    char chunk[4096];
+    ssize_t got;
+
+    if (newline) {
+      *newline = '\0';
+      *consumed = (size_t)(newline - client->in) + 1;
+      return client->in;
+    }
+
+    got = read(client->fd, chunk, sizeof(chunk));
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0 ||
+        !buffer_append(&client->in, &client->in_len, &client->in_cap, chunk,
+                       (size_t)got)) {
+      client->dead = 1;
+      return NULL;
+    }
+  }
+}
+
+static void consume_line(TmuxClient *client, size_t consumed) {
+  memmove(client->in, client->in + consumed, client->in_len - consumed);
+  client->in_len -= consumed;
+}
+
+// Reads the reply to the oldest queued command. Blocks from other sources
+// (flags 0, e.g. the attach itself) and notifications are skipped. Returns 1
+// on %end and 0 on %error or a lost client; *output gets the reply body.
+int tmux_client_result(TmuxClient *client, char **output) {
+  char *body = NULL;
+  size_t body_len = 0;
+  size_t body_cap = 0;
+  char block_number[32] = "";
+  int in_block = 0;
+  int ours = 0;
+
+  if (output) {
+    *output = NULL;
+  }
+
+  if (client->pending_replies == 0 || !flush_queue(client)) {
+    return 0;
+  }
+
+  while (1) {
+    size_t consumed = 0;
+    char *line = read_line(client, &consumed);
+
+    if (!line) {
+      free(body);
+      client->pending_replies = 0;
+      return 0;
+    }
+
+    if (!in_block) {
+      unsigned long long time_value;
+      unsigned long long number;
+      unsigned flags;
+
+      if (sscanf(line, "%%begin %llu %llu %u", &time_value, &number, &flags) == 3) {
+        in_block = 1;
+        ours = (flags & 1) != 0;
+        snprintf(block_number, sizeof(block_number), " %llu ", number);
+      } else if (strcmp(line, "%exit") == 0 || strncmp(line, "%exit ", 6) == 0) {
+        client->dead = 1;
+      }
+      consume_line(client, consumed);
+      continue;
+    }
+
+    if ((strncmp(line, "%end ", 5) == 0 || strncmp(line, "%error ", 7) == 0) &&
+        strstr(line, block_number) != NULL) {
+      int ok = line[1] == 'e' && line[2] == 'n';
+      consume_line(client, consumed);
+      in_block = 0;
+      if (!ours) {
+        body_len = 0;
+        continue;
+      }
+
+      client->pending_replies--;
+      if (output) {
+        *output = body ? body : strdup("");
+      } else {
+        free(body);
+      }
+      return ok;
+    }
+
+    if (ours && (!buffer_append(&body, &body_len, &body_cap, line, strlen(line)) ||
+                 !buffer_append(&body, &body_len, &body_cap, "\n", 1))) {
+      free(body);
+      client->dead = 1;
+      return 0;
+    }
+    consume_line(client, consumed);
+  }
+}
+
+// Drains every queued reply; returns 1 only if all of them succeeded.
+int tmux_client_sync(TmuxClient *client) {
+  int ok = 1;
+
+  while (client->pending_replies > 0) {
+    if (!tmux_client_result(client, NULL)) {
+      ok = 0;
+      if (client->dead) {
+        break;
+      }
+    }
+  }
+  return ok;
+}
+
+int tmux_client_run(TmuxClient *client, const char *const *argv, char **output) {
+  if (!tmux_client_queue(client, argv)) {
+    return 0;
+  }
+  return tmux_client_result(client, output);
+}
+
+void tmux_client_close(TmuxClient *client) {
+  if (!client) {
+    return;
+  }
+
+  // Queued commands must reach the server before EOF detaches the client.
+  if (!client->dead) {
+    (void)tmux_client_sync(client);
+  }
+
+  shutdown(client->fd, SHUT_WR);
+  close(client->fd);
+  (void)spawn_wait(client->pid);
+
+  free(client->out);
+  free(client->in);
+  free(client);
+}
+
+int tmux_supports_client_flags(void) {
+  static int supported = -1;
+
+  if (supported < 0) {
+    char *const argv[] = {"tmux", "-V", NULL};
+    char *output = spawn_capture(NULL, argv, 0, NULL, NULL);
+    const char *version = output ? strpbrk(output, "0123456789") : NULL;
+    int major;
+    int minor;
+
+    if (output && !version) {
+      // Builds from git report "tmux master" and are always new enough.
+      supported = 1;
+    } else {
+      supported = version && sscanf(version, "%d.%d", &major, &minor) == 2 &&
+                  (major > TMUX_CLIENT_FLAGS_MIN_MAJOR ||
+                   (major == TMUX_CLIENT_FLAGS_MIN_MAJOR &&
+                    minor >= TMUX_CLIENT_FLAGS_MIN_MINOR));
+    }
+    free(output);
+  }
+  return supported;
+}
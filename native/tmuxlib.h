@@ -0,0 +1,20 @@
+#ifndef tmux_lib_included
+#define tmux_lib_included
+
+// One long-lived `tmux -C` control-mode client. Commands are queued and
+// written together; replies come back in order as %begin/%end blocks.
+typedef struct TmuxClient TmuxClient;
+
+TmuxClient *tmux_client_open(const char *const *attach_argv);
+int tmux_client_is_alive(const TmuxClient *client);
+int tmux_client_queue(TmuxClient *client, const char *const *argv);
+int tmux_client_result(TmuxClient *client, char **output);
+int tmux_client_sync(TmuxClient *client);
+int tmux_client_run(TmuxClient *client, const char *const *argv, char **output);
+void tmux_client_close(TmuxClient *client);
+
+// Whether the installed tmux takes client flags (`-f no-output,...`), which
+// arrived in 3.2. Runs `tmux -V` once.
+int tmux_supports_client_flags(void);
+
+#endif // tmux_lib_included